@@ -5,10 +5,11 @@
 #include <sys/socket.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 
-static int createNonblocking()
+static int createNonblocking(sa_family_t family)
 {
-    int sockfd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int sockfd = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sockfd < 0)
     {
         LOG_FATAL("%s: %s : %d listen socket create err: %d \n", __FILE__, __FUNCTION__, __LINE__, errno);
@@ -16,21 +17,67 @@ static int createNonblocking()
     return sockfd;
 }
 
+// 绑定监听地址，Unix域地址先删掉残留的socket文件，网络地址开启端口复用
+static void bindListenAddress(int sockfd, const InetAddress &listenAddr)
+{
+    if (listenAddr.isUnix())
+    {
+        // Unix域socket文件在进程退出后会残留，确认没有进程在监听后才删掉
+        if (!Socket::removeStaleUnixPath(listenAddr))
+        {
+            LOG_FATAL("bind %s fail : %d \n", listenAddr.toIpPort().c_str(), errno);
+        }
+    }
+    else
+    {
+        int optval = 1;
+        ::setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+        ::setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof optval);
+    }
+    if (::bind(sockfd, listenAddr.getSockAddr(), listenAddr.getSockLen()) != 0)
+    {
+        LOG_FATAL("bind %s fail : %d \n", listenAddr.toIpPort().c_str(), errno);
+    }
+}
+
 Acceptor::Acceptor(EventLoop* loop, const InetAddress &listenAddr, bool reuserport)
     : loop_(loop),
-    acceptSocket_(createNonblocking()),
+    acceptSocket_(createNonblocking(listenAddr.family())),
     acceptChannel_(loop, acceptSocket_.fd()),
-    listenning_(false)
+    listenning_(false),
+    paused_(false)
 {
-    acceptSocket_.setReuseAddr(true);
-    acceptSocket_.setReusePort(true);
-    acceptSocket_.bindAddress(listenAddr); //bind
+    bindListenAddress(acceptSocket_.fd(), listenAddr); //bind
     //TcpServer::start() Acceptor.listen    有新用户连接，执行一个回调(connfd=> channel) =>loop
     // baseloop
     acceptChannel_.setReadCallback(std::bind(&Acceptor::handleRead, this));
 
 }
 
+Acceptor::Acceptor(EventLoop* loop, int listenFd)
+    : loop_(loop),
+    acceptSocket_(listenFd),
+    acceptChannel_(loop, listenFd),
+    listenning_(false),
+    paused_(false)
+{
+    // 继承来的fd可能是阻塞的，多个进程共享时必须非阻塞，否则被别的进程抢先accept后会卡住
+    int flags = ::fcntl(listenFd, F_GETFL, 0);
+    ::fcntl(listenFd, F_SETFL, flags | O_NONBLOCK);
+    acceptChannel_.setReadCallback(std::bind(&Acceptor::handleRead, this));
+}
+
+int Acceptor::createListenSocket(const InetAddress &listenAddr)
+{
+    int sockfd = createNonblocking(listenAddr.family());
+    bindListenAddress(sockfd, listenAddr);
+    if (::listen(sockfd, 1024) != 0)
+    {
+        LOG_FATAL("listen %s fail : %d \n", listenAddr.toIpPort().c_str(), errno);
+    }
+    return sockfd;
+}
+
 Acceptor::~Acceptor()
 {
     acceptChannel_.disableAll();
@@ -53,7 +100,7 @@ void Acceptor::handleRead()
             ::close(connfd);
         } 
     }
-    else
+    else if (errno != EAGAIN)   //多个进程共享监听socket时，连接可能已被别的进程取走
     {
         LOG_ERROR("%s: %s : %d accept socket err: %d \n", __FILE__, __FUNCTION__, __LINE__, errno);
         if (errno == EMFILE)
@@ -67,5 +114,41 @@ void Acceptor::listen()
 {
     listenning_ = true;
     acceptSocket_.listen();
-    acceptChannel_.enabeReading();  //accptChannel 注册=> Poller
-}
\ No newline at end of file
+    if (!paused_)
+    {
+        acceptChannel_.enabeReading();  //accptChannel 注册=> Poller
+    }
+}
+
+void Acceptor::stop()
+{
+    if (listenning_)
+    {
+        listenning_ = false;
+        acceptChannel_.disableAll();
+    }
+}
+
+void Acceptor::pause()
+{
+    if (!paused_)
+    {
+        paused_ = true;
+        if (listenning_)
+        {
+            acceptChannel_.disableReading();
+        }
+    }
+}
+
+void Acceptor::resume()
+{
+    if (paused_)
+    {
+        paused_ = false;
+        if (listenning_)
+        {
+            acceptChannel_.enabeReading();
+        }
+    }
+}
@@ -15,8 +15,13 @@ class Acceptor : noncopyable
 public:
     using NewConnectionCallback = std::function<void(int sockfd, const InetAddress&)>;
     Acceptor(EventLoop* loop, const InetAddress &listenAddr, bool reuseport);
+    // 接管一个已经bind(可以已经listen)的监听fd，例如prefork时父进程创建的或热升级时从旧进程收到的
+    Acceptor(EventLoop* loop, int listenFd);
     ~Acceptor();
 
+    // 创建一个已经bind和listen的非阻塞监听socket，用于fork之前创建、多个进程共享
+    static int createListenSocket(const InetAddress &listenAddr);
+
     void setNewConnectionCallback(const NewConnectionCallback &cb)
     {
         newConnectionCallback_ = cb;
@@ -24,6 +29,12 @@ public:
 
     bool listenning() const { return listenning_; }
     void listen();
+    // 停止accept新连接，监听socket保持打开，已经排队的连接留给共享该socket的其他进程
+    void stop();
+    // 过载时暂停accept，新连接留在内核的监听队列中，resume后继续；和stop不同，只在本loop中暂停
+    void pause();
+    void resume();
+    bool paused() const { return paused_; }
 private:
     void handleRead();
 
@@ -32,5 +43,6 @@ private:
     Channel acceptChannel_;     //clientfd conn success!!!
     NewConnectionCallback newConnectionCallback_;
     bool listenning_;
+    bool paused_;
     
 };
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "BroadcastGroup.h"
+#include "EventLoop.h"
+#include "TcpConnection.h"
+
+#include <algorithm>
+#include <functional>
+
+BroadcastGroup::BroadcastGroup()
+    : state_(std::make_shared<State>()),
+      broadcasts_(0),
+      loopTasks_(0)
+{
+}
+
+BroadcastGroup::ShardPtr BroadcastGroup::shardInLoop(State &state, EventLoop *loop)
+{
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (const ShardPtr &shard : state.shards)
+    {
+        if (shard->loop == loop)
+        {
+            return shard;
+        }
+    }
+    state.shards.push_back(std::make_shared<Shard>(loop));
+    return state.shards.back();
+}
+
+// 分片只在自己的loop线程中增删成员，这里判断为空之后不会再有成员加进来
+void BroadcastGroup::dropIfEmpty(State &state, const ShardPtr &shard)
+{
+    if (!shard->members.empty())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.shards.erase(std::remove(state.shards.begin(), state.shards.end(), shard), state.shards.end());
+}
+
+void BroadcastGroup::add(const TcpConnectionPtr &conn)
+{
+    conn->getLoop()->runInLoop(std::bind(&BroadcastGroup::addInLoop, state_, conn));
+}
+
+void BroadcastGroup::remove(const TcpConnectionPtr &conn)
+{
+    conn->getLoop()->runInLoop(std::bind(&BroadcastGroup::removeInLoop, state_, conn));
+}
+
+size_t BroadcastGroup::size() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    size_t n = 0;
+    for (const ShardPtr &shard : state_->shards)
+    {
+        n += shard->size;
+    }
+    return n;
+}
+
+void BroadcastGroup::broadcast(const SharedPayload &message)
+{
+    std::vector<ShardPtr> shards;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        shards = state_->shards;
+    }
+    ++broadcasts_;
+    for (const ShardPtr &shard : shards)
+    {
+        ++loopTasks_;
+        shard->loop->runInLoop(std::bind(&BroadcastGroup::sendInLoop, shard, message));
+    }
+}
+
+void BroadcastGroup::broadcast(std::string &&message)
+{
+    broadcast(std::make_shared<const std::string>(std::move(message)));
+}
+
+void BroadcastGroup::broadcast(const std::string &message)
+{
+    broadcast(std::make_shared<const std::string>(message));
+}
+
+// 在连接所属的loop中执行；排队期间连接迁走了就跟过去，登记到它现在所在loop的分片
+void BroadcastGroup::addInLoop(const StatePtr &state, const TcpConnectionPtr &conn)
+{
+    EventLoop *loop = conn->getLoop();
+    if (!loop->isInLoopThread())
+    {
+        loop->queueInLoop(std::bind(&BroadcastGroup::addInLoop, state, conn));
+        return;
+    }
+    ShardPtr shard(shardInLoop(*state, loop));
+    if (shard->members.insert(conn).second)
+    {
+        ++shard->size;
+        conn->addMigrationObserver(state.get(), std::bind(&BroadcastGroup::memberMigrated,
+            std::weak_ptr<State>(state), std::placeholders::_1, std::placeholders::_2));
+    }
+}
+
+void BroadcastGroup::removeInLoop(const StatePtr &state, const TcpConnectionPtr &conn)
+{
+    EventLoop *loop = conn->getLoop();
+    if (!loop->isInLoopThread())
+    {
+        loop->queueInLoop(std::bind(&BroadcastGroup::removeInLoop, state, conn));
+        return;
+    }
+    conn->removeMigrationObserver(state.get());
+    eraseInLoop(*state, loop, conn);
+}
+
+// 在新loop中执行：成员加入新loop的分片，再到原loop中把它从原来的分片摘掉
+void BroadcastGroup::memberMigrated(const std::weak_ptr<State> &weakState, const TcpConnectionPtr &conn, EventLoop *from)
+{
+    StatePtr state(weakState.lock());
+    if (!state)
+    {
+        return;
+    }
+    ShardPtr shard(shardInLoop(*state, conn->getLoop()));
+    if (shard->members.insert(conn).second)
+    {
+        ++shard->size;
+    }
+    from->queueInLoop(std::bind(&BroadcastGroup::leaveShardInLoop, state, from, conn));
+}
+
+// 在原loop中执行；连接又迁了回来时它仍然是本分片的成员，不摘
+void BroadcastGroup::leaveShardInLoop(const StatePtr &state, EventLoop *loop, const TcpConnectionPtr &conn)
+{
+    if (conn->getLoop() != loop)
+    {
+        eraseInLoop(*state, loop, conn);
+    }
+}
+
+void BroadcastGroup::eraseInLoop(State &state, EventLoop *loop, const TcpConnectionPtr &conn)
+{
+    ShardPtr shard;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (const ShardPtr &s : state.shards)
+        {
+            if (s->loop == loop)
+            {
+                shard = s;
+                break;
+            }
+        }
+    }
+    if (shard && shard->members.erase(conn) > 0)
+    {
+        --shard->size;
+        dropIfEmpty(state, shard);
+    }
+}
+
+// 在分片所属的loop线程中执行，每个连接只多一次引用计数
+// 已经迁走、还没有从本分片摘掉的连接跳过，由新loop的分片发送
+void BroadcastGroup::sendInLoop(const ShardPtr &shard, const SharedPayload &message)
+{
+    for (const TcpConnectionPtr &conn : shard->members)
+    {
+        if (conn->getLoop() == shard->loop)
+        {
+            conn->send(message);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+class EventLoop;
+
+// 一组订阅者连接，向它们广播同一条消息（发布订阅网关的扇出）
+// 消息只序列化一次，放进不可变的引用计数块(SharedPayload)；成员按所属loop分片，
+// 每次广播每个loop只投递一个任务，由它在loop线程里把块的引用交给本loop的各个连接，
+// 所以广播的内存和跨线程开销随loop数增长，而不是随订阅者数增长
+// 接口都是线程安全的，分片的成员集合只在对应的loop线程中修改和遍历，
+// 同一线程中先add/remove再broadcast，广播一定能看到这次修改；投递出去的任务各自持有分片，组可以先析构
+// 成员迁移到其他loop（见TcpConnection::migrateTo）后跟着挪到新loop的分片，分片空了就删掉，
+// 不会留下已经移除的loop；和迁移同时进行的那次广播，迁移中的连接可能收到两次或者收不到
+class BroadcastGroup : noncopyable
+{
+public:
+    BroadcastGroup();
+
+    // 组里持有连接的强引用，连接断开时（connection回调中）需要remove；已经断开的连接广播时跳过
+    void add(const TcpConnectionPtr &conn);
+    void remove(const TcpConnectionPtr &conn);
+    // 已经加入各分片的成员数
+    size_t size() const;
+
+    void broadcast(const SharedPayload &message);
+    void broadcast(std::string &&message);
+    void broadcast(const std::string &message);
+
+    uint64_t broadcasts() const { return broadcasts_; }
+    // 所有广播一共投递的跨线程任务数，等于每次广播涉及的loop数之和
+    uint64_t loopTasks() const { return loopTasks_; }
+
+private:
+    struct Shard
+    {
+        explicit Shard(EventLoop *l) : loop(l), size(0) {}
+
+        EventLoop *loop;
+        std::unordered_set<TcpConnectionPtr> members;   //只在loop线程中访问
+        std::atomic<size_t> size;
+    };
+    using ShardPtr = std::shared_ptr<Shard>;
+
+    // 分片表，成员登记的迁移观察者只持有它的弱引用，组析构后观察者什么也不做
+    struct State
+    {
+        std::mutex mutex;
+        std::vector<ShardPtr> shards;   //loop数很少，线性查找
+    };
+    using StatePtr = std::shared_ptr<State>;
+
+    // 在loop线程中调用，分片不存在时创建
+    static ShardPtr shardInLoop(State &state, EventLoop *loop);
+    static void dropIfEmpty(State &state, const ShardPtr &shard);
+    // 把连接从loop的分片中摘掉，在loop线程中调用
+    static void eraseInLoop(State &state, EventLoop *loop, const TcpConnectionPtr &conn);
+
+    static void addInLoop(const StatePtr &state, const TcpConnectionPtr &conn);
+    static void removeInLoop(const StatePtr &state, const TcpConnectionPtr &conn);
+    static void memberMigrated(const std::weak_ptr<State> &weakState, const TcpConnectionPtr &conn, EventLoop *from);
+    static void leaveShardInLoop(const StatePtr &state, EventLoop *loop, const TcpConnectionPtr &conn);
+    static void sendInLoop(const ShardPtr &shard, const SharedPayload &message);
+
+    StatePtr state_;
+
+    std::atomic<uint64_t> broadcasts_;
+    std::atomic<uint64_t> loopTasks_;
+};
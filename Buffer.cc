@@ -1,37 +1,56 @@
 #include "Buffer.h"
+#include "BufferPool.h"
+#include "BufferSearch.h"
 
 #include <errno.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <memory>
+
+// 没有指定溢出区时使用的线程私有溢出区，第一次用到时分配，不清零
+static char* threadOverflow()
+{
+    static thread_local std::unique_ptr<char[]> overflow;
+    if (!overflow)
+    {
+        overflow.reset(new char[BufferPool::kOverflowSize]);
+    }
+    return overflow.get();
+}
+
+ssize_t Buffer::readFd(int fd, int *saveErrno)
+{
+    return readFd(fd, saveErrno, threadOverflow(), BufferPool::kOverflowSize);
+}
 
 // 从fd上读数据 Poller工作在LT模式
 // Buffer缓冲区是有大小的，但从fd上读数据时，不知道tcp最终数据大小
-ssize_t Buffer::readFd(int fd, int *saveErrno)
+// 缓冲区剩余空间之外再挂一块溢出区，一次readv尽量读完；溢出区不需要清零，readv只会覆盖它
+ssize_t Buffer::readFd(int fd, int *saveErrno, char *overflow, size_t overflowLen)
 {
-    char extrabuf[65536] = {0};     //栈上内存空间
     struct iovec vec[2];
 
     const size_t writable = writableBytes();    //这是buffer底层缓冲区剩余大小
-    vec[0].iov_base = begin() + writerIndex_;
+    vec[0].iov_base = writable > 0 ? begin() + writerIndex_ : overflow;
     vec[0].iov_len = writable;
 
-    vec[1].iov_base = extrabuf;
-    vec[1].iov_len = sizeof extrabuf;
+    vec[1].iov_base = overflow;
+    vec[1].iov_len = overflowLen;
 
-    const int iovcnt = (writable < sizeof extrabuf) ? 2 : 1;
-    const size_t n = ::readv(fd, vec, iovcnt);
+    const int iovcnt = (writable < overflowLen) ? 2 : 1;
+    const ssize_t n = ::readv(fd, vec, iovcnt);
     if (n < 0)
     {
         *saveErrno = errno;
     }
-    else if (n <= writable)
+    else if (static_cast<size_t>(n) <= writable)
     {
         writerIndex_ += n;
     }
-    else    //extrabuf 也有数据
+    else    //溢出区也有数据
     {
-        writerIndex_ = buffer_.size();
-        append(extrabuf, n - writable);
+        writerIndex_ += writable;   //缓冲区还没有分配时writable为0
+        append(overflow, n - writable);
     }
     return n;
 }
@@ -45,4 +64,18 @@ ssize_t Buffer::writeFd(int fd, int *saveErrno)
         *saveErrno = errno;
     }
     return n;
-}
\ No newline at end of file
+}
+const char* Buffer::findCRLF(const char *start) const
+{
+    return BufferSearch::findCRLF(start, beginWrite());
+}
+
+const char* Buffer::findEOL(const char *start) const
+{
+    return BufferSearch::findByte(start, beginWrite(), '\n');
+}
+
+const char* Buffer::findAny(const char *start, const char *delimiters, size_t count) const
+{
+    return BufferSearch::findAny(start, beginWrite(), delimiters, count);
+}
@@ -4,6 +4,9 @@
 
 #include <vector>
 #include <aio.h>
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
 #include <algorithm>
 
@@ -13,14 +16,15 @@ public:
     static const size_t kCheapPreapend = 8;
     static const size_t kInitialSize = 1024;
 
+    // initialSize为0时不预先分配内存，第一次写入时才按需分配（空闲连接不占缓冲区）
     explicit Buffer(size_t initialSize = kInitialSize)
-        : buffer_(kCheapPreapend + initialSize),
+        : buffer_(initialSize > 0 ? kCheapPreapend + initialSize : 0),
           readerIndex_(kCheapPreapend),
           writerIndex_(kCheapPreapend)
         {}
 
     size_t readableBytes() const { return writerIndex_ - readerIndex_; }
-    size_t writableBytes() const { return buffer_.size() - writerIndex_; }
+    size_t writableBytes() const { return buffer_.size() > writerIndex_ ? buffer_.size() - writerIndex_ : 0; }
     size_t prependableBytes() const{ return readerIndex_; }
     const char* peek() const { return begin() + readerIndex_; } //返回缓冲区中可读数据的起始地址
     char* beginWrite() {return begin() + writerIndex_; }
@@ -81,6 +85,9 @@ public:
         }
     }
 
+    //直接写入beginWrite()之后，移动写指针
+    void hasWritten(size_t len) { writerIndex_ += len; }
+
     //向缓冲区添加数据 [data, data + len]
     void append(const char* data, size_t len)
     {
@@ -89,15 +96,83 @@ public:
         writerIndex_ += len;
     }
 
-    // 从fd上读数据
+    //在可读数据前面插入数据，用于补写长度头，len不能超过prependableBytes()
+    void prepend(const void *data, size_t len)
+    {
+        readerIndex_ -= len;
+        const char *d = static_cast<const char*>(data);
+        std::copy(d, d + len, begin() + readerIndex_);
+    }
+
+    // 在可读数据中查找，没有找到返回nullptr；start必须位于[peek(), beginWrite()]之间
+    // 由BufferSearch按CPU选用AVX2/SSE2/标量内核
+    const char* findCRLF() const { return findCRLF(peek()); }
+    const char* findCRLF(const char *start) const;
+    const char* findEOL() const { return findEOL(peek()); }
+    const char* findEOL(const char *start) const;
+    // delimiters中任意一个字节第一次出现的位置，比如" \t\r\n"
+    const char* findAny(const char *delimiters, size_t count) const { return findAny(peek(), delimiters, count); }
+    const char* findAny(const char *start, const char *delimiters, size_t count) const;
+
+    // 网络字节序的整数，用于长度头编解码
+    // peekIntXX不移动读指针，readIntXX读取后移动，调用前需保证readableBytes()足够
+    int64_t peekInt64() const { return static_cast<int64_t>(be64toh(peekRaw<uint64_t>())); }
+    int32_t peekInt32() const { return static_cast<int32_t>(be32toh(peekRaw<uint32_t>())); }
+    int16_t peekInt16() const { return static_cast<int16_t>(be16toh(peekRaw<uint16_t>())); }
+    int8_t peekInt8() const { return static_cast<int8_t>(*peek()); }
+
+    int64_t readInt64() { int64_t x = peekInt64(); retrieve(sizeof x); return x; }
+    int32_t readInt32() { int32_t x = peekInt32(); retrieve(sizeof x); return x; }
+    int16_t readInt16() { int16_t x = peekInt16(); retrieve(sizeof x); return x; }
+    int8_t readInt8() { int8_t x = peekInt8(); retrieve(sizeof x); return x; }
+
+    void appendInt64(int64_t x) { uint64_t be = htobe64(static_cast<uint64_t>(x)); append(reinterpret_cast<const char*>(&be), sizeof be); }
+    void appendInt32(int32_t x) { uint32_t be = htobe32(static_cast<uint32_t>(x)); append(reinterpret_cast<const char*>(&be), sizeof be); }
+    void appendInt16(int16_t x) { uint16_t be = htobe16(static_cast<uint16_t>(x)); append(reinterpret_cast<const char*>(&be), sizeof be); }
+    void appendInt8(int8_t x) { append(reinterpret_cast<const char*>(&x), sizeof x); }
+
+    void prependInt64(int64_t x) { uint64_t be = htobe64(static_cast<uint64_t>(x)); prepend(&be, sizeof be); }
+    void prependInt32(int32_t x) { uint32_t be = htobe32(static_cast<uint32_t>(x)); prepend(&be, sizeof be); }
+    void prependInt16(int16_t x) { uint16_t be = htobe16(static_cast<uint16_t>(x)); prepend(&be, sizeof be); }
+    void prependInt8(int8_t x) { prepend(&x, sizeof x); }
+
+    // 从fd上读数据，缓冲区放不下的部分先读到溢出区再追加
+    // overflow一般是所属loop的BufferPool::overflow()，不传时使用线程自己的一块
     ssize_t readFd(int fd, int *saveErrno);
+    ssize_t readFd(int fd, int *saveErrno, char *overflow, size_t overflowLen);
     // 通过fd发送数据
     ssize_t writeFd(int fd, int *saveErrno);
 
+    // 底层内存是否已经分配
+    bool allocated() const { return !buffer_.empty(); }
+    // 接管一块内存作为底层存储（见BufferPool::take），只能在没有可读数据时调用
+    void adopt(std::vector<char> &&storage)
+    {
+        buffer_.swap(storage);
+        readerIndex_ = writerIndex_ = kCheapPreapend;
+    }
+    // 交出底层内存，之后回到未分配的状态，只能在没有可读数据时调用
+    std::vector<char> release()
+    {
+        std::vector<char> storage;
+        storage.swap(buffer_);
+        readerIndex_ = writerIndex_ = kCheapPreapend;
+        return storage;
+    }
+
 private:
-    char* begin() { return &*buffer_.begin(); } //vector底层数组首元素地址
-    const char* begin() const { return &*buffer_.begin(); } //常对象使用
-    
+    char* begin() { return buffer_.data(); } //vector底层数组首元素地址
+    const char* begin() const { return buffer_.data(); } //常对象使用
+
+    // 可读数据可能不对齐，用memcpy读取
+    template <typename T>
+    T peekRaw() const
+    {
+        T x;
+        ::memcpy(&x, peek(), sizeof x);
+        return x;
+    }
+
     std::vector<char> buffer_;
     size_t readerIndex_;
     size_t writerIndex_;
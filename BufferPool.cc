@@ -0,0 +1,64 @@
+#include "BufferPool.h"
+#include "Buffer.h"
+
+BufferPool::BufferPool()
+    : overflow_(new char[kOverflowSize])    //不初始化，readv会覆盖
+{
+}
+
+// 不小于size的最小档位，超过kMaxBlockSize时返回kNumClasses
+int BufferPool::classOf(size_t size)
+{
+    int index = 0;
+    size_t blockSize = kMinBlockSize;
+    while (blockSize < size && index < kNumClasses)
+    {
+        blockSize <<= 1;
+        ++index;
+    }
+    return index;
+}
+
+std::vector<char> BufferPool::take(size_t size)
+{
+    int index = classOf(size);
+    if (index < kNumClasses && !free_[index].empty())
+    {
+        std::vector<char> block(std::move(free_[index].back()));
+        free_[index].pop_back();
+        return block;
+    }
+    size_t blockSize = index < kNumClasses ? (kMinBlockSize << index) : size;
+    return std::vector<char>(Buffer::kCheapPreapend + blockSize);
+}
+
+void BufferPool::give(std::vector<char> &&block)
+{
+    if (block.size() < Buffer::kCheapPreapend + kMinBlockSize)
+    {
+        return;
+    }
+    // 按能完整提供的档位归还：Buffer扩容后块的大小不一定是2的幂
+    size_t usable = block.size() - Buffer::kCheapPreapend;
+    int index = classOf(usable);
+    if (index >= kNumClasses || (kMinBlockSize << index) > usable)
+    {
+        --index;
+    }
+    if (index < 0 || index >= kNumClasses || usable > 2 * kMaxBlockSize
+        || free_[index].size() >= kMaxBlocksPerClass)
+    {
+        return;     //block析构时释放
+    }
+    free_[index].push_back(std::move(block));
+}
+
+size_t BufferPool::blocksCached() const
+{
+    size_t n = 0;
+    for (const auto &blocks : free_)
+    {
+        n += blocks.size();
+    }
+    return n;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <stddef.h>
+#include <memory>
+#include <vector>
+
+// 每个loop一个的读缓冲区池，只在loop线程中使用
+// 1. 溢出区：readFd时输入缓冲区放不下的数据先读到这里，整个loop共用一块，不清零
+// 2. 按2的幂分档的空闲块：开启pooled输入的连接读空后把输入缓冲区的内存还回来，
+//    下次可读时再按预期的消息大小取出，空闲连接不占输入缓冲区，也不用每次都malloc
+class BufferPool : noncopyable
+{
+public:
+    static const size_t kOverflowSize = 64 * 1024;
+    static const size_t kMinBlockSize = 512;
+    static const size_t kMaxBlockSize = 64 * 1024;
+    static const size_t kMaxBlocksPerClass = 256;
+
+    BufferPool();
+
+    char* overflow() { return overflow_.get(); }
+
+    // 取出一块不小于size字节（另加Buffer的预留头部）的内存，可以直接交给Buffer::adopt
+    std::vector<char> take(size_t size);
+    // 归还Buffer::release出来的内存，超过kMaxBlockSize或该档已满时直接释放
+    void give(std::vector<char> &&block);
+
+    size_t blocksCached() const;
+
+private:
+    static const int kNumClasses = 8;   // 512B ~ 64KB
+
+    static int classOf(size_t size);
+
+    std::unique_ptr<char[]> overflow_;
+    std::vector<std::vector<char>> free_[kNumClasses];
+};
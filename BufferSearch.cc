@@ -0,0 +1,314 @@
+#include "BufferSearch.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYMUDUO_X86 1
+#endif
+
+namespace
+{
+
+struct Kernels
+{
+    const char* (*findCRLF)(const char*, const char*);
+    const char* (*findByte)(const char*, const char*, char);
+    const char* (*findAny)(const char*, const char*, const char*, size_t);
+};
+
+// ---------------- 标量实现，单字节查找交给libc的memchr ----------------
+
+const char* scalarFindByte(const char *begin, const char *end, char c)
+{
+    return static_cast<const char*>(memchr(begin, c, end - begin));
+}
+
+const char* scalarFindCRLF(const char *begin, const char *end)
+{
+    const char *p = begin;
+    while (p < end)
+    {
+        p = static_cast<const char*>(memchr(p, '\r', end - p));
+        if (p == nullptr || p + 1 >= end)
+        {
+            return nullptr;
+        }
+        if (p[1] == '\n')
+        {
+            return p;
+        }
+        ++p;
+    }
+    return nullptr;
+}
+
+const char* scalarFindAny(const char *begin, const char *end, const char *delimiters, size_t count)
+{
+    if (count == 1)
+    {
+        return scalarFindByte(begin, end, delimiters[0]);
+    }
+    uint64_t table[4] = {0, 0, 0, 0};
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned char c = static_cast<unsigned char>(delimiters[i]);
+        table[c >> 6] |= 1ULL << (c & 63);
+    }
+    for (const char *p = begin; p < end; ++p)
+    {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (table[c >> 6] & (1ULL << (c & 63)))
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+const Kernels kScalarKernels = { scalarFindCRLF, scalarFindByte, scalarFindAny };
+
+#ifdef MYMUDUO_X86
+
+// 一次比较的分隔符个数上限，更多时退回查表
+const size_t kMaxVectorDelimiters = 8;
+
+// ---------------- SSE2，x86_64上总是可用 ----------------
+
+const char* sse2FindByte(const char *begin, const char *end, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    const char *p = begin;
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scalarFindByte(p, end, c);
+}
+
+// 同时比较p[i]=='\r'和p[i+1]=='\n'，两个掩码相与
+const char* sse2FindCRLF(const char *begin, const char *end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const char *p = begin;
+    for (; end - p >= 17; p += 16)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, cr), _mm_cmpeq_epi8(second, lf)));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scalarFindCRLF(p, end);
+}
+
+const char* sse2FindAny(const char *begin, const char *end, const char *delimiters, size_t count)
+{
+    if (count == 1)
+    {
+        return sse2FindByte(begin, end, delimiters[0]);
+    }
+    if (count > kMaxVectorDelimiters)
+    {
+        return scalarFindAny(begin, end, delimiters, count);
+    }
+    __m128i needles[kMaxVectorDelimiters];
+    for (size_t i = 0; i < count; ++i)
+    {
+        needles[i] = _mm_set1_epi8(delimiters[i]);
+    }
+    const char *p = begin;
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+        for (size_t i = 1; i < count; ++i)
+        {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+        }
+        int mask = _mm_movemask_epi8(hits);
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scalarFindAny(p, end, delimiters, count);
+}
+
+const Kernels kSSE2Kernels = { sse2FindCRLF, sse2FindByte, sse2FindAny };
+
+// ---------------- AVX2，按函数开启指令集，库本身不需要-mavx2 ----------------
+
+__attribute__((target("avx2")))
+const char* avx2FindByte(const char *begin, const char *end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    const char *p = begin;
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return sse2FindByte(p, end, c);
+}
+
+__attribute__((target("avx2")))
+const char* avx2FindCRLF(const char *begin, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const char *p = begin;
+    for (; end - p >= 33; p += 32)
+    {
+        __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, cr), _mm256_cmpeq_epi8(second, lf))));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return sse2FindCRLF(p, end);
+}
+
+__attribute__((target("avx2")))
+const char* avx2FindAny(const char *begin, const char *end, const char *delimiters, size_t count)
+{
+    if (count == 1)
+    {
+        return avx2FindByte(begin, end, delimiters[0]);
+    }
+    if (count > kMaxVectorDelimiters)
+    {
+        return scalarFindAny(begin, end, delimiters, count);
+    }
+    __m256i needles[kMaxVectorDelimiters];
+    for (size_t i = 0; i < count; ++i)
+    {
+        needles[i] = _mm256_set1_epi8(delimiters[i]);
+    }
+    const char *p = begin;
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hits = _mm256_cmpeq_epi8(block, needles[0]);
+        for (size_t i = 1; i < count; ++i)
+        {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[i]));
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if (mask)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return sse2FindAny(p, end, delimiters, count);
+}
+
+const Kernels kAVX2Kernels = { avx2FindCRLF, avx2FindByte, avx2FindAny };
+
+#endif  // MYMUDUO_X86
+
+const Kernels* kernelsOf(BufferSearch::Impl impl)
+{
+    switch (impl)
+    {
+#ifdef MYMUDUO_X86
+    case BufferSearch::kAVX2:
+        return &kAVX2Kernels;
+    case BufferSearch::kSSE2:
+        return &kSSE2Kernels;
+#endif
+    default:
+        return &kScalarKernels;
+    }
+}
+
+BufferSearch::Impl detectImpl()
+{
+#ifdef MYMUDUO_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return BufferSearch::kAVX2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return BufferSearch::kSSE2;
+    }
+#endif
+    return BufferSearch::kScalar;
+}
+
+// 静态初始化时选定，之后只读
+BufferSearch::Impl g_impl = detectImpl();
+const Kernels *g_kernels = kernelsOf(g_impl);
+
+} // namespace
+
+const char* BufferSearch::findCRLF(const char *begin, const char *end)
+{
+    return g_kernels->findCRLF(begin, end);
+}
+
+const char* BufferSearch::findByte(const char *begin, const char *end, char c)
+{
+    return g_kernels->findByte(begin, end, c);
+}
+
+const char* BufferSearch::findAny(const char *begin, const char *end, const char *delimiters, size_t count)
+{
+    if (count == 0)
+    {
+        return nullptr;
+    }
+    return g_kernels->findAny(begin, end, delimiters, count);
+}
+
+BufferSearch::Impl BufferSearch::impl()
+{
+    return g_impl;
+}
+
+bool BufferSearch::supported(Impl impl)
+{
+    return impl <= detectImpl();
+}
+
+bool BufferSearch::setImpl(Impl impl)
+{
+    if (!supported(impl))
+    {
+        return false;
+    }
+    g_impl = impl;
+    g_kernels = kernelsOf(impl);
+    return true;
+}
+
+const char* BufferSearch::implName(Impl impl)
+{
+    switch (impl)
+    {
+    case kAVX2:
+        return "avx2";
+    case kSSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+// Buffer查找使用的字节扫描内核，程序启动时按CPU选择AVX2/SSE2/标量实现
+// 所有函数在[begin, end)中查找，没有找到返回nullptr
+class BufferSearch
+{
+public:
+    enum Impl
+    {
+        kScalar,
+        kSSE2,
+        kAVX2,
+    };
+
+    // "\r\n"，返回'\r'的位置
+    static const char* findCRLF(const char *begin, const char *end);
+    static const char* findByte(const char *begin, const char *end, char c);
+    // delimiters中任意一个字节第一次出现的位置
+    static const char* findAny(const char *begin, const char *end, const char *delimiters, size_t count);
+
+    // 当前使用的实现
+    static Impl impl();
+    // 强制使用某个实现，用于测试和压测；CPU不支持时返回false，不改变当前实现
+    static bool setImpl(Impl impl);
+    static bool supported(Impl impl);
+    static const char* implName(Impl impl);
+};
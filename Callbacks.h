@@ -2,8 +2,10 @@
 
 #include <memory>
 #include <functional>
+#include <string>
 
 class Buffer;
+class EventLoop;
 class TcpConnection;
 class Timestamp;
 
@@ -16,4 +18,23 @@ using MessageCallback = std::function<void(const TcpConnectionPtr&,
                                         Buffer*, 
                                         Timestamp)>;
 
-using HighWaterMarkCallback = std::function<void(const TcpConnectionPtr&, size_t)>;
\ No newline at end of file
+// 多个连接共享的只读消息（如广播），发送队列里只保存引用，不拷贝
+using SharedPayload = std::shared_ptr<const std::string>;
+
+using HighWaterMarkCallback = std::function<void(const TcpConnectionPtr&, size_t)>;
+// 连接迁移完成后在新loop中回调，第二个参数是原来的loop
+using MigrationCallback = std::function<void(const TcpConnectionPtr&, EventLoop*)>;
+using TimerCallback = std::function<void()>;
+
+// 一个连接的全部用户回调。同一个TcpServer的连接共享一份，
+// 单个连接再设置回调时才复制出自己的一份（写时复制），避免每个连接保存五个std::function
+struct ConnectionCallbacks
+{
+    ConnectionCallback connection;
+    MessageCallback message;
+    WriteCompleteCallback writeComplete;
+    CloseCallback close;
+    HighWaterMarkCallback highWaterMark;
+    MigrationCallback migrated;     //TcpServer用它把迁移后的连接挪到新loop的分片，不管迁移是谁发起的
+};
+using ConnectionCallbacksPtr = std::shared_ptr<ConnectionCallbacks>;
@@ -1,6 +1,7 @@
 #include "Channel.h"
 #include "EventLoop.h"
 #include "logger.h"
+#include "Trace.h"
 
 #include <sys/epoll.h>
 
@@ -10,7 +11,8 @@ const int Channel::kWriteEvent = EPOLLOUT;
 
 //EventLoop : ChannelList poller
 Channel::Channel(EventLoop *loop, int fd) 
-    : loop_(loop), fd_(fd), events_(0), revents_(0), index_(-1), tied_(false)
+    : loop_(loop), fd_(fd), events_(0), revents_(0), index_(-1),
+    eventHandling_(false), releaseTiePending_(false), handler_(nullptr)
     {}
 
 Channel::~Channel() {}
@@ -18,7 +20,7 @@ Channel::~Channel() {}
 //channel的tie调用时机：一个TcpConneciton新连接创建的时候
 void Channel::tie(const std::shared_ptr<void> &obj) {
     tie_ = obj;
-    tied_ = true;
+    releaseTiePending_ = false;
 }
 
 //当改变channel所表述的fd的event事件后, update 负责在poller里面更改fd相应的事件epoll_ctl
@@ -31,54 +33,109 @@ void Channel::update() {
 // 在channel所属的EventLoop中删除当前的channnel
 void Channel::remove() {
     loop_->removeChannel(this);
+    if (tie_)
+    {
+        if (eventHandling_)
+        {
+            // 正在分发事件，owner要活到handleEvent返回
+            releaseTiePending_ = true;
+        }
+        else
+        {
+            // remove()一般在owner自己的成员函数里调用，不能在这里析构owner，
+            // 把最后的引用交给loop，在本轮回调之后释放
+            std::shared_ptr<void> owner;
+            owner.swap(tie_);
+            loop_->queueInLoop([owner]() {});
+        }
+    }
 }
 
 // fd得到poller通知后，处理事件
+// 被tie的channel在注册期间owner一直存活，分发路径上没有原子引用计数操作
 void Channel::handleEvent(Timestamp receiveTime) {
-    std::shared_ptr<void> guard;
-    if (tied_)
+    bool traced = Trace::enabled();
+    if (traced)
     {
-        guard = tie_.lock();
-        if (guard)
-        {
-            handleEventWithGuard(receiveTime);
-        }
+        traceBegin();
+    }
+    eventHandling_ = true;
+    handleEventWithGuard(receiveTime);
+    eventHandling_ = false;
+    if (traced)
+    {
+        Trace::end("handleEvent");
     }
-    else
+    if (releaseTiePending_)
     {
-        handleEventWithGuard(receiveTime);
+        releaseTiePending_ = false;
+        std::shared_ptr<void> owner;
+        owner.swap(tie_);
+        // owner析构时可能连同本channel一起析构，之后不能再访问成员
     }
 }
 
+void Channel::traceBegin() const
+{
+    uint64_t id = 0;
+    const char *name = handler_ ? handler_->traceName(&id) : nullptr;
+    Trace::beginFd("handleEvent", fd_, name, id);
+}
+
 void Channel::handleEventWithGuard(Timestamp receiveTime) {
 
-    LOG_INFO("channel handEvent revents :%d \n", revents_);
+    LOG_DEBUG("channel handEvent revents :%d \n", revents_);
+
+    if (handler_)
+    {
+        if ((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN))
+        {
+            handler_->handleClose();
+        }
+        if (revents_ & EPOLLERR)
+        {
+            handler_->handleError();
+        }
+        if (revents_ & (EPOLLIN | EPOLLPRI))
+        {
+            handler_->handleRead(receiveTime);
+        }
+        if (revents_ & EPOLLOUT)
+        {
+            handler_->handleWrite();
+        }
+        return;
+    }
+    if (!callbacks_)
+    {
+        return;
+    }
 
     if ((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN)) {
-        if (closeCallback_)
+        if (callbacks_->close)
         {
-            closeCallback_();
+            callbacks_->close();
         }
     }
     if (revents_ & EPOLLERR)
     {
-        if (errorCallback_)
+        if (callbacks_->error)
         {
-            errorCallback_();
+            callbacks_->error();
         }
     }
     if (revents_ & (EPOLLIN | EPOLLPRI))
     {
-        if (readCallback_)
+        if (callbacks_->read)
         {
-            readCallback_(receiveTime);
+            callbacks_->read(receiveTime);
         }
     }
     if (revents_ & EPOLLOUT)
     {
-        if (writeCallback_)
+        if (callbacks_->write)
         {
-            writeCallback_();
+            callbacks_->write();
         }
     }  
 }
\ No newline at end of file
@@ -3,11 +3,28 @@
 #include "noncopyable.h"
 #include "Timestamp.h"
 
+#include <stdint.h>
 #include <functional>
 #include <memory>
 
 class EventLoop;
 
+// 事件处理接口：大量同类对象（如TcpConnection）实现这个接口代替四个std::function回调，
+// Channel只保存一个指针，节省每个对象上的内存
+class ChannelHandler
+{
+public:
+    virtual void handleRead(Timestamp receiveTime) = 0;
+    virtual void handleWrite() = 0;
+    virtual void handleClose() = 0;
+    virtual void handleError() = 0;
+    // 事件追踪时显示的名字"前缀#id"，没有时返回nullptr
+    virtual const char* traceName(uint64_t * /*id*/) const { return nullptr; }
+
+protected:
+    ~ChannelHandler() {}
+};
+
 // Channel 理解为通道， 封装了sockfd和其感兴趣的event， 如EPOLLIN EPOLLOUT事件，
 // 还绑定了poller返回的具体事件
 
@@ -23,13 +40,16 @@ public:
     // fd 得到poller通知后，处理事件
     void handleEvent(Timestamp receiveTime);
     
-    // 设置回调函数对象
-    void setReadCallback(ReadEventCallback cb) { readCallback_ = cb; }
-    void setWriteCallback(EventCallback cb) { writeCallback_ = cb; }
-    void setCloseCallback(EventCallback cb) { closeCallback_ = cb; }
-    void setErrorCallback(EventCallback cb) { errorCallback_ = cb; }
+    // 设置回调函数对象，回调对象在第一次设置时才分配
+    void setReadCallback(ReadEventCallback cb) { callbacks().read = std::move(cb); }
+    void setWriteCallback(EventCallback cb) { callbacks().write = std::move(cb); }
+    void setCloseCallback(EventCallback cb) { callbacks().close = std::move(cb); }
+    void setErrorCallback(EventCallback cb) { callbacks().error = std::move(cb); }
+    // 设置后事件交给handler处理，不再使用上面的回调
+    void setHandler(ChannelHandler *handler) { handler_ = handler; }
 
     //防止当channel被手动remove掉后，还在执行回调函数
+    //channel注册期间持有owner的强引用，remove()时释放，事件分发时不再需要lock weak_ptr
     void tie(const std::shared_ptr<void>&);
 
     int fd() const { return fd_; }
@@ -53,11 +73,30 @@ public:
 
     EventLoop* ownerLoop() { return loop_; }
     void remove();
+    // 连接迁移时换到另一个loop，只能在remove()之后、重新注册之前调用
+    void setLoop(EventLoop *loop) { loop_ = loop; }
 
 private:
 
+    struct Callbacks
+    {
+        ReadEventCallback read;
+        EventCallback write;
+        EventCallback close;
+        EventCallback error;
+    };
+
     void update();
     void handleEventWithGuard(Timestamp receiveTime);
+    void traceBegin() const;
+    Callbacks& callbacks()
+    {
+        if (!callbacks_)
+        {
+            callbacks_.reset(new Callbacks);
+        }
+        return *callbacks_;
+    }
 
     static const int kNoneEvent;
     static const int kReadEvent;
@@ -69,12 +108,11 @@ private:
     int revents_;       // poller返回的具体发生的事件
     int index_;
 
-    std::weak_ptr<void> tie_;
-    bool tied_;
+    std::shared_ptr<void> tie_;     //owner的强引用，tie()到remove()之间有效
+    bool eventHandling_;            //正在handleEvent中
+    bool releaseTiePending_;        //handleEvent结束后再释放tie_
 
     //因为channel 通道里能够获知fd最终发生的具体事件events，所以它负责调用具体事件的回调操作
-    ReadEventCallback readCallback_;
-    EventCallback writeCallback_;
-    EventCallback closeCallback_;
-    EventCallback errorCallback_;
+    ChannelHandler *handler_;
+    std::unique_ptr<Callbacks> callbacks_;
 };
@@ -0,0 +1,195 @@
+#include "ComputePool.h"
+#include "Thread.h"
+#include "logger.h"
+
+#include <exception>
+
+// 当前线程所属的计算池和队列下标，计算线程中提交的任务放进自己的队列
+static thread_local ComputePool *t_pool = nullptr;
+static thread_local int t_workerIndex = -1;
+
+struct ComputePool::Worker
+{
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::unique_ptr<Thread> thread;
+};
+
+void ComputeSequence::deliver(uint64_t seq, EventLoop::Functor cb)
+{
+    if (seq != nextDeliver_)
+    {
+        ready_[seq] = std::move(cb);
+        return;
+    }
+    if (cb)
+    {
+        cb();
+    }
+    ++nextDeliver_;
+    // 交付已经在等待的后续结果
+    auto it = ready_.begin();
+    while (it != ready_.end() && it->first == nextDeliver_)
+    {
+        EventLoop::Functor next = std::move(it->second);
+        it = ready_.erase(it);
+        if (next)
+        {
+            next();
+        }
+        ++nextDeliver_;
+    }
+}
+
+ComputePool::ComputePool(const std::string &nameArg)
+    : name_(nameArg),
+    numThreads_(static_cast<int>(std::thread::hardware_concurrency())),
+    running_(false),
+    next_(0),
+    pending_(0),
+    idle_(0),
+    tasksExecuted_(0),
+    tasksStolen_(0)
+{
+}
+
+ComputePool::~ComputePool()
+{
+    stop();
+}
+
+void ComputePool::start()
+{
+    if (running_)
+    {
+        return;
+    }
+    if (numThreads_ <= 0)
+    {
+        numThreads_ = 1;
+    }
+    running_ = true;
+    for (int i = 0; i < numThreads_; ++i)
+    {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker));
+    }
+    // 队列全部建好之后再启动线程，窃取时会遍历所有队列
+    for (int i = 0; i < numThreads_; ++i)
+    {
+        std::string name = name_ + std::to_string(i);
+        workers_[i]->thread.reset(new Thread(std::bind(&ComputePool::workerFunc, this, i), name));
+        workers_[i]->thread->start();
+    }
+}
+
+void ComputePool::stop()
+{
+    if (!running_.exchange(false))
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+    for (auto &worker : workers_)
+    {
+        worker->thread->join();
+    }
+}
+
+void ComputePool::run(Task task)
+{
+    if (!running_)
+    {
+        LOG_ERROR("ComputePool %s is not running, task dropped \n", name_.c_str());
+        return;
+    }
+
+    int index = t_pool == this ? t_workerIndex : static_cast<int>(next_++ % workers_.size());
+    Worker &worker = *workers_[index];
+    ++pending_;     //先计数再入队，取任务时的减一不会先于这里的加一
+    {
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+
+    // 先增加pending_再检查idle_，与workerFunc中的顺序相反，保证不会漏掉唤醒
+    if (idle_ > 0)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.notify_one();
+    }
+}
+
+bool ComputePool::takeTask(int index, Task *task)
+{
+    {
+        Worker &self = *workers_[index];
+        std::unique_lock<std::mutex> lock(self.mutex);
+        if (!self.tasks.empty())
+        {
+            *task = std::move(self.tasks.back());
+            self.tasks.pop_back();
+            --pending_;
+            return true;
+        }
+    }
+
+    int n = static_cast<int>(workers_.size());
+    for (int i = 1; i < n; ++i)
+    {
+        Worker &victim = *workers_[(index + i) % n];
+        std::unique_lock<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            *task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --pending_;
+            ++tasksStolen_;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ComputePool::workerFunc(int index)
+{
+    t_pool = this;
+    t_workerIndex = index;
+
+    for (;;)
+    {
+        Task task;
+        if (takeTask(index, &task))
+        {
+            try
+            {
+                task();
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("ComputePool %s task exception : %s \n", name_.c_str(), e.what());
+            }
+            catch (...)
+            {
+                LOG_ERROR("ComputePool %s task unknown exception \n", name_.c_str());
+            }
+            ++tasksExecuted_;
+            continue;
+        }
+
+        // 所有队列都空了：stop之后退出，否则睡眠等待新任务
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++idle_;
+        cond_.wait(lock, [this]() { return pending_ > 0 || !running_; });
+        --idle_;
+        if (pending_ == 0 && !running_)
+        {
+            break;
+        }
+    }
+
+    t_pool = nullptr;
+    t_workerIndex = -1;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "EventLoop.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <type_traits>
+
+class ComputePool;
+
+// 同一个ComputeSequence上提交的任务，结果按提交顺序交付给loop（任务本身仍然并行执行）
+// 一般每个连接一个，可以放在TcpConnection::setContext中
+class ComputeSequence : noncopyable
+{
+public:
+    explicit ComputeSequence(EventLoop *loop)
+        : loop_(loop), nextSubmit_(0), nextDeliver_(0)
+    {}
+
+    EventLoop* getLoop() const { return loop_; }
+    // 已提交但结果还没有交付的任务个数，在loop线程中调用
+    uint64_t inFlight() const { return nextSubmit_ - nextDeliver_; }
+
+private:
+    friend class ComputePool;
+
+    // 在loop线程中调用，seq之前的结果都交付之后才执行cb
+    void deliver(uint64_t seq, EventLoop::Functor cb);
+
+    EventLoop *loop_;
+    std::atomic<uint64_t> nextSubmit_;
+    uint64_t nextDeliver_;  //只在loop线程中访问
+    std::map<uint64_t, EventLoop::Functor> ready_;  //先完成的后续结果
+};
+
+using ComputeSequencePtr = std::shared_ptr<ComputeSequence>;
+
+// 计算线程池：把压缩、加解密、查询计算等CPU密集的工作从IO loop上移走
+// 每个工作线程一个双端队列，自己从尾部取（LIFO，缓存更热），空闲时从其他线程的队列头部窃取
+// submit的结果通过loop->runInLoop交回提交方所属的loop，回调中可以直接操作连接
+class ComputePool : noncopyable
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit ComputePool(const std::string &nameArg = std::string("ComputePool"));
+    ~ComputePool();
+
+    // 默认为CPU核数，需在start之前设置
+    void setThreadNum(int numThreads) { numThreads_ = numThreads; }
+    void start();
+    // 执行完已提交的任务后退出所有工作线程
+    void stop();
+
+    // 只在计算线程中执行，不交付结果
+    void run(Task task);
+
+    // work在计算线程中执行，返回值r通过loop->runInLoop交给done(r)
+    // work返回void时done不带参数
+    template <typename Work, typename Done>
+    void submit(EventLoop *loop, Work work, Done done)
+    {
+        using Result = typename std::result_of<Work()>::type;
+        run(std::bind(&Invoker<Result>::template toLoop<Work, Done>, loop, work, done));
+    }
+
+    // 同上，但同一个sequence上的结果按提交顺序交付
+    template <typename Work, typename Done>
+    void submit(const ComputeSequencePtr &sequence, Work work, Done done)
+    {
+        using Result = typename std::result_of<Work()>::type;
+        uint64_t seq = sequence->nextSubmit_++;
+        run(std::bind(&Invoker<Result>::template toSequence<Work, Done>, sequence, seq, work, done));
+    }
+
+    const std::string& name() const { return name_; }
+    int numThreads() const { return static_cast<int>(workers_.size()); }
+    uint64_t tasksExecuted() const { return tasksExecuted_; }
+    uint64_t tasksStolen() const { return tasksStolen_; }
+
+private:
+    struct Worker;
+
+    template <typename Result>
+    struct Invoker
+    {
+        template <typename Work, typename Done>
+        static void toLoop(EventLoop *loop, Work &work, Done &done)
+        {
+            std::shared_ptr<Result> result = std::make_shared<Result>(work());
+            loop->runInLoop([done, result]() { done(std::move(*result)); });
+        }
+
+        template <typename Work, typename Done>
+        static void toSequence(const ComputeSequencePtr &sequence, uint64_t seq, Work &work, Done &done)
+        {
+            std::shared_ptr<Result> result;
+            try
+            {
+                result = std::make_shared<Result>(work());
+            }
+            catch (...)
+            {
+                skip(sequence, seq);
+                throw;
+            }
+            sequence->getLoop()->runInLoop([sequence, seq, done, result]() {
+                sequence->deliver(seq, [done, result]() { done(std::move(*result)); });
+            });
+        }
+    };
+
+    // work抛出异常时也要占掉这个序号，否则后面的结果永远交付不了
+    static void skip(const ComputeSequencePtr &sequence, uint64_t seq)
+    {
+        sequence->getLoop()->runInLoop([sequence, seq]() {
+            sequence->deliver(seq, EventLoop::Functor());
+        });
+    }
+
+    void workerFunc(int index);
+    // 先取自己队列的尾部，再从其他队列的头部窃取
+    bool takeTask(int index, Task *task);
+
+    std::string name_;
+    int numThreads_;
+    std::atomic_bool running_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<unsigned> next_;    //外部线程提交时轮询选择队列
+
+    // 空闲线程在这里睡眠，pending_是所有队列中任务的总数
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::atomic<size_t> pending_;
+    std::atomic_int idle_;
+
+    std::atomic<uint64_t> tasksExecuted_;
+    std::atomic<uint64_t> tasksStolen_;
+};
+
+template <>
+struct ComputePool::Invoker<void>
+{
+    template <typename Work, typename Done>
+    static void toLoop(EventLoop *loop, Work &work, Done &done)
+    {
+        work();
+        loop->runInLoop(done);
+    }
+
+    template <typename Work, typename Done>
+    static void toSequence(const ComputeSequencePtr &sequence, uint64_t seq, Work &work, Done &done)
+    {
+        try
+        {
+            work();
+        }
+        catch (...)
+        {
+            skip(sequence, seq);
+            throw;
+        }
+        sequence->getLoop()->runInLoop([sequence, seq, done]() {
+            sequence->deliver(seq, done);
+        });
+    }
+};
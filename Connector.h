@@ -0,0 +1,60 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "InetAddress.h"
+
+#include <functional>
+#include <memory>
+#include <atomic>
+
+class Channel;
+class EventLoop;
+
+// 主动发起连接：非阻塞connect，等待socket可写后检查SO_ERROR，失败时按指数退避重试
+// 连接成功后把sockfd交给NewConnectionCallback，之后socket归回调方所有
+class Connector : noncopyable,
+        public std::enable_shared_from_this<Connector>
+{
+public:
+    using NewConnectionCallback = std::function<void(int sockfd)>;
+
+    Connector(EventLoop *loop, const InetAddress &serverAddr);
+    ~Connector();
+
+    void setNewConnectionCallback(const NewConnectionCallback &cb)
+        { newConnectionCallback_ = cb; }
+
+    // start和stop可以在任意线程调用
+    void start();
+    void stop();
+    // 在loop线程中调用，连接断开后重新发起连接，重试间隔恢复为初始值
+    void restart();
+
+    const InetAddress& serverAddress() const { return serverAddr_; }
+
+private:
+    enum States { kDisconnected, kConnecting, kConnected };
+    static const int kMaxRetryDelayMs = 30 * 1000;
+    static const int kInitRetryDelayMs = 500;
+
+    void setState(States s) { state_ = s; }
+    void startInLoop();
+    void stopInLoop();
+    void connect();
+    void connecting(int sockfd);
+    void handleWrite();
+    void handleError();
+    void retry(int sockfd);
+    int removeAndResetChannel();
+    void resetChannel();
+
+    EventLoop *loop_;
+    InetAddress serverAddr_;
+    std::atomic_bool connect_;
+    std::atomic_int state_;
+    std::unique_ptr<Channel> channel_;  //只在connect进行中存在
+    NewConnectionCallback newConnectionCallback_;
+    int retryDelayMs_;
+};
+
+using ConnectorPtr = std::shared_ptr<Connector>;
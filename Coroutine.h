@@ -0,0 +1,500 @@
+#pragma once
+
+// 可选的C++20协程接口，只有头文件，库本身仍然按C++11编译，使用方需要 -std=c++20
+//
+//   server.setConnectionCallback(co::connectionHandler(
+//       [](co::Connection conn) -> co::Task<> {
+//           for (;;)
+//           {
+//               std::string line = co_await conn.readUntil("\r\n");
+//               if (line.empty()) break;    //对端关闭
+//               co_await conn.write(std::move(line));
+//           }
+//       }));
+//
+// 协程总是在连接所属的loop线程中内联恢复：读等待在onMessage中恢复，写等待在writeComplete中恢复，
+// 不经过额外的队列和线程切换；协程帧从每个loop线程自己的帧池中分配
+
+#if __cplusplus < 202002L
+#error "Coroutine.h requires C++20 (-std=c++20)"
+#endif
+
+#include "EventLoop.h"
+#include "TcpConnection.h"
+#include "Buffer.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace co
+{
+
+// 协程帧池：按64字节分档的空闲链表，每个线程一份（one loop per thread，即每个loop一份）
+// 超过kMaxFrameSize的帧直接走operator new
+class FramePool
+{
+public:
+    static void* allocate(size_t size)
+    {
+        size_t index = sizeClass(size);
+        if (index >= kNumClasses)
+        {
+            return ::operator new(size);
+        }
+        FreeNode *&head = freeLists()[index];
+        if (head)
+        {
+            FreeNode *node = head;
+            head = node->next;
+            return node;
+        }
+        return ::operator new((index + 1) * kAlignment);
+    }
+
+    static void deallocate(void *p, size_t size)
+    {
+        size_t index = sizeClass(size);
+        if (index >= kNumClasses)
+        {
+            ::operator delete(p);
+            return;
+        }
+        FreeNode *node = static_cast<FreeNode*>(p);
+        FreeNode *&head = freeLists()[index];
+        node->next = head;
+        head = node;
+    }
+
+private:
+    struct FreeNode { FreeNode *next; };
+
+    static const size_t kAlignment = 64;
+    static const size_t kMaxFrameSize = 2048;
+    static const size_t kNumClasses = kMaxFrameSize / kAlignment;
+
+    static size_t sizeClass(size_t size) { return (size + kAlignment - 1) / kAlignment - 1; }
+
+    // 线程退出时把池中的内存还给系统
+    struct FreeLists
+    {
+        FreeNode *heads[kNumClasses] = {};
+        ~FreeLists()
+        {
+            for (FreeNode *head : heads)
+            {
+                while (head)
+                {
+                    FreeNode *next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+        }
+    };
+
+    static FreeNode** freeLists()
+    {
+        static thread_local FreeLists lists;
+        return lists.heads;
+    }
+};
+
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+
+struct PromiseBase
+{
+    std::coroutine_handle<> continuation;   //co_await本任务的协程
+    std::exception_ptr exception;
+    bool detached = false;                  //spawn出来的任务，结束时自己销毁
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            PromiseBase &promise = h.promise();
+            if (promise.continuation)
+            {
+                return promise.continuation;    //对称转移，直接恢复等待者
+            }
+            if (promise.detached)
+            {
+                if (promise.exception)
+                {
+                    try
+                    {
+                        std::rethrow_exception(promise.exception);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        LOG_ERROR("co::spawn task exits with exception : %s \n", e.what());
+                    }
+                    catch (...)
+                    {
+                        LOG_ERROR("co::spawn task exits with unknown exception \n");
+                    }
+                }
+                h.destroy();
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    static void* operator new(size_t size) { return FramePool::allocate(size); }
+    static void operator delete(void *p, size_t size) { FramePool::deallocate(p, size); }
+};
+
+template <typename T>
+struct Promise : PromiseBase
+{
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    template <typename U>
+    void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+
+    T result()
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+    Task<void> get_return_object();
+    void return_void() {}
+
+    void result()
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+} // namespace detail
+
+// 惰性启动的协程任务：co_await时才开始执行，执行完对称转移回等待者
+template <typename T>
+class Task
+{
+public:
+    using promise_type = detail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle h) : handle_(h) {}
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task& operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+            {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().result(); }
+
+    // 交出协程的所有权，由spawn使用
+    Handle release() { return std::exchange(handle_, nullptr); }
+
+private:
+    Handle handle_;
+};
+
+namespace detail
+{
+
+template <typename T>
+inline Task<T> Promise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+// 在loop中启动一个任务，任务结束后自己销毁；在loop线程中调用时立即开始执行
+inline void spawn(EventLoop *loop, Task<void> &&task)
+{
+    std::coroutine_handle<detail::Promise<void>> h = task.release();
+    h.promise().detached = true;
+    loop->runInLoop([h]() { h.resume(); });
+}
+
+// co_await co::sleep(dur)：在当前loop上挂起dur后恢复
+template <typename Rep, typename Period>
+inline auto sleep(std::chrono::duration<Rep, Period> dur)
+{
+    struct SleepAwaiter
+    {
+        double seconds;
+
+        bool await_ready() const noexcept { return seconds <= 0; }
+        void await_suspend(std::coroutine_handle<> h) const
+        {
+            EventLoop *loop = EventLoop::getEventLoopOfCurrentThread();
+            if (loop == nullptr)
+            {
+                LOG_FATAL("co::sleep must be awaited in an EventLoop thread \n");
+            }
+            loop->runAfter(seconds, [h]() { h.resume(); });
+        }
+        void await_resume() const noexcept {}
+    };
+    return SleepAwaiter{ std::chrono::duration<double>(dur).count() };
+}
+
+namespace detail
+{
+
+// 一个连接上的协程等待状态，挂在TcpConnection的context上
+struct ConnectionState
+{
+    Buffer *input = nullptr;            //连接的inputBuffer_，第一次收到数据后有效
+    bool closed = false;
+    std::coroutine_handle<> reader;
+    std::coroutine_handle<> writer;
+    size_t wantBytes = 0;               //reader等待的字节数
+    std::string delimiter;              //非空时reader等待分隔符
+
+    size_t readable() const { return input ? input->readableBytes() : 0; }
+
+    // 当前数据是否满足reader等待的条件，满足时返回要取出的长度
+    std::optional<size_t> ready() const
+    {
+        if (!delimiter.empty())
+        {
+            if (input)
+            {
+                const char *begin = input->peek();
+                const char *end = begin + input->readableBytes();
+                const char *pos = std::search(begin, end, delimiter.begin(), delimiter.end());
+                if (pos != end)
+                {
+                    return static_cast<size_t>(pos - begin) + delimiter.size();
+                }
+            }
+            return std::nullopt;
+        }
+        if (readable() >= wantBytes)
+        {
+            return wantBytes;
+        }
+        return std::nullopt;
+    }
+
+    void resumeReader()
+    {
+        if (reader)
+        {
+            std::exchange(reader, nullptr).resume();
+        }
+    }
+
+    void resumeWriter()
+    {
+        if (writer)
+        {
+            std::exchange(writer, nullptr).resume();
+        }
+    }
+};
+
+} // namespace detail
+
+// 协程中使用的连接句柄，持有TcpConnection的强引用，只能在连接所属的loop线程中使用
+class Connection
+{
+public:
+    // 接管conn的消息回调，需要在conn所属的loop线程中、收到数据之前构造（一般在connectionCallback中）
+    // 写完成回调只包一层：构造时已经设置的写完成回调照常执行，之后再恢复等待写完成的协程；
+    // 构造之后再调用setWriteCompleteCallback会替换掉这一层
+    // 连接固定在当前loop上（见TcpConnection::setMigratable），TcpServer移除loop和负载均衡时不会迁走它
+    explicit Connection(const TcpConnectionPtr &conn)
+        : conn_(conn),
+        state_(std::make_shared<detail::ConnectionState>())
+    {
+        conn_->setContext(state_);
+        // 协程在本loop线程中恢复，co::sleep的定时器也排在本loop上，连接不能再迁移
+        conn_->setMigratable(false);
+        std::weak_ptr<detail::ConnectionState> weakState(state_);
+        conn_->setMessageCallback([weakState](const TcpConnectionPtr&, Buffer *buf, Timestamp) {
+            std::shared_ptr<detail::ConnectionState> state = weakState.lock();
+            if (state)
+            {
+                state->input = buf;
+                if (state->reader && state->ready())
+                {
+                    state->resumeReader();
+                }
+            }
+        });
+        WriteCompleteCallback userWriteComplete(conn_->writeCompleteCallback());
+        conn_->setWriteCompleteCallback([weakState, userWriteComplete](const TcpConnectionPtr &c) {
+            if (userWriteComplete)
+            {
+                userWriteComplete(c);
+            }
+            std::shared_ptr<detail::ConnectionState> state = weakState.lock();
+            if (state && state->writer && c->outputBytes() == 0)
+            {
+                state->resumeWriter();
+            }
+        });
+    }
+
+    const TcpConnectionPtr& connection() const { return conn_; }
+
+    // 对端关闭时由connectionHandler调用，恢复所有等待者
+    static void onClose(const TcpConnectionPtr &conn)
+    {
+        std::shared_ptr<detail::ConnectionState> state =
+            std::static_pointer_cast<detail::ConnectionState>(conn->getContext());
+        if (state)
+        {
+            state->closed = true;
+            state->resumeReader();
+            state->resumeWriter();
+        }
+    }
+
+    struct ReadAwaiter
+    {
+        std::shared_ptr<detail::ConnectionState> state;
+
+        bool await_ready() const { return state->closed || state->ready(); }
+        void await_suspend(std::coroutine_handle<> h) { state->reader = h; }
+        // 读到要求的数据；对端关闭时返回剩下的数据，没有数据时为空
+        std::string await_resume()
+        {
+            std::optional<size_t> n = state->ready();
+            size_t len = n ? *n : state->readable();
+            state->delimiter.clear();
+            return len > 0 ? state->input->retrieveAsString(len) : std::string();
+        }
+    };
+
+    // co_await conn.read(n)：读满n个字节
+    ReadAwaiter read(size_t n)
+    {
+        state_->wantBytes = n;
+        state_->delimiter.clear();
+        return ReadAwaiter{ state_ };
+    }
+
+    // co_await conn.readSome()：有数据就返回当前所有数据
+    ReadAwaiter readSome()
+    {
+        state_->wantBytes = 1;
+        state_->delimiter.clear();
+        return ReadAwaiter{ state_ };
+    }
+
+    // co_await conn.readUntil(delim)：读到分隔符为止，返回的数据包含分隔符
+    ReadAwaiter readUntil(std::string delimiter)
+    {
+        state_->wantBytes = 0;
+        state_->delimiter = std::move(delimiter);
+        return ReadAwaiter{ state_ };
+    }
+
+    struct WriteAwaiter
+    {
+        TcpConnectionPtr conn;
+        std::shared_ptr<detail::ConnectionState> state;
+        std::string data;
+
+        // 直接发送，数据全部写进socket时不挂起；挂起后由Connection构造时包的写完成回调恢复
+        bool await_ready()
+        {
+            if (state->closed)
+            {
+                return true;
+            }
+            conn->send(std::move(data));
+            return conn->outputBytes() == 0 || !conn->connected();
+        }
+        void await_suspend(std::coroutine_handle<> h) { state->writer = h; }
+        // 返回连接是否仍然有效
+        bool await_resume() const { return !state->closed; }
+    };
+
+    // co_await conn.write(buf)：发送数据，等到全部写进socket后恢复
+    WriteAwaiter write(std::string data)
+    {
+        return WriteAwaiter{ conn_, state_, std::move(data) };
+    }
+
+    void shutdown() { conn_->shutdown(); }
+
+private:
+    TcpConnectionPtr conn_;
+    std::shared_ptr<detail::ConnectionState> state_;
+};
+
+// 把协程处理函数包装成TcpServer的ConnectionCallback：每个新连接spawn一个任务
+template <typename Handler>
+ConnectionCallback connectionHandler(Handler handler)
+{
+    return [handler](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            spawn(conn->getLoop(), handler(Connection(conn)));
+        }
+        else
+        {
+            Connection::onClose(conn);
+        }
+    };
+}
+
+} // namespace co
@@ -11,7 +11,7 @@ Poller* Poller::newDefaultPoller(EventLoop *loop)
     }
     else
     {
-        return new EpollPoller(loop);
+        return new EpollPoller(loop, ::getenv("MUDUO_EPOLL_IMMEDIATE") == nullptr);
     }
     
 }
\ No newline at end of file
@@ -4,14 +4,14 @@
 
 #include <iostream>
 #include <string.h>
+#include <algorithm>
 
-const int kNew = -1;
-const int kAdded = 1;
-const int kdeleted = 2;
+const int kNew = -1;    //不在channels_中
+const int kAdded = 1;   //在channels_中，内核中是否注册见FdState
 
-EpollPoller::EpollPoller(EventLoop *loop)
+EpollPoller::EpollPoller(EventLoop *loop, bool batched)
     :Poller(loop), epollfd_(::epoll_create1(EPOLL_CLOEXEC)),
-    events_(kInitEventListSize)
+    events_(kInitEventListSize), batched_(batched)
 {
     if (epollfd_ < 0)
     {
@@ -30,30 +30,24 @@ void EpollPoller::updateChannel(Channel *channel)
 {
     const int index = channel->index();
 
-    LOG_INFO("func = %s> fd = %d events = %d index = %d \n", __FUNCTION__, channel->fd(), channel->events(), index);
-    
-    if (index == kNew || index == kdeleted)
+    LOG_DEBUG("func = %s> fd = %d events = %d index = %d \n", __FUNCTION__, channel->fd(), channel->events(), index);
+
+    countInterestUpdate();
+    if (index == kNew)
     {
-        if (index == kNew)
-        {       
-            int fd = channel->fd();
-            channels_[fd] = channel;
-        }
+        addToChannelMap(channel);
         channel->set_index(kAdded);
-        update(EPOLL_CTL_ADD, channel);
     }
-    else    //channel已经在poller上注册过了
+    if (!batched_)
     {
-        int fd = channel->fd();
-        if (channel->isNoneEvent())
-        {
-            update(EPOLL_CTL_DEL, channel);
-            channel->set_index(kdeleted);
-        }
-        else
-        {
-            update(EPOLL_CTL_MOD, channel);
-        }   
+        applyUpdate(channel);
+        return;
+    }
+    FdState &state = fdState(channel->fd());
+    if (!state.dirty)
+    {
+        state.dirty = true;
+        dirtyFds_.push_back(channel->fd());
     }
 }
 
@@ -61,17 +55,77 @@ void EpollPoller::removeChannel(Channel *channel)
 {
     int fd = channel->fd();
     int index = channel->index();
-    channels_.erase(fd);
+    removeFromChannelMap(channel);
 
-    LOG_INFO("func = %s> fd = %d \n", __FUNCTION__, fd);
+    LOG_DEBUG("func = %s> fd = %d \n", __FUNCTION__, fd);
 
     if (index == kAdded)
     {
-        update(EPOLL_CTL_DEL, channel);
+        // 立即从内核中删除，还没有flush的变化一起丢弃，之后fd可以被关闭和复用
+        FdState &state = fdState(fd);
+        if (state.added)
+        {
+            update(EPOLL_CTL_DEL, channel);
+        }
+        state.added = false;
+        state.dirty = false;
+        state.registered = 0;
     }
     channel->set_index(kNew);
 }
 
+EpollPoller::FdState& EpollPoller::fdState(int fd)
+{
+    size_t index = static_cast<size_t>(fd);
+    if (index >= fdStates_.size())
+    {
+        FdState empty = { false, false, 0 };
+        fdStates_.resize(std::max(index + 1, fdStates_.size() * 2), empty);
+    }
+    return fdStates_[index];
+}
+
+// 按channel当前的事件和内核中注册的事件决定ADD/MOD/DEL，没有变化时不调用epoll_ctl
+// 立即模式保持原来的行为：每次都调用
+void EpollPoller::applyUpdate(Channel *channel)
+{
+    FdState &state = fdState(channel->fd());
+    if (!state.added)
+    {
+        if (batched_ && channel->isNoneEvent())
+        {
+            return;
+        }
+        update(EPOLL_CTL_ADD, channel);
+        state.added = true;
+    }
+    else if (channel->isNoneEvent())
+    {
+        update(EPOLL_CTL_DEL, channel);
+        state.added = false;
+    }
+    else if (!batched_ || channel->events() != state.registered)
+    {
+        update(EPOLL_CTL_MOD, channel);
+    }
+    state.registered = state.added ? channel->events() : 0;
+}
+
+void EpollPoller::flushUpdates()
+{
+    for (int fd : dirtyFds_)
+    {
+        FdState &state = fdStates_[fd];
+        // removeChannel会清掉dirty，这时channels_[fd]可能已经是空的或者换了channel
+        if (state.dirty)
+        {
+            state.dirty = false;
+            applyUpdate(channels_[fd]);
+        }
+    }
+    dirtyFds_.clear();
+}
+
 // 填写活跃的连接
 void EpollPoller::fillActiveChannels(int numEvents, ChannelList *activeChannels) const
 {
@@ -96,6 +150,7 @@ void EpollPoller::update(int operation, Channel *channel)
     event.data.ptr = channel;
 
     int fd = channel->fd();
+    countCtlCall();
     if (::epoll_ctl(epollfd_, operation, fd, &event) < 0)
     {
         if (operation == EPOLL_CTL_DEL)
@@ -112,10 +167,10 @@ void EpollPoller::update(int operation, Channel *channel)
 //epoll_wait
 Timestamp EpollPoller::poll(int timeoutMs, ChannelList *activeChannels) 
 {
-    //实际上用LOG_DEBUG更合适
-    
-    LOG_INFO("func = %s, total counts = %zu \n", __FUNCTION__, channels_.size());
-    
+    LOG_DEBUG("func = %s, fd table size = %zu \n", __FUNCTION__, channels_.size());
+
+    flushUpdates();
+
     int numEvents = epoll_wait(epollfd_, &*events_.begin(), static_cast<int>(events_.size()), timeoutMs);
     int saveErrno = errno;
 
@@ -123,7 +178,7 @@ Timestamp EpollPoller::poll(int timeoutMs, ChannelList *activeChannels)
 
     if (numEvents > 0)
     {
-        LOG_INFO("%d events happend \n", numEvents);
+        LOG_DEBUG("%d events happend \n", numEvents);
         fillActiveChannels(numEvents, activeChannels);
 
         //扩容操作
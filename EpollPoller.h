@@ -7,10 +7,14 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 
+// channel的事件变化默认先记下来，在下一次epoll_wait之前按fd合并，和内核中已注册的事件比较后
+// 只对真正变化的fd调用一次epoll_ctl，同一轮中打开又关闭EPOLLOUT这类互相抵消的变化不产生系统调用
+// removeChannel总是立即生效，之后fd可以被关闭和复用
 class EpollPoller : public Poller
 {
 public:
-    EpollPoller(EventLoop *loop);
+    // batched为false时每次updateChannel立即调用epoll_ctl（环境变量MUDUO_EPOLL_IMMEDIATE）
+    explicit EpollPoller(EventLoop *loop, bool batched = true);
     ~EpollPoller() override;
 
     //重写基类Poller的抽象方法
@@ -25,9 +29,24 @@ private:
     void fillActiveChannels(int numEvents, ChannelList *activeChannels) const;
     // 更新channel通道
     void update(int operation, Channel *channel);
+    // 把积攒的事件变化写进内核，在epoll_wait之前调用
+    void flushUpdates();
+    void applyUpdate(Channel *channel);
+
+    // 每个fd在内核中的注册状态，以fd为下标，和channels_一样大
+    struct FdState
+    {
+        bool added;         //已经EPOLL_CTL_ADD
+        bool dirty;         //在dirtyFds_中等待flush
+        int registered;     //内核中注册的事件
+    };
+    FdState& fdState(int fd);
 
     using EventList = std::vector<epoll_event>;
 
     int epollfd_;
     EventList events_;
+    const bool batched_;
+    std::vector<FdState> fdStates_;
+    std::vector<int> dirtyFds_;
 };
\ No newline at end of file
@@ -2,8 +2,12 @@
 #include "logger.h"
 #include "Poller.h"
 #include "Channel.h"
+#include "TimerQueue.h"
+#include "BufferPool.h"
+#include "Trace.h"
 
 #include <sys/eventfd.h>
+#include <sched.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -33,7 +37,21 @@ EventLoop::EventLoop()
     , poller_(Poller::newDefaultPoller(this))
     , wakeupFd_(createEventfd())
     , wakeupChannel_(new Channel(this, wakeupFd_))
+    , timerQueue_(new TimerQueue(this))
+    , nextActive_(0)
     , CurrenActiveChannels_(nullptr)
+    , nextFunctor_(0)
+    , ioBudgetEvents_(0)
+    , ioBudgetMicros_(0)
+    , taskBudget_(0)
+    , taskBudgetMicros_(0)
+    , deferredTasks_(0)
+    , ioBudgetExhausted_(0)
+    , taskBudgetExhausted_(0)
+    , callingFlushFunctors_(false)
+    , busyMicros_(0)
+    , queueSize_(0)
+    , cpu_(-1)
 {
     LOG_DEBUG("EventLoop created %p in thread %d \n", this, threadId_);
     if (t_loopInThisThread)
@@ -77,20 +95,39 @@ void EventLoop::loop()
 
     while (!quit_)
     {
-        activeChannels_.clear();
-        // 监听两类fd，1. client Fd     2. wakeupFd
-        pollReturnTime_ = poller_->poll(kPollerTime, &activeChannels_);
-        
-        for (Channel *channel : activeChannels_)
+        Timestamp iterationStart;
+        //上一轮IO预算用完时，先把剩下的就绪channel处理完再poll，每个就绪的fd都轮到之后才会有fd被处理第二次
+        if (nextActive_ == activeChannels_.size())
         {
-            //Poller监听哪些channel发生了事件，上报给EventLoop，然后EventLoop来处理这些事件
-            channel->handleEvent(pollReturnTime_);
+            activeChannels_.clear();
+            nextActive_ = 0;
+            //还有留下的回调时不等待
+            int timeoutMs = nextFunctor_ < runningFunctors_.size() ? 0 : kPollerTime;
+            // 监听两类fd，1. client Fd     2. wakeupFd
+            Trace::begin("poll");
+            pollReturnTime_ = poller_->poll(timeoutMs, &activeChannels_);
+            Trace::end("poll");
+            iterationStart = pollReturnTime_;
         }
+        else
+        {
+            iterationStart = Timestamp::now();
+        }
+
+        //Poller监听哪些channel发生了事件，上报给EventLoop，然后EventLoop来处理这些事件
+        handleActiveChannels();
         //执行当前EventLoop循环所需要的回调操作
         // mainloop事先注册一个回调cb（需要subloop来执行）， wakeup subloop后，执行下面的回调方法，执行mainloop注册的回调方法
 
         doPendingFunctors();
-        
+        //本轮中积攒的写操作统一写出
+        doFlushFunctors();
+
+        int64_t busy = Timestamp::now().microSecondsSinceEpoch() - iterationStart.microSecondsSinceEpoch();
+        if (busy > 0)
+        {
+            busyMicros_.store(busyMicros_.load(std::memory_order_relaxed) + busy, std::memory_order_relaxed);
+        }
     }
     looping_ = false;
     LOG_INFO("EventLoop %p is stop looping...\n", this);
@@ -127,15 +164,95 @@ void EventLoop::queueInLoop(Functor cb)
     {
         std::unique_lock<std::mutex> lock(mutex_);
         pendingFunctors_.emplace_back(cb);
+        queueSize_.store(pendingFunctors_.size() + urgentFunctors_.size(), std::memory_order_relaxed);
+    }
+    if (Trace::enabled() && !isInLoopThread())
+    {
+        Trace::instant("queueInLoop", "toTid", threadId_);
     }
     //唤醒相应的需要执行上述回调操作的线程  
     //CallingPendingFunctors_ 是指当前loop正在进行回调操作，而此时给当前EventLoop增加了新的回调；
-    if (!isInLoopThread() || CallingPendingFunctors_ )
+    if (!isInLoopThread() || CallingPendingFunctors_ || callingFlushFunctors_)
     {
         wakeup();
     }   
 }
 
+void EventLoop::queueUrgent(Functor cb)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        urgentFunctors_.emplace_back(std::move(cb));
+        queueSize_.store(pendingFunctors_.size() + urgentFunctors_.size(), std::memory_order_relaxed);
+    }
+    if (!isInLoopThread() || CallingPendingFunctors_ || callingFlushFunctors_)
+    {
+        wakeup();
+    }
+}
+
+void EventLoop::setIoBudget(size_t maxEvents, int64_t maxMicros)
+{
+    ioBudgetEvents_ = maxEvents;
+    ioBudgetMicros_ = maxMicros;
+}
+
+void EventLoop::setTaskBudget(size_t maxTasks, int64_t maxMicros)
+{
+    taskBudget_ = maxTasks;
+    taskBudgetMicros_ = maxMicros;
+}
+
+bool EventLoop::pinToCpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (::sched_setaffinity(0, sizeof set, &set) != 0)
+    {
+        LOG_ERROR("EventLoop %p pin to cpu %d fail : %d \n", this, cpu, errno);
+        return false;
+    }
+    cpu_.store(cpu, std::memory_order_relaxed);
+    return true;
+}
+
+EventLoop* EventLoop::getEventLoopOfCurrentThread()
+{
+    return t_loopInThisThread;
+}
+
+BufferPool* EventLoop::bufferPool()
+{
+    if (!bufferPool_)
+    {
+        bufferPool_.reset(new BufferPool);
+    }
+    return bufferPool_.get();
+}
+
+TimerId EventLoop::runAt(Timestamp time, TimerCallback cb)
+{
+    return timerQueue_->addTimer(std::move(cb), time, 0.0);
+}
+
+TimerId EventLoop::runAfter(double delay, TimerCallback cb)
+{
+    Timestamp time(addTime(Timestamp::now(), delay));
+    return runAt(time, std::move(cb));
+}
+
+TimerId EventLoop::runEvery(double interval, TimerCallback cb)
+{
+    Timestamp time(addTime(Timestamp::now(), interval));
+    return timerQueue_->addTimer(std::move(cb), time, interval);
+}
+
+void EventLoop::cancel(TimerId timerId)
+{
+    timerQueue_->cancel(timerId);
+}
+
 //调用poller的方法
 void EventLoop::updateChannel(Channel* channel)
 {
@@ -144,12 +261,30 @@ void EventLoop::updateChannel(Channel* channel)
 void EventLoop::removeChannel(Channel* channel)
 {
     poller_->removeChannel(channel);
+    //还没有轮到的就绪事件作废，channel之后可能被析构
+    for (size_t i = nextActive_; i < activeChannels_.size(); ++i)
+    {
+        if (activeChannels_[i] == channel)
+        {
+            activeChannels_[i] = nullptr;
+        }
+    }
 }
 void EventLoop::hasChannel(Channel* channel)
 {
     poller_->hasChannel(channel);
 }
 
+uint64_t EventLoop::interestUpdates() const
+{
+    return poller_->interestUpdates();
+}
+
+uint64_t EventLoop::epollCtlCalls() const
+{
+    return poller_->ctlCalls();
+}
+
 //唤醒loop所在的线程
 void EventLoop::wakeup()
 {
@@ -161,22 +296,118 @@ void EventLoop::wakeup()
     }
 }
 
+void EventLoop::handleActiveChannels()
+{
+    bool budgeted = ioBudgetEvents_ > 0 || ioBudgetMicros_ > 0;
+    int64_t start = budgeted ? Timestamp::now().microSecondsSinceEpoch() : 0;
+    size_t handled = 0;
+    while (nextActive_ < activeChannels_.size())
+    {
+        Channel *channel = activeChannels_[nextActive_++];
+        if (channel == nullptr)
+        {
+            continue;
+        }
+        channel->handleEvent(pollReturnTime_);
+        ++handled;
+        if (budgeted && nextActive_ < activeChannels_.size()
+            && ((ioBudgetEvents_ > 0 && handled >= ioBudgetEvents_)
+                || (ioBudgetMicros_ > 0 && Timestamp::now().microSecondsSinceEpoch() - start >= ioBudgetMicros_)))
+        {
+            ioBudgetExhausted_.store(ioBudgetExhausted_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            break;
+        }
+    }
+}
+
 //执行回调
 void EventLoop::doPendingFunctors() 
 {
-    std::vector<Functor> functors;
+    std::vector<Functor> urgent;
     CallingPendingFunctors_ = true;
+
+    //已经执行过的前缀先删掉，否则预算一直不够用时runningFunctors_只增不减
+    if (nextFunctor_ > 0 && nextFunctor_ < runningFunctors_.size())
+    {
+        runningFunctors_.erase(runningFunctors_.begin(), runningFunctors_.begin() + nextFunctor_);
+        nextFunctor_ = 0;
+    }
     
     {
         std::unique_lock<std::mutex> lock(mutex_);
-        functors.swap(pendingFunctors_);
+        urgent.swap(urgentFunctors_);
+        if (nextFunctor_ == runningFunctors_.size())
+        {
+            runningFunctors_.clear();
+            nextFunctor_ = 0;
+            runningFunctors_.swap(pendingFunctors_);
+        }
+        else
+        {
+            //上一轮留下的回调排在前面
+            for (Functor &functor : pendingFunctors_)
+            {
+                runningFunctors_.emplace_back(std::move(functor));
+            }
+            pendingFunctors_.clear();
+        }
+        queueSize_.store(0, std::memory_order_relaxed);
     }
 
-    for (const Functor &functor : functors)
+    for (const Functor &functor : urgent)
     {
+        functor();
+    }
+
+    size_t count = runningFunctors_.size() - nextFunctor_;
+    bool traced = Trace::enabled() && count > 0;
+    if (traced)
+    {
+        Trace::begin("pendingFunctors", "count", count);
+    }
+    bool budgeted = taskBudget_ > 0 || taskBudgetMicros_ > 0;
+    int64_t start = budgeted ? Timestamp::now().microSecondsSinceEpoch() : 0;
+    size_t ran = 0;
+    while (nextFunctor_ < runningFunctors_.size())
+    {
+        //执行完立即析构，回调持有的对象不会因为留下的回调而延迟释放
+        Functor functor;
+        functor.swap(runningFunctors_[nextFunctor_++]);
         functor(); //执行当前loop所需执行的回调操作
+        ++ran;
+        if (budgeted && nextFunctor_ < runningFunctors_.size()
+            && ((taskBudget_ > 0 && ran >= taskBudget_)
+                || (taskBudgetMicros_ > 0 && Timestamp::now().microSecondsSinceEpoch() - start >= taskBudgetMicros_)))
+        {
+            taskBudgetExhausted_.store(taskBudgetExhausted_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            break;
+        }
+    }
+    deferredTasks_.store(runningFunctors_.size() - nextFunctor_, std::memory_order_relaxed);
+    if (traced)
+    {
+        Trace::end("pendingFunctors");
     }
     CallingPendingFunctors_ = false;
 }
 
+void EventLoop::queueFlush(Functor cb)
+{
+    flushFunctors_.emplace_back(std::move(cb));
+}
 
+void EventLoop::doFlushFunctors()
+{
+    //flush中还可能登记新的flush（例如向同一loop上的其他连接send），一并在本轮处理完
+    while (!flushFunctors_.empty())
+    {
+        std::vector<Functor> functors;
+        functors.swap(flushFunctors_);
+        callingFlushFunctors_ = true;
+        for (const Functor &functor : functors)
+        {
+            functor();
+        }
+        callingFlushFunctors_ = false;
+    }
+}
@@ -8,9 +8,13 @@
 
 #include "Timestamp.h"
 #include "CurrentThread.h"
+#include "Callbacks.h"
+#include "TimerId.h"
 
 class Channel;
 class Poller;
+class TimerQueue;
+class BufferPool;
 //事件循环类 主要包括 channel 和 poller(epoll的抽象)
 class EventLoop
 {
@@ -31,10 +35,25 @@ public:
     void runInLoop(Functor cb);
     //把cb放入队列中，唤醒loop所在的线程，执行cb
     void queueInLoop(Functor cb);
+    //高优先级的队列：每轮在普通回调之前全部执行，不受setTaskBudget的限制
+    void queueUrgent(Functor cb);
 
     //唤醒loop所在的线程
     void wakeup();
 
+    //在本轮循环的末尾(处理完IO事件和pending回调之后)执行cb，只能在loop线程中调用
+    //用于合并写等需要在一轮循环结束时统一处理的操作
+    void queueFlush(Functor cb);
+
+    //定时器，线程安全，回调在loop线程中执行
+    //在time时刻执行cb
+    TimerId runAt(Timestamp time, TimerCallback cb);
+    //delay秒之后执行cb
+    TimerId runAfter(double delay, TimerCallback cb);
+    //每隔interval秒执行一次cb
+    TimerId runEvery(double interval, TimerCallback cb);
+    void cancel(TimerId timerId);
+
     //EventLoop的方法 => 调用Poller的方法
     void updateChannel(Channel* channel);
     void removeChannel(Channel* channel);
@@ -42,10 +61,49 @@ public:
 
     //判断EventLoop的对象是否在自己的线程里面
     bool isInLoopThread() const { return threadId_ == CurrentThread::tid(); }
+    //loop()是否正在运行，可以在任意线程读取；没有运行的loop不会再执行排队的回调
+    bool isLooping() const { return looping_; }
+
+    //当前线程的EventLoop，没有时返回nullptr
+    static EventLoop* getEventLoopOfCurrentThread();
+
+    //本loop的读缓冲区池（溢出区和空闲块），第一次调用时创建，只能在loop线程中使用
+    BufferPool* bufferPool();
+
+    //loop线程处理事件、回调和flush累计用掉的时间（微秒，不含poll等待），可以在任意线程读取
+    //两次读数之差除以间隔就是这段时间的忙碌比例，TcpServer的负载均衡用它比较各loop
+    int64_t busyMicroseconds() const { return busyMicros_.load(std::memory_order_relaxed); }
+    //排队等待执行的回调个数，可以在任意线程读取，TcpServer的准入控制用它判断loop是否过载
+    size_t queueSize() const
+    {
+        return queueSize_.load(std::memory_order_relaxed) + deferredTasks_.load(std::memory_order_relaxed);
+    }
+
+    //每轮循环的预算，0表示不限制，只能在loop线程中或loop开始之前调用
+    //IO事件：一轮最多处理maxEvents个就绪channel、最多用maxMicros微秒，剩下的channel下一轮先处理完再poll
+    void setIoBudget(size_t maxEvents, int64_t maxMicros);
+    //回调：一轮最多执行maxTasks个、最多用maxMicros微秒，剩下的下一轮排在新回调之前执行
+    //预算只在处理完一个事件或回调之后检查，每轮至少处理一个
+    void setTaskBudget(size_t maxTasks, int64_t maxMicros);
+    //预算用完、留下了未处理工作的轮数，可以在任意线程读取，用来调整预算
+    uint64_t ioBudgetExhausted() const { return ioBudgetExhausted_.load(std::memory_order_relaxed); }
+    uint64_t taskBudgetExhausted() const { return taskBudgetExhausted_.load(std::memory_order_relaxed); }
+
+    //Channel事件变化的次数和实际的epoll_ctl调用次数，可以在任意线程读取
+    //变化在每轮poll之前合并提交，两者之比反映合并省掉的系统调用
+    uint64_t interestUpdates() const;
+    uint64_t epollCtlCalls() const;
+
+    //把loop线程绑定到一个CPU上，只能在loop线程中调用（例如ThreadInitCallback中），失败返回false
+    bool pinToCpu(int cpu);
+    //绑定的CPU，没有绑定时返回-1，可以在任意线程读取
+    int cpu() const { return cpu_.load(std::memory_order_relaxed); }
 
 private:
     void handleRead();  //唤醒wakeup
+    void handleActiveChannels();    //按预算处理就绪的channel
     void doPendingFunctors();   //执行回调
+    void doFlushFunctors();     //执行本轮末尾的flush
 
     using ChannelList = std::vector<Channel*>;
 
@@ -59,12 +117,34 @@ private:
 
     int wakeupFd_; //当mainLoop获取一个新用户的channel后，通过轮询算法选择一个subloop，通过该成员唤醒subloop来执行工作
     std::unique_ptr<Channel> wakeupChannel_;
+    std::unique_ptr<TimerQueue> timerQueue_;
+    std::unique_ptr<BufferPool> bufferPool_;
 
     ChannelList activeChannels_;
+    size_t nextActive_;     //activeChannels_中下一个要处理的位置，小于size()时下一轮不poll
     Channel *CurrenActiveChannels_;
 
     std::atomic_bool CallingPendingFunctors_;    //标识当前loop是否有需要回调的操作
     std::vector<Functor> pendingFunctors_;  //存储loop所需要执行的所有回调操作
+    std::vector<Functor> urgentFunctors_;   //queueUrgent的回调
     std::mutex mutex_;  //互斥锁，保护上述vector的线程安全操作
+
+    std::vector<Functor> runningFunctors_;  //正在执行的一批回调，预算用完时剩下的留在这里，只在loop线程中访问
+    size_t nextFunctor_;
+
+    size_t ioBudgetEvents_;
+    int64_t ioBudgetMicros_;
+    size_t taskBudget_;
+    int64_t taskBudgetMicros_;
+    std::atomic<size_t> deferredTasks_;     //runningFunctors_中还没有执行的个数
+    std::atomic<uint64_t> ioBudgetExhausted_;
+    std::atomic<uint64_t> taskBudgetExhausted_;
+
+    std::vector<Functor> flushFunctors_;    //本轮末尾执行的flush，只在loop线程中访问
+    bool callingFlushFunctors_;
+
+    std::atomic<int64_t> busyMicros_;   //只有loop线程写
+    std::atomic<size_t> queueSize_;     //pendingFunctors_和urgentFunctors_的个数，在mutex_内更新
+    std::atomic<int> cpu_;
 };
 
@@ -1,15 +1,18 @@
 #include "EventLoopThreadPool.h"
 #include "EventLoopThread.h"
+#include "EventLoop.h"
 
 #include <string.h>
 #include <memory>
+#include <algorithm>
 
 EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop, const std::string &nameArg)
     : baseLoop_(baseLoop),
     name_(nameArg),
     started_(false),
     numThreads_(0),
-    next_(0)
+    next_(0),
+    nextThreadId_(0)
 {
 
 }
@@ -19,14 +22,11 @@ EventLoopThreadPool::~EventLoopThreadPool() {}
 void EventLoopThreadPool::start(const ThreadInitCallback &cb)
 {
     started_ = true;
+    threadInitCallback_ = cb;
     
     for (int i = 0; i < numThreads_; ++i)
     {
-        char buf[name_.size() + 32];
-        snprintf(buf, sizeof buf, "%s%d", name_.c_str(), i);
-        EventLoopThread *t = new EventLoopThread(cb, buf);
-        threads_.push_back(std::unique_ptr<EventLoopThread>(t));
-        loops_.push_back(t->startLoop());   //底层创建线程，绑定新的EventLoop，返回其地址
+        loops_.push_back(startThread());
     }
 
     //整个服务器只有一个线程， 运行着baseLoop
@@ -36,6 +36,66 @@ void EventLoopThreadPool::start(const ThreadInitCallback &cb)
     }
 }
 
+EventLoop* EventLoopThreadPool::startThread()
+{
+    char buf[name_.size() + 32];
+    int id = nextThreadId_++;
+    snprintf(buf, sizeof buf, "%s%d", name_.c_str(), id);
+    ThreadInitCallback cb(threadInitCallback_);
+    if (!cpus_.empty())
+    {
+        int cpu = cpus_[id % cpus_.size()];
+        ThreadInitCallback userCb(threadInitCallback_);
+        cb = [cpu, userCb](EventLoop *loop) {
+            loop->pinToCpu(cpu);
+            if (userCb)
+            {
+                userCb(loop);
+            }
+        };
+    }
+    EventLoopThread *t = new EventLoopThread(cb, buf);
+    threads_.push_back(std::unique_ptr<EventLoopThread>(t));
+    EventLoop *loop = t->startLoop();   //底层创建线程，绑定新的EventLoop，返回其地址
+    threadLoops_.push_back(loop);
+    return loop;
+}
+
+EventLoop* EventLoopThreadPool::addLoop()
+{
+    EventLoop *loop = startThread();
+    loops_.push_back(loop);
+    return loop;
+}
+
+void EventLoopThreadPool::retireLoop(EventLoop *loop)
+{
+    auto it = std::find(loops_.begin(), loops_.end(), loop);
+    if (it != loops_.end())
+    {
+        loops_.erase(it);
+        if (next_ >= static_cast<int>(loops_.size()))
+        {
+            next_ = 0;
+        }
+    }
+}
+
+bool EventLoopThreadPool::removeLoop(EventLoop *loop)
+{
+    auto it = std::find(threadLoops_.begin(), threadLoops_.end(), loop);
+    if (it == threadLoops_.end())
+    {
+        return false;
+    }
+    retireLoop(loop);
+    size_t index = it - threadLoops_.begin();
+    threadLoops_.erase(it);
+    // EventLoopThread析构时quit并join
+    threads_.erase(threads_.begin() + index);
+    return true;
+}
+
 //如果工作在多线程，baseLoop_默认以轮询的方式分配channel给subloop
 EventLoop* EventLoopThreadPool::getNextLoop()
 {
@@ -19,6 +19,8 @@ public:
     ~EventLoopThreadPool();
 
     void setThreadNum(int numThreads) { numThreads_ = numThreads; }
+    // 在start之前调用：第i个loop线程绑定到cpus[i % cpus.size()]，在ThreadInitCallback之前绑定
+    void setThreadCpus(const std::vector<int> &cpus) { cpus_ = cpus; }
 
     void start(const ThreadInitCallback &cb = ThreadInitCallback());
 
@@ -27,15 +29,30 @@ public:
 
     std::vector<EventLoop*> getAllLoops();
 
+    // 运行中增减subloop，和getNextLoop一样只能在baseLoop线程中调用
+    // addLoop启动一个新的loop线程（同样执行start时的ThreadInitCallback），之后参与轮询分配
+    EventLoop* addLoop();
+    // 把loop移出轮询，不再分配新的连接，线程继续运行，之后还要调用removeLoop
+    void retireLoop(EventLoop *loop);
+    // 停止loop线程并回收，调用前要先把它上面的连接迁走（见TcpConnection::migrateTo）
+    // loop不属于本线程池时返回false
+    bool removeLoop(EventLoop *loop);
+
     bool started() const { return started_; }
 
     const std::string name() const { return name_; }
 private:
+    EventLoop* startThread();
+
     EventLoop *baseLoop_;   //EventLoop
     std::string name_;
     bool started_;
     int numThreads_;
     int next_;
-    std::vector<std::unique_ptr<EventLoopThread>> threads_;
-    std::vector<EventLoop*> loops_;
+    int nextThreadId_;      //线程名的编号，移除过的编号不再复用
+    ThreadInitCallback threadInitCallback_;
+    std::vector<int> cpus_;
+    std::vector<std::unique_ptr<EventLoopThread>> threads_; //包括已经retire还没有remove的
+    std::vector<EventLoop*> threadLoops_;   //和threads_一一对应
+    std::vector<EventLoop*> loops_;         //参与轮询分配的loop
 };
\ No newline at end of file
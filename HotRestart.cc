@@ -0,0 +1,215 @@
+#include "HotRestart.h"
+#include "Channel.h"
+#include "EventLoop.h"
+#include "InetAddress.h"
+#include "Socket.h"
+#include "logger.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+HotRestart::HotRestart(EventLoop *loop, const std::string &controlPath)
+    : loop_(loop),
+    controlPath_(controlPath),
+    controlFd_(-1)
+{
+}
+
+HotRestart::~HotRestart()
+{
+    if (controlFd_ >= 0)
+    {
+        channel_->disableAll();
+        channel_->remove();
+        ::close(controlFd_);
+    }
+}
+
+int HotRestart::listenControl(const std::string &controlPath)
+{
+    InetAddress addr(InetAddress::fromUnixPath(controlPath));
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        LOG_FATAL("%s:%s:%d control socket create err: %d \n", __FILE__, __FUNCTION__, __LINE__, errno);
+    }
+    // 旧进程还在监听时不能删掉它的控制地址，只清理残留的socket文件
+    if (!Socket::removeStaleUnixPath(addr)
+        || ::bind(fd, addr.getSockAddr(), addr.getSockLen()) < 0 || ::listen(fd, 4) < 0)
+    {
+        LOG_FATAL("%s:%s:%d control socket %s bind/listen err: %d \n",
+            __FILE__, __FUNCTION__, __LINE__, controlPath.c_str(), errno);
+    }
+    return fd;
+}
+
+// 消息内容为fd的个数，fd本身放在SCM_RIGHTS控制消息中
+bool HotRestart::sendFds(int sockfd, const std::vector<int> &fds)
+{
+    if (fds.empty() || fds.size() > static_cast<size_t>(kMaxFds))
+    {
+        LOG_ERROR("HotRestart::sendFds - invalid fd count %lu \n", fds.size());
+        return false;
+    }
+    uint32_t count = static_cast<uint32_t>(fds.size());
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof count;
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    if (::sendmsg(sockfd, &msg, MSG_NOSIGNAL) != sizeof count)
+    {
+        LOG_ERROR("HotRestart::sendFds - sendmsg err: %d \n", errno);
+        return false;
+    }
+    return true;
+}
+
+bool HotRestart::recvFds(int sockfd, std::vector<int> *fds)
+{
+    uint32_t count = 0;
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof count;
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxFds));
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    ssize_t n = ::recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+    if (n != sizeof count)
+    {
+        LOG_ERROR("HotRestart::recvFds - recvmsg returns %ld err: %d \n", n, errno);
+        return false;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            size_t num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *received = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            fds->insert(fds->end(), received, received + num);
+        }
+    }
+    if (fds->size() != count || (msg.msg_flags & MSG_CTRUNC))
+    {
+        LOG_ERROR("HotRestart::recvFds - expect %u fds, got %lu \n", count, fds->size());
+        for (int fd : *fds)
+        {
+            ::close(fd);
+        }
+        fds->clear();
+        return false;
+    }
+    return true;
+}
+
+bool HotRestart::inherit(const std::string &controlPath, std::vector<int> *fds, double timeoutSeconds)
+{
+    InetAddress addr(InetAddress::fromUnixPath(controlPath));
+    int sockfd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+    {
+        LOG_ERROR("HotRestart::inherit - socket err: %d \n", errno);
+        return false;
+    }
+    if (::connect(sockfd, addr.getSockAddr(), addr.getSockLen()) < 0)
+    {
+        // 没有旧进程，正常的冷启动
+        LOG_INFO("HotRestart::inherit - no running instance on %s \n", controlPath.c_str());
+        ::close(sockfd);
+        return false;
+    }
+
+    struct timeval tv;
+    tv.tv_sec = static_cast<time_t>(timeoutSeconds);
+    tv.tv_usec = static_cast<suseconds_t>((timeoutSeconds - tv.tv_sec) * 1000 * 1000);
+    ::setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+    bool ok = recvFds(sockfd, fds);
+    if (ok)
+    {
+        // 旧进程关闭控制socket之后才会关闭这条连接，等到EOF再返回，
+        // 保证新进程随后在同一个地址上listenControl不会冲突
+        char c;
+        while (::read(sockfd, &c, sizeof c) > 0)
+        {
+        }
+        LOG_INFO("HotRestart::inherit - got %lu listening fds from %s \n", fds->size(), controlPath.c_str());
+    }
+    ::close(sockfd);
+    return ok;
+}
+
+bool HotRestart::handoff(int controlFd, const std::vector<int> &fds)
+{
+    // 控制连接使用阻塞模式，消息很小，一次sendmsg就能完成
+    int connfd = ::accept4(controlFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (connfd < 0)
+    {
+        if (errno != EAGAIN)
+        {
+            LOG_ERROR("HotRestart::handoff - accept err: %d \n", errno);
+        }
+        return false;
+    }
+    bool ok = sendFds(connfd, fds);
+    if (ok)
+    {
+        // 先关闭控制socket，新进程看到这条连接的EOF之后就可以接管控制地址了
+        ::close(controlFd);
+    }
+    ::close(connfd);
+    return ok;
+}
+
+void HotRestart::serve(const std::vector<int> &fds, const HandoffCallback &cb)
+{
+    fds_ = fds;
+    handoffCallback_ = cb;
+    controlFd_ = listenControl(controlPath_);
+    channel_.reset(new Channel(loop_, controlFd_));
+    channel_->setReadCallback(std::bind(&HotRestart::handleRead, this));
+    channel_->enabeReading();
+    LOG_INFO("HotRestart::serve - waiting for new instance on %s \n", controlPath_.c_str());
+}
+
+void HotRestart::handleRead()
+{
+    // handoff成功时会关闭controlFd_，先把channel从poller上摘下来
+    channel_->disableAll();
+    if (HotRestart::handoff(controlFd_, fds_))
+    {
+        channel_->remove();     //正处在该channel的回调中，channel_本身留到析构时释放
+        controlFd_ = -1;
+        LOG_INFO("HotRestart - listening fds handed off to new instance \n");
+        if (handoffCallback_)
+        {
+            handoffCallback_();
+        }
+    }
+    else
+    {
+        channel_->enabeReading();
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+class EventLoop;
+class Channel;
+
+// 不停服升级时在新旧进程之间交接监听socket
+// 旧进程在控制socket(Unix域，controlPath以'@'开头时为abstract地址)上等待，
+// 新进程启动时连上来，旧进程用SCM_RIGHTS把监听fd发给新进程，之后旧进程停止accept并排空已有连接
+// 监听socket始终处于打开状态，升级期间新连接在内核的accept队列中排队，不会被拒绝
+class HotRestart : noncopyable
+{
+public:
+    using HandoffCallback = std::function<void()>;
+
+    HotRestart(EventLoop *loop, const std::string &controlPath);
+    ~HotRestart();
+
+    // 新进程启动时调用，阻塞地向旧进程取监听fd，顺序与旧进程serve时给出的一致
+    // 没有旧进程在运行时返回false，此时应自己创建监听socket
+    static bool inherit(const std::string &controlPath, std::vector<int> *fds, double timeoutSeconds = 5.0);
+
+    // 旧进程：在loop中监听控制socket，fds被新进程取走后回调cb（一般调用TcpServer::drain）
+    // 只交接一次，交接后控制socket随即关闭
+    void serve(const std::vector<int> &fds, const HandoffCallback &cb);
+
+    // 以下为底层接口，Prefork的supervisor进程不使用EventLoop，直接调用
+    // 创建并监听控制socket，返回非阻塞的fd
+    static int listenControl(const std::string &controlPath);
+    // 在控制socket上accept一个新进程并把fds发过去，成功返回true
+    static bool handoff(int controlFd, const std::vector<int> &fds);
+    // 通过Unix域socket收发fd
+    static bool sendFds(int sockfd, const std::vector<int> &fds);
+    static bool recvFds(int sockfd, std::vector<int> *fds);
+
+    static const int kMaxFds = 64;
+
+private:
+    void handleRead();
+
+    EventLoop *loop_;
+    const std::string controlPath_;
+    int controlFd_;
+    std::unique_ptr<Channel> channel_;
+    std::vector<int> fds_;
+    HandoffCallback handoffCallback_;
+};
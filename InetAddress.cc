@@ -3,36 +3,124 @@
 #include <string>
 #include <strings.h>
 #include <string.h>
+#include <stddef.h>
 #include <iostream>
+#include <algorithm>
 
 InetAddress::InetAddress(uint16_t port, std::string ip) {
-    bzero(&addr_, sizeof(addr_));
-    addr_.sin_family = AF_INET;
-    addr_.sin_port = htons(port);
-    addr_.sin_addr.s_addr = inet_addr(ip.c_str());
+    bzero(&addrUn_, sizeof(addrUn_));
+    if (ip.find(':') != std::string::npos)
+    {
+        addr6_.sin6_family = AF_INET6;
+        addr6_.sin6_port = htons(port);
+        ::inet_pton(AF_INET6, ip.c_str(), &addr6_.sin6_addr);
+        len_ = sizeof addr6_;
+    }
+    else
+    {
+        addr_.sin_family = AF_INET;
+        addr_.sin_port = htons(port);
+        addr_.sin_addr.s_addr = inet_addr(ip.c_str());
+        len_ = sizeof addr_;
+    }
+}
+
+InetAddress::InetAddress(const sockaddr *addr, socklen_t len) {
+    setSockAddr(addr, len);
+}
+
+InetAddress InetAddress::fromUnixPath(const std::string &path) {
+    sockaddr_un un;
+    bzero(&un, sizeof un);
+    un.sun_family = AF_UNIX;
+    size_t n = std::min(path.size(), sizeof(un.sun_path) - 1);
+    memcpy(un.sun_path, path.data(), n);
+    if (n > 0 && path[0] == '@')
+    {
+        un.sun_path[0] = '\0';  //abstract namespace，长度里不包含结尾的'\0'
+    }
+    else
+    {
+        ++n;    //文件路径带上结尾的'\0'
+    }
+    return InetAddress(reinterpret_cast<const sockaddr*>(&un),
+        static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + n));
+}
+
+void InetAddress::setSockAddr(const sockaddr *addr, socklen_t len) {
+    bzero(&addrUn_, sizeof(addrUn_));
+    len_ = std::min(len, static_cast<socklen_t>(sizeof(addrUn_)));
+    memcpy(&addrUn_, addr, len_);
+    if (len_ < sizeof(sa_family_t))
+    {
+        addr_.sin_family = AF_UNSPEC;
+    }
 }
 
 std::string InetAddress::toIp() const {
     char buf[64] = {0};
-    ::inet_ntop(AF_INET, &addr_.sin_addr, buf, sizeof(buf));
+    if (family() == AF_INET6)
+    {
+        ::inet_ntop(AF_INET6, &addr6_.sin6_addr, buf, sizeof(buf));
+    }
+    else if (family() == AF_INET)
+    {
+        ::inet_ntop(AF_INET, &addr_.sin_addr, buf, sizeof(buf));
+    }
     return buf;
 }
 std::string InetAddress::toIpPort() const {
+    if (isUnix())
+    {
+        return "unix:" + toUnixPath();
+    }
     char buf[64] = {0};
-    inet_ntop(AF_INET, &addr_.sin_addr, buf, sizeof(buf));
-    size_t end = strlen(buf);
-    uint16_t port = ntohs(addr_.sin_port);
-    sprintf(buf + end, ":%u", port);
+    size_t end = 0;
+    if (family() == AF_INET6)
+    {
+        buf[0] = '[';
+        inet_ntop(AF_INET6, &addr6_.sin6_addr, buf + 1, sizeof(buf) - 1);
+        end = strlen(buf);
+        buf[end++] = ']';
+    }
+    else
+    {
+        inet_ntop(AF_INET, &addr_.sin_addr, buf, sizeof(buf));
+        end = strlen(buf);
+    }
+    uint16_t port = toPort();
+    snprintf(buf + end, sizeof(buf) - end, ":%u", port);
     return buf;
 }
 
 uint16_t InetAddress::toPort() const {
-    uint16_t port = ntohs(addr_.sin_port);
+    uint16_t port = 0;
+    if (family() == AF_INET6)
+    {
+        port = ntohs(addr6_.sin6_port);
+    }
+    else if (family() == AF_INET)
+    {
+        port = ntohs(addr_.sin_port);
+    }
     return port;
 }
 
+std::string InetAddress::toUnixPath() const {
+    if (!isUnix() || len_ <= offsetof(sockaddr_un, sun_path))
+    {
+        return std::string();   //未命名的Unix域socket，比如客户端
+    }
+    size_t n = len_ - offsetof(sockaddr_un, sun_path);
+    if (addrUn_.sun_path[0] == '\0')
+    {
+        return "@" + std::string(addrUn_.sun_path + 1, n - 1);
+    }
+    return std::string(addrUn_.sun_path, strnlen(addrUn_.sun_path, n));
+}
+
 // int main() {
 //     InetAddress net_addr(8080);
 //     std::cout << net_addr.toIpPort() << std::endl;
 //     return 0;
-// }
\ No newline at end of file
+// }
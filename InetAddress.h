@@ -2,30 +2,53 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <string>
 
-//封装socket地址类型
+//封装socket地址类型，支持IPv4、IPv6和Unix域(含abstract namespace)地址
 class InetAddress
 {
 private:
-    sockaddr_in addr_;
+    union
+    {
+        sockaddr_in addr_;
+        sockaddr_in6 addr6_;
+        sockaddr_un addrUn_;
+    };
+    socklen_t len_;     //地址的实际长度，bind/connect时使用
 public:
+    // ip中含有':'时按IPv6解析
     explicit InetAddress(uint16_t port = 0, std::string ip = "127.0.0.1");
     explicit InetAddress(const sockaddr_in &addr) 
-        : addr_(addr) 
+        : addr_(addr), len_(sizeof addr)
+    {}
+    explicit InetAddress(const sockaddr_in6 &addr)
+        : addr6_(addr), len_(sizeof addr)
     {}
+    InetAddress(const sockaddr *addr, socklen_t len);
+
+    // Unix域地址，path以'@'开头时表示Linux abstract namespace，不在文件系统中创建文件
+    static InetAddress fromUnixPath(const std::string &path);
+
+    sa_family_t family() const { return addr_.sin_family; }
+    bool isUnix() const { return family() == AF_UNIX; }
+    // abstract namespace地址的第一个字节是'\0'
+    bool isAbstractUnix() const { return isUnix() && len_ > sizeof(sa_family_t) && addrUn_.sun_path[0] == '\0'; }
 
     std::string toIp() const;
-    std::string toIpPort() const;
+    std::string toIpPort() const;   // IPv6为"[ip]:port"，Unix域为"unix:path"
     uint16_t toPort() const;
+    std::string toUnixPath() const; // abstract地址以'@'开头
 
-    const sockaddr_in* getSockAddr() const {
-        return &addr_;
+    const sockaddr* getSockAddr() const {
+        return reinterpret_cast<const sockaddr*>(&addr_);
     }
+    socklen_t getSockLen() const { return len_; }
 
     void setSockAddr(const sockaddr_in &addr)
     {
         addr_ = addr;
+        len_ = sizeof addr;
     }
+    void setSockAddr(const sockaddr *addr, socklen_t len);
 };
-
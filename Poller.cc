@@ -1,14 +1,34 @@
 #include "Poller.h"
 #include "Channel.h"
 
+#include <algorithm>
+
 Poller::Poller(EventLoop *loop) 
-    :ownerLoop_(loop)
+    :ownerLoop_(loop), interestUpdates_(0), ctlCalls_(0)
     {}
 Poller::~Poller() {}
 
 bool Poller::hasChannel(Channel *channel) const
 {
-    auto it = channels_.find(channel->fd());
-    return it != channels_.end() && it->second == channel;
-    
+    size_t fd = static_cast<size_t>(channel->fd());
+    return fd < channels_.size() && channels_[fd] == channel;
+}
+
+void Poller::addToChannelMap(Channel *channel)
+{
+    size_t fd = static_cast<size_t>(channel->fd());
+    if (fd >= channels_.size())
+    {
+        channels_.resize(std::max(fd + 1, channels_.size() * 2), nullptr);
+    }
+    channels_[fd] = channel;
+}
+
+void Poller::removeFromChannelMap(Channel *channel)
+{
+    size_t fd = static_cast<size_t>(channel->fd());
+    if (fd < channels_.size() && channels_[fd] == channel)
+    {
+        channels_[fd] = nullptr;
+    }
 }
\ No newline at end of file
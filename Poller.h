@@ -3,8 +3,9 @@
 #include "noncopyable.h"
 #include "Timestamp.h"
 
+#include <atomic>
+#include <stdint.h>
 #include <vector>
-#include <unordered_map>
 
 class Channel;
 class EventLoop;
@@ -25,13 +26,27 @@ public:
     // 判断参数channel是否在当前Poller中
     bool hasChannel(Channel *channel) const;
 
+    // updateChannel被调用的次数和实际的epoll_ctl等系统调用次数，可以在任意线程读取
+    uint64_t interestUpdates() const { return interestUpdates_.load(std::memory_order_relaxed); }
+    uint64_t ctlCalls() const { return ctlCalls_.load(std::memory_order_relaxed); }
+
     //EventLoop可以通过该接口获取默认的IO复用的具体实现
     static Poller* newDefaultPoller(EventLoop *loop);
 
 protected:
-    // map 的 key : sockfd, value : sockfd所属的channel
-    using ChannelMap = std::unordered_map<int, Channel*>;
+    // 以sockfd为下标的平坦表，value : sockfd所属的channel，未注册的位置为nullptr
+    // fd由内核从小到大分配，表的大小跟随最大的fd增长
+    using ChannelMap = std::vector<Channel*>;
     ChannelMap channels_;
+
+    void addToChannelMap(Channel *channel);
+    void removeFromChannelMap(Channel *channel);
+
+    // 只有loop线程写
+    void countInterestUpdate() { interestUpdates_.store(interestUpdates_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+    void countCtlCall() { ctlCalls_.store(ctlCalls_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
 private:
     EventLoop *ownerLoop_; //定义Poller所属事件循环
+    std::atomic<uint64_t> interestUpdates_;
+    std::atomic<uint64_t> ctlCalls_;
 };
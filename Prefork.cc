@@ -0,0 +1,235 @@
+#include "Prefork.h"
+#include "HotRestart.h"
+#include "CurrentThread.h"
+#include "logger.h"
+
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+// worker启动后不到这么久就退出，认为是启动失败，延迟这么久再重启
+static const double kMinWorkerLifetime = 1.0;
+
+Prefork::Prefork(const std::vector<int> &listenFds, int numWorkers)
+    : listenFds_(listenFds),
+    numWorkers_(numWorkers),
+    drainTimeout_(30.0),
+    signalFd_(-1),
+    controlFd_(-1),
+    stopping_(false),
+    handedOff_(false)
+{
+}
+
+Prefork::~Prefork()
+{
+    for (int fd : listenFds_)
+    {
+        ::close(fd);
+    }
+}
+
+int Prefork::run(const WorkerFunc &func)
+{
+    workerFunc_ = func;
+
+    // SIGCHLD和退出信号都通过signalfd和控制socket一起在poll中处理
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    ::sigprocmask(SIG_BLOCK, &mask, &oldMask);
+    signalFd_ = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd_ < 0)
+    {
+        LOG_FATAL("%s:%s:%d signalfd err: %d \n", __FILE__, __FUNCTION__, __LINE__, errno);
+    }
+    if (!controlPath_.empty())
+    {
+        controlFd_ = HotRestart::listenControl(controlPath_);
+    }
+
+    for (int i = 0; i < numWorkers_; ++i)
+    {
+        spawn(i);
+    }
+
+    while (!(stopping_ && workers_.empty()))
+    {
+        // 计算最近的定时事件：延迟重启或者强制杀掉worker
+        Timestamp now(Timestamp::now());
+        Timestamp next = stopping_ ? killDeadline_ : Timestamp::invalid();
+        for (auto &item : respawnAt_)
+        {
+            if (!next.valid() || item.second < next)
+            {
+                next = item.second;
+            }
+        }
+        int timeoutMs = -1;
+        if (next.valid())
+        {
+            timeoutMs = next < now ? 0 : static_cast<int>(timeDifference(next, now) * 1000) + 1;
+        }
+
+        struct pollfd pfds[2];
+        pfds[0].fd = signalFd_;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = controlFd_;    //controlFd_为-1时poll忽略该项
+        pfds[1].events = POLLIN;
+        int n = ::poll(pfds, 2, timeoutMs);
+        if (n < 0 && errno != EINTR)
+        {
+            LOG_ERROR("Prefork::run poll err: %d \n", errno);
+        }
+
+        if (n > 0 && (pfds[0].revents & POLLIN))
+        {
+            struct signalfd_siginfo info;
+            while (::read(signalFd_, &info, sizeof info) == sizeof info)
+            {
+                if (info.ssi_signo == SIGCHLD)
+                {
+                    reapWorkers();
+                }
+                else
+                {
+                    LOG_INFO("Prefork - supervisor got signal %d, stopping workers \n", info.ssi_signo);
+                    stopWorkers();
+                }
+            }
+        }
+        if (n > 0 && controlFd_ >= 0 && (pfds[1].revents & POLLIN))
+        {
+            if (HotRestart::handoff(controlFd_, listenFds_))
+            {
+                // 新的supervisor已经拿到监听fd并开始fork自己的worker，旧的worker排空后退出
+                LOG_INFO("Prefork - listening fds handed off, draining old workers \n");
+                controlFd_ = -1;
+                handedOff_ = true;
+                stopWorkers();
+            }
+        }
+
+        now = Timestamp::now();
+        for (auto it = respawnAt_.begin(); it != respawnAt_.end(); )
+        {
+            if (!stopping_ && it->second < now)
+            {
+                spawn(it->first);
+                it = respawnAt_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        if (stopping_ && killDeadline_ < now)
+        {
+            for (auto &item : workers_)
+            {
+                LOG_ERROR("Prefork - worker %d pid %d did not exit in time, kill it \n", item.second, item.first);
+                ::kill(item.first, SIGKILL);
+            }
+            killDeadline_ = Timestamp(INT64_MAX);
+        }
+    }
+
+    if (controlFd_ >= 0)
+    {
+        ::close(controlFd_);
+        controlFd_ = -1;
+        // 交接之后控制地址已经属于新进程，不能删
+        if (!handedOff_ && controlPath_[0] != '@')
+        {
+            ::unlink(controlPath_.c_str());
+        }
+    }
+    ::close(signalFd_);
+    signalFd_ = -1;
+    ::sigprocmask(SIG_SETMASK, &oldMask, nullptr);
+    LOG_INFO("Prefork - all workers exited \n");
+    return 0;
+}
+
+void Prefork::spawn(int index)
+{
+    // 避免stdio缓冲区里的内容在子进程中再输出一遍
+    ::fflush(nullptr);
+    pid_t pid = ::fork();
+    if (pid < 0)
+    {
+        LOG_ERROR("Prefork - fork worker %d err: %d \n", index, errno);
+        respawnAt_[index] = addTime(Timestamp::now(), kMinWorkerLifetime);
+        return;
+    }
+    if (pid == 0)
+    {
+        // worker进程：丢掉supervisor的状态，恢复信号掩码，线程id缓存的是父进程的
+        CurrentThread::t_cachedTid = 0;
+        ::close(signalFd_);
+        if (controlFd_ >= 0)
+        {
+            ::close(controlFd_);
+        }
+        sigset_t empty;
+        sigemptyset(&empty);
+        ::sigprocmask(SIG_SETMASK, &empty, nullptr);
+        int code = workerFunc_(index, listenFds_);
+        ::exit(code);
+    }
+    LOG_INFO("Prefork - worker %d started, pid = %d \n", index, pid);
+    workers_[pid] = index;
+    startTimes_[index] = Timestamp::now();
+}
+
+void Prefork::reapWorkers()
+{
+    int status = 0;
+    pid_t pid;
+    while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        auto it = workers_.find(pid);
+        if (it == workers_.end())
+        {
+            continue;
+        }
+        int index = it->second;
+        workers_.erase(it);
+        LOG_INFO("Prefork - worker %d pid %d exited, status = %d \n", index, pid, status);
+        if (stopping_)
+        {
+            continue;
+        }
+        Timestamp now(Timestamp::now());
+        if (timeDifference(now, startTimes_[index]) < kMinWorkerLifetime)
+        {
+            respawnAt_[index] = addTime(now, kMinWorkerLifetime);
+        }
+        else
+        {
+            spawn(index);
+        }
+    }
+}
+
+void Prefork::stopWorkers()
+{
+    if (stopping_)
+    {
+        return;
+    }
+    stopping_ = true;
+    respawnAt_.clear();
+    killDeadline_ = addTime(Timestamp::now(), drainTimeout_ + 1.0);
+    for (auto &item : workers_)
+    {
+        ::kill(item.first, SIGTERM);
+    }
+}
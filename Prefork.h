@@ -0,0 +1,56 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Timestamp.h"
+
+#include <sys/types.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// 多进程(prefork)模式
+// supervisor进程持有监听socket并fork出numWorkers个worker，worker继承监听fd，各自创建EventLoop和TcpServer
+// worker异常退出后supervisor重新fork一个，避免accept能力下降
+// supervisor收到SIGTERM/SIGINT，或通过控制socket把监听fd交给了新版本的supervisor(HotRestart)后，
+// 向所有worker发SIGTERM让它们排空连接，超过drainTimeout仍未退出的worker被SIGKILL
+//
+// supervisor本身不使用EventLoop，要在创建任何EventLoop和线程之前调用run()
+class Prefork : noncopyable
+{
+public:
+    // 在worker进程中执行，返回值作为worker进程的退出码
+    // worker应当用SignalWatcher处理SIGTERM，调用TcpServer::drain后退出loop
+    using WorkerFunc = std::function<int(int index, const std::vector<int> &listenFds)>;
+
+    Prefork(const std::vector<int> &listenFds, int numWorkers);
+    ~Prefork();
+
+    // 开启热升级：在controlPath上等待新版本的进程来取监听fd，见HotRestart::inherit
+    void setControlPath(const std::string &path) { controlPath_ = path; }
+    // worker排空连接的时间，supervisor在此基础上再多等1秒才强制杀掉worker
+    void setDrainTimeout(double seconds) { drainTimeout_ = seconds; }
+
+    // 阻塞直到所有worker退出，返回0
+    int run(const WorkerFunc &func);
+
+private:
+    void spawn(int index);
+    void reapWorkers();
+    void stopWorkers();
+
+    const std::vector<int> listenFds_;
+    const int numWorkers_;
+    std::string controlPath_;
+    double drainTimeout_;
+    WorkerFunc workerFunc_;
+
+    int signalFd_;
+    int controlFd_;
+    bool stopping_;
+    bool handedOff_;
+    Timestamp killDeadline_;
+    std::map<pid_t, int> workers_;          // pid => worker编号
+    std::map<int, Timestamp> startTimes_;   // worker编号 => 启动时间
+    std::map<int, Timestamp> respawnAt_;    // 启动后很快就退出的worker延迟重启，避免疯狂fork
+};
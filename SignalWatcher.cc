@@ -0,0 +1,62 @@
+#include "SignalWatcher.h"
+#include "Channel.h"
+#include "EventLoop.h"
+#include "logger.h"
+
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+static int createSignalfd(const sigset_t *mask)
+{
+    int fd = ::signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_FATAL("%s:%s:%d signalfd err: %d \n", __FILE__, __FUNCTION__, __LINE__, errno);
+    }
+    return fd;
+}
+
+static sigset_t blockSignals(const std::vector<int> &signals, sigset_t *oldMask)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signo : signals)
+    {
+        sigaddset(&mask, signo);
+    }
+    ::pthread_sigmask(SIG_BLOCK, &mask, oldMask);
+    return mask;
+}
+
+SignalWatcher::SignalWatcher(EventLoop *loop, const std::vector<int> &signals, const SignalCallback &cb)
+    : loop_(loop),
+    mask_(blockSignals(signals, &oldMask_)),
+    signalFd_(createSignalfd(&mask_)),
+    channel_(new Channel(loop, signalFd_)),
+    signalCallback_(cb)
+{
+    channel_->setReadCallback(std::bind(&SignalWatcher::handleRead, this));
+    channel_->enabeReading();
+}
+
+SignalWatcher::~SignalWatcher()
+{
+    channel_->disableAll();
+    channel_->remove();
+    ::close(signalFd_);
+    ::pthread_sigmask(SIG_SETMASK, &oldMask_, nullptr);
+}
+
+void SignalWatcher::handleRead()
+{
+    struct signalfd_siginfo info;
+    while (::read(signalFd_, &info, sizeof info) == sizeof info)
+    {
+        LOG_INFO("SignalWatcher - signal %d \n", info.ssi_signo);
+        if (signalCallback_)
+        {
+            signalCallback_(static_cast<int>(info.ssi_signo));
+        }
+    }
+}
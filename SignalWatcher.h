@@ -0,0 +1,32 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <signal.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class EventLoop;
+class Channel;
+
+// 通过signalfd在loop线程中处理信号，回调和普通IO事件一样执行，可以安全地调用任意库函数
+// 构造时在当前线程屏蔽这些信号，新线程会继承信号掩码，所以要在启动线程池(TcpServer::start)之前构造
+class SignalWatcher : noncopyable
+{
+public:
+    using SignalCallback = std::function<void(int signo)>;
+
+    SignalWatcher(EventLoop *loop, const std::vector<int> &signals, const SignalCallback &cb);
+    ~SignalWatcher();
+
+private:
+    void handleRead();
+
+    EventLoop *loop_;
+    sigset_t mask_;
+    sigset_t oldMask_;
+    const int signalFd_;
+    std::unique_ptr<Channel> channel_;
+    SignalCallback signalCallback_;
+};
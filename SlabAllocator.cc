@@ -0,0 +1,76 @@
+#include "SlabAllocator.h"
+
+static size_t alignUp(size_t size)
+{
+    const size_t align = alignof(max_align_t);
+    size = size < sizeof(void*) ? sizeof(void*) : size;
+    return (size + align - 1) / align * align;
+}
+
+FixedSizeSlab::FixedSizeSlab(size_t objectSize)
+    : objectSize_(alignUp(objectSize)),
+    freeList_(nullptr),
+    inUse_(0)
+{
+}
+
+FixedSizeSlab::~FixedSizeSlab()
+{
+    for (char *slab : slabs_)
+    {
+        ::operator delete(slab);
+    }
+}
+
+void* FixedSizeSlab::allocate()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (freeList_ == nullptr)
+    {
+        grow();
+    }
+    FreeNode *node = freeList_;
+    freeList_ = node->next;
+    ++inUse_;
+    return node;
+}
+
+void FixedSizeSlab::deallocate(void *p)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    FreeNode *node = static_cast<FreeNode*>(p);
+    node->next = freeList_;
+    freeList_ = node;
+    --inUse_;
+}
+
+// 新申请一块slab，切成槽位放进空闲链表，至少能放下一个对象
+void FixedSizeSlab::grow()
+{
+    size_t count = kSlabBytes / objectSize_;
+    if (count == 0)
+    {
+        count = 1;
+    }
+    char *slab = static_cast<char*>(::operator new(count * objectSize_));
+    slabs_.push_back(slab);
+    for (size_t i = count; i > 0; --i)
+    {
+        FreeNode *node = reinterpret_cast<FreeNode*>(slab + (i - 1) * objectSize_);
+        node->next = freeList_;
+        freeList_ = node;
+    }
+}
+
+size_t FixedSizeSlab::objectsInUse() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return inUse_;
+}
+
+size_t FixedSizeSlab::bytesReserved() const
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t count = kSlabBytes / objectSize_;
+    return slabs_.size() * (count == 0 ? 1 : count) * objectSize_;
+}
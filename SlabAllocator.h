@@ -0,0 +1,84 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <stddef.h>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// 定长对象的slab分配器：每次向系统申请一整块(kSlabBytes)，切成等长的槽位串成空闲链表
+// 释放的槽位回到空闲链表复用，不还给系统；省掉每个对象的malloc头和碎片
+// 线程安全：连接在baseloop中创建，在各自的ioLoop中销毁
+class FixedSizeSlab : noncopyable
+{
+public:
+    static const size_t kSlabBytes = 64 * 1024;
+
+    explicit FixedSizeSlab(size_t objectSize);
+    ~FixedSizeSlab();
+
+    void* allocate();
+    void deallocate(void *p);
+
+    size_t objectSize() const { return objectSize_; }
+    size_t objectsInUse() const;
+    size_t bytesReserved() const;
+
+private:
+    struct FreeNode { FreeNode *next; };
+
+    void grow();
+
+    const size_t objectSize_;   //按max_align_t对齐后的槽位大小
+    mutable std::mutex mutex_;
+    FreeNode *freeList_;
+    std::vector<char*> slabs_;
+    size_t inUse_;
+};
+
+// 给std::allocate_shared使用的分配器，对象和shared_ptr的控制块一起从slab中分配
+// 每种类型一个slab，进程内不销毁（对象可能在静态析构之后才释放）
+template <typename T>
+class SlabAllocator
+{
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = SlabAllocator<U>; };
+
+    SlabAllocator() {}
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if (n != 1)
+        {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(slab().allocate());
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (n != 1)
+        {
+            ::operator delete(p);
+            return;
+        }
+        slab().deallocate(p);
+    }
+
+    static FixedSizeSlab& slab()
+    {
+        static FixedSizeSlab *slab = new FixedSizeSlab(sizeof(T));
+        return *slab;
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const SlabAllocator<T>&, const SlabAllocator<U>&) { return true; }
+template <typename T, typename U>
+inline bool operator!=(const SlabAllocator<T>&, const SlabAllocator<U>&) { return false; }
@@ -5,7 +5,9 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <string.h>
+#include <errno.h>
 #include <netinet/tcp.h>
 
 Socket::~Socket()
@@ -15,7 +17,7 @@ Socket::~Socket()
 
 void Socket::bindAddress(const InetAddress &localaddr)
 {
-    if (bind(sockfd_, (sockaddr *)localaddr.getSockAddr(), sizeof(sockaddr_in)) != 0)
+    if (bind(sockfd_, localaddr.getSockAddr(), localaddr.getSockLen()) != 0)
     {
         LOG_FATAL("bind sockfd fail : %d \n", sockfd_);
     }
@@ -32,13 +34,13 @@ void Socket::listen()
 
 int Socket::accept(InetAddress *peeraddr)
 {
-    struct sockaddr_in addr;
+    struct sockaddr_storage addr;
     bzero(&addr, sizeof(addr));
     socklen_t len = sizeof(addr);
     int connfd = ::accept4(sockfd_,(sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (connfd >= 0)
     {
-        peeraddr->setSockAddr(addr);
+        peeraddr->setSockAddr((sockaddr*)&addr, len);
     }
     return connfd;
 }
@@ -74,4 +76,62 @@ void Socket::setKeepAlive(bool on)
 {
     int optval = on ? 1 : 0;
     ::setsockopt(sockfd_, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof optval);
-}
\ No newline at end of file
+}
+
+bool Socket::setZeroCopy(bool on)
+{
+#ifdef SO_ZEROCOPY
+    int optval = on ? 1 : 0;
+    if (::setsockopt(sockfd_, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof optval) == 0)
+    {
+        return true;
+    }
+    LOG_INFO("setsockopt SO_ZEROCOPY fail : %d \n", errno);
+#endif
+    return false;
+}
+
+void Socket::setTcpNotSentLowat(int bytes)
+{
+    if (::setsockopt(sockfd_, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof bytes) < 0)
+    {
+        LOG_ERROR("setsockopt TCP_NOTSENT_LOWAT fail : %d \n", errno);
+    }
+}
+
+bool Socket::removeStaleUnixPath(const InetAddress &addr)
+{
+    if (!addr.isUnix() || addr.isAbstractUnix())
+    {
+        return true;
+    }
+    std::string path = addr.toUnixPath();
+    struct stat st;
+    if (::lstat(path.c_str(), &st) < 0)
+    {
+        return true;    //文件不存在等情况交给bind报错
+    }
+    if (!S_ISSOCK(st.st_mode))
+    {
+        LOG_ERROR("Socket::removeStaleUnixPath - %s is not a socket \n", path.c_str());
+        errno = EADDRINUSE;
+        return false;
+    }
+    // 只有连接被拒绝才说明没有进程在监听，连接成功或者backlog满(EAGAIN)都说明地址还在使用
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    int ret = ::connect(fd, addr.getSockAddr(), addr.getSockLen());
+    int savedErrno = errno;
+    ::close(fd);
+    if (ret < 0 && savedErrno == ECONNREFUSED)
+    {
+        ::unlink(path.c_str());
+        return true;
+    }
+    LOG_ERROR("Socket::removeStaleUnixPath - %s is in use \n", path.c_str());
+    errno = EADDRINUSE;
+    return false;
+}
@@ -24,6 +24,14 @@ public:
     void setReuseAddr(bool on);
     void setReusePort(bool on);
     void setKeepAlive(bool on);
+    // 内核发送队列中未发送数据低于bytes时才通知可写
+    void setTcpNotSentLowat(int bytes);
+    // SO_ZEROCOPY，内核不支持时返回false
+    bool setZeroCopy(bool on);
+
+    // bind Unix域地址之前调用：路径上残留的socket文件没有进程在监听时删掉
+    // 路径不是socket文件或者仍有进程在监听时返回false，errno为EADDRINUSE；abstract地址不用处理
+    static bool removeStaleUnixPath(const InetAddress &addr);
     
 private:
     const int sockfd_;
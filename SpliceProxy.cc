@@ -0,0 +1,310 @@
+#include "SpliceProxy.h"
+#include "EventLoop.h"
+#include "TcpConnection.h"
+#include "logger.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <unistd.h>
+#include <functional>
+
+// 一次读事件最多搬运的轮数，源连接一直有数据时把loop让给其他连接，水平触发下次还会通知
+static const int kMaxRoundsPerEvent = 16;
+
+std::shared_ptr<SpliceProxy> SpliceProxy::start(const TcpConnectionPtr &a, const TcpConnectionPtr &b,
+                                                size_t pipeSize)
+{
+    std::shared_ptr<SpliceProxy> proxy(new SpliceProxy(a, b, pipeSize));
+    a->getLoop()->runInLoop(std::bind(&SpliceProxy::startInLoop, proxy));
+    return proxy;
+}
+
+SpliceProxy::SpliceProxy(const TcpConnectionPtr &a, const TcpConnectionPtr &b, size_t pipeSize)
+    : pipeSize_(pipeSize),
+      takenOver_(0),
+      closed_(false)
+{
+    conns_[0] = a;
+    conns_[1] = b;
+    for (int i = 0; i < 2; ++i)
+    {
+        sides_[i].init(this, i);
+        Direction &dir = dirs_[i];
+        if (::pipe2(dir.pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+        {
+            LOG_FATAL("SpliceProxy pipe create err : %d \n", errno);
+        }
+        // 失败时保持默认的容量（一般是64K）
+        ::fcntl(dir.pipe[1], F_SETPIPE_SZ, static_cast<int>(pipeSize));
+        int size = ::fcntl(dir.pipe[1], F_GETPIPE_SZ);
+        if (size > 0)
+        {
+            pipeSize_ = static_cast<size_t>(size);
+        }
+        dir.inPipe = 0;
+        dir.eof = false;
+        dir.shutdown = false;
+        dir.bytes = 0;
+    }
+}
+
+SpliceProxy::~SpliceProxy()
+{
+    for (Direction &dir : dirs_)
+    {
+        ::close(dir.pipe[0]);
+        ::close(dir.pipe[1]);
+    }
+}
+
+// 在a的loop中执行；a或b此后被迁移走时重新来过
+void SpliceProxy::startInLoop()
+{
+    TcpConnectionPtr a(conns_[0].lock());
+    TcpConnectionPtr b(conns_[1].lock());
+    if (!a || !b || !a->connected() || !b->connected())
+    {
+        closeBoth();
+        return;
+    }
+    EventLoop *loop = a->getLoop();
+    if (!loop->isInLoopThread())
+    {
+        loop->queueInLoop(std::bind(&SpliceProxy::startInLoop, shared_from_this()));
+        return;
+    }
+    if (b->getLoop() != loop)
+    {
+        // 固定在别的loop上的连接迁不过来，done永远不会回调
+        if (!b->migratable())
+        {
+            LOG_ERROR("SpliceProxy::start %s is pinned to another loop \n", b->name().c_str());
+            closeBoth();
+            return;
+        }
+        // done回调之后b才在新loop中重新注册，接管放到它之后
+        std::shared_ptr<SpliceProxy> self(shared_from_this());
+        b->migrateTo(loop, [self, loop](const TcpConnectionPtr&) {
+            loop->queueInLoop(std::bind(&SpliceProxy::startInLoop, self));
+        });
+        return;
+    }
+
+    // 还有没写完的数据时接管会等它们写完，两个连接都接管之后才开始搬运
+    std::shared_ptr<SpliceProxy> self(shared_from_this());
+    a->takeOverIo(std::shared_ptr<ChannelHandler>(self, &sides_[0]),
+        std::bind(&SpliceProxy::tookOver, self, 0, std::placeholders::_1, std::placeholders::_2));
+    b->takeOverIo(std::shared_ptr<ChannelHandler>(self, &sides_[1]),
+        std::bind(&SpliceProxy::tookOver, self, 1, std::placeholders::_1, std::placeholders::_2));
+}
+
+void SpliceProxy::tookOver(int index, bool ok, std::string &unread)
+{
+    if (!ok)
+    {
+        // 另一个连接接管失败时关闭了本连接，不再重复打印
+        TcpConnectionPtr conn(conns_[index].lock());
+        if (!closed_ && conn)
+        {
+            LOG_ERROR("SpliceProxy::start %s can not take over io \n", conn->name().c_str());
+        }
+        closeBoth();
+        return;
+    }
+    dirs_[index].head.swap(unread);
+    if (++takenOver_ < 2 || closed_)
+    {
+        return;
+    }
+    TcpConnectionPtr a(conns_[0].lock());
+    TcpConnectionPtr b(conns_[1].lock());
+    if (!a || !b)
+    {
+        closeBoth();
+        return;
+    }
+    LOG_INFO("SpliceProxy::start %s <=> %s pipe size = %zu \n", a->name().c_str(), b->name().c_str(), pipeSize_);
+    pump(0);
+    pump(1);
+}
+
+// 先把已经读进来的数据发给对端，发完了再从源连接读，直到源连接读空、对端写满或者读到EOF
+void SpliceProxy::pump(int direction)
+{
+    if (closed_ || takenOver_ < 2)
+    {
+        return;
+    }
+    TcpConnectionPtr src(conns_[direction].lock());
+    TcpConnectionPtr dst(conns_[1 - direction].lock());
+    if (!src || !dst || src->disconnected() || dst->disconnected())
+    {
+        closeBoth();
+        return;
+    }
+    Direction &dir = dirs_[direction];
+    int srcFd = src->ioChannel()->fd();
+    int dstFd = dst->ioChannel()->fd();
+
+    for (int round = 0; round < kMaxRoundsPerEvent; ++round)
+    {
+        FlushResult result = flush(dir, dstFd);
+        if (result == kFlushError)
+        {
+            closeBoth();
+            return;
+        }
+        if (result == kBlocked)
+        {
+            break;
+        }
+        if (dir.eof)
+        {
+            if (!dir.shutdown)
+            {
+                ::shutdown(dstFd, SHUT_WR);
+                dir.shutdown = true;
+            }
+            if (dirs_[1 - direction].shutdown)
+            {
+                closeBoth();
+                return;
+            }
+            break;
+        }
+        ssize_t n = ::splice(srcFd, nullptr, dir.pipe[1], nullptr, pipeSize_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            dir.inPipe += n;
+        }
+        else if (n == 0)
+        {
+            dir.eof = true;
+        }
+        else if (errno == EAGAIN)
+        {
+            break;  //管道是空的，只能是源连接读空了
+        }
+        else if (errno != EINTR)
+        {
+            LOG_ERROR("SpliceProxy::pump splice from fd = %d err : %d \n", srcFd, errno);
+            closeBoth();
+            return;
+        }
+    }
+    updateInterest();
+}
+
+SpliceProxy::FlushResult SpliceProxy::flush(Direction &dir, int dstFd)
+{
+    while (!dir.head.empty())
+    {
+        ssize_t n = ::send(dstFd, dir.head.data(), dir.head.size(), MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            dir.head.erase(0, n);
+            dir.bytes.fetch_add(n, std::memory_order_relaxed);
+        }
+        else if (errno == EAGAIN)
+        {
+            return kBlocked;
+        }
+        else if (errno != EINTR)
+        {
+            LOG_ERROR("SpliceProxy::flush send to fd = %d err : %d \n", dstFd, errno);
+            return kFlushError;
+        }
+    }
+    while (dir.inPipe > 0)
+    {
+        ssize_t n = ::splice(dir.pipe[0], nullptr, dstFd, nullptr, dir.inPipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            dir.inPipe -= n;
+            dir.bytes.fetch_add(n, std::memory_order_relaxed);
+        }
+        else if (n < 0 && errno == EAGAIN)
+        {
+            return kBlocked;
+        }
+        else if (n == 0 || errno != EINTR)
+        {
+            LOG_ERROR("SpliceProxy::flush splice to fd = %d err : %d \n", dstFd, errno);
+            return kFlushError;
+        }
+    }
+    return kFlushed;
+}
+
+// 管道里还有数据的方向：停止读源连接，等目的连接可写；读到EOF的源连接也不再读
+void SpliceProxy::updateInterest()
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        TcpConnectionPtr conn(conns_[i].lock());
+        if (!conn || conn->disconnected())
+        {
+            continue;
+        }
+        Channel *channel = conn->ioChannel();
+        bool reading = !dirs_[i].eof && !dirs_[i].pending();
+        bool writing = dirs_[1 - i].pending();
+        if (reading != channel->isReading())
+        {
+            if (reading)
+            {
+                channel->enabeReading();
+            }
+            else
+            {
+                channel->disableReading();
+            }
+        }
+        if (writing != channel->isWriting())
+        {
+            if (writing)
+            {
+                channel->enableWriting();
+            }
+            else
+            {
+                channel->disableWriting();
+            }
+        }
+    }
+}
+
+void SpliceProxy::handleError(int index)
+{
+    TcpConnectionPtr conn(conns_[index].lock());
+    if (conn)
+    {
+        int optval = 0;
+        socklen_t optlen = sizeof optval;
+        ::getsockopt(conn->ioChannel()->fd(), SOL_SOCKET, SO_ERROR, &optval, &optlen);
+        LOG_ERROR("SpliceProxy %s SO_ERROR : %d \n", conn->name().c_str(), optval);
+    }
+    closeBoth();
+}
+
+// 停止关注两个连接上的事件，再按正常流程关闭（connection/close回调照常执行）
+void SpliceProxy::closeBoth()
+{
+    if (closed_.exchange(true))
+    {
+        return;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        TcpConnectionPtr conn(conns_[i].lock());
+        if (conn)
+        {
+            if (conn->getLoop()->isInLoopThread() && !conn->disconnected())
+            {
+                conn->ioChannel()->disableAll();
+            }
+            conn->forceClose();
+        }
+    }
+}
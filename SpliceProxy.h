@@ -0,0 +1,85 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "Channel.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+
+// 四层转发：把两个已建立的连接配成一对，每个方向一条管道，用splice(2)把数据从一个socket
+// 经管道搬到另一个socket，数据不进入用户态，也不经过TcpConnection的收发缓冲区
+// 对端写不进去时管道留着数据，停止读源连接、等对端可写（背压）；一方读到EOF时，
+// 管道中的数据发完后关闭另一方的写端（半关闭），两个方向都结束或任一方出错时关闭两个连接
+// 两个连接各自持有SpliceProxy，两个都析构后它才析构；和TcpConnection的写一样，进程需要忽略SIGPIPE
+class SpliceProxy : noncopyable,
+        public std::enable_shared_from_this<SpliceProxy>
+{
+public:
+    static const size_t kDefaultPipeSize = 256 * 1024;
+
+    // 可以在任意线程调用，b不在a的loop中时先迁移过去；两个连接都要是已建立的非TLS连接，
+    // 还有没写完的数据时等它们写完再接管（见TcpConnection::takeOverIo），
+    // 接管之前输入缓冲区中还没有取走的数据先转发给对端；无法接管或b固定在别的loop上时关闭两个连接
+    // pipeSize是每条管道的容量（F_SETPIPE_SZ），超过系统上限时保持默认大小
+    static std::shared_ptr<SpliceProxy> start(const TcpConnectionPtr &a, const TcpConnectionPtr &b,
+                                              size_t pipeSize = kDefaultPipeSize);
+
+    ~SpliceProxy();
+
+    // 方向0是a到b，方向1是b到a；已经写进对端socket的字节数，可以在任意线程读取
+    uint64_t bytesForwarded(int direction) const { return dirs_[direction].bytes.load(std::memory_order_relaxed); }
+    bool closed() const { return closed_.load(std::memory_order_relaxed); }
+
+private:
+    // 每个连接的channel事件交给对应的Side，读事件推动从它出发的方向，写事件推动到达它的方向
+    class Side : public ChannelHandler
+    {
+    public:
+        Side() : proxy_(nullptr), index_(0) {}
+        void init(SpliceProxy *proxy, int index) { proxy_ = proxy; index_ = index; }
+
+        void handleRead(Timestamp) override { proxy_->pump(index_); }
+        void handleWrite() override { proxy_->pump(1 - index_); }
+        void handleClose() override { proxy_->closeBoth(); }
+        void handleError() override { proxy_->handleError(index_); }
+
+    private:
+        SpliceProxy *proxy_;
+        int index_;
+    };
+
+    struct Direction
+    {
+        int pipe[2];
+        size_t inPipe;          //管道中的字节数
+        std::string head;       //接管时输入缓冲区中留下的数据，先于管道发送
+        bool eof;               //源连接读到了EOF
+        bool shutdown;          //已经关闭了目的连接的写端
+        std::atomic<uint64_t> bytes;
+
+        bool pending() const { return inPipe > 0 || !head.empty(); }
+    };
+
+    enum FlushResult { kFlushed, kBlocked, kFlushError };
+
+    SpliceProxy(const TcpConnectionPtr &a, const TcpConnectionPtr &b, size_t pipeSize);
+
+    void startInLoop();
+    void tookOver(int index, bool ok, std::string &unread);
+    void pump(int direction);
+    FlushResult flush(Direction &dir, int dstFd);
+    void updateInterest();
+    void handleError(int index);
+    void closeBoth();
+
+    std::weak_ptr<TcpConnection> conns_[2];
+    Side sides_[2];
+    Direction dirs_[2];
+    size_t pipeSize_;
+    int takenOver_;     //已经接管的连接数，两个都接管之后才开始搬运，只在loop线程中访问
+    std::atomic<bool> closed_;
+};
@@ -0,0 +1,395 @@
+#pragma once
+
+// 编译期组装的单线程reactor，只有头文件，和EventLoop/TcpConnection是两套独立的实现
+// poller、缓冲区和处理器都是模板参数：从epoll_wait的结果到用户的onMessage全部是静态分发，
+// 中间没有虚函数和std::function，编译器可以把整条路径内联
+//
+//   struct Echo
+//   {
+//       template <typename Conn> void onConnection(Conn &conn) {}
+//       template <typename Conn, typename Buf> void onMessage(Conn &conn, Buf &buf)
+//       {
+//           conn.send(buf.peek(), buf.readableBytes());
+//           buf.retrieveAll();
+//       }
+//       template <typename Conn> void onClose(Conn &conn) {}
+//   };
+//
+//   sr::Reactor<Echo> reactor;
+//   reactor.listen(InetAddress(8000));
+//   reactor.loop();
+//
+// 代价是功能少：只有一个线程，没有定时器和跨线程的任务队列，quit是唯一可以在其他线程调用的接口
+
+#include "noncopyable.h"
+#include "Buffer.h"
+#include "InetAddress.h"
+#include "logger.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace sr
+{
+
+// 默认的poller策略：直接包装epoll
+// 作为Reactor的模板参数需要提供add/modify/remove，以及把每个就绪事件交给dispatch的poll
+class Epoll : noncopyable
+{
+public:
+    static const int kMaxEvents = 256;
+
+    Epoll()
+        : epollfd_(::epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (epollfd_ < 0)
+        {
+            LOG_FATAL("sr::Epoll epoll_create error : %d \n", errno);
+        }
+    }
+    ~Epoll() { ::close(epollfd_); }
+
+    void add(int fd, uint32_t events, void *ptr) { control(EPOLL_CTL_ADD, fd, events, ptr); }
+    void modify(int fd, uint32_t events, void *ptr) { control(EPOLL_CTL_MOD, fd, events, ptr); }
+    void remove(int fd) { control(EPOLL_CTL_DEL, fd, 0, nullptr); }
+
+    // dispatch(void *ptr, uint32_t revents)，返回就绪事件数，出错返回-1
+    template <typename Dispatch>
+    int poll(int timeoutMs, Dispatch &&dispatch)
+    {
+        int numEvents = ::epoll_wait(epollfd_, events_, kMaxEvents, timeoutMs);
+        for (int i = 0; i < numEvents; ++i)
+        {
+            dispatch(events_[i].data.ptr, events_[i].events);
+        }
+        return numEvents;
+    }
+
+private:
+    void control(int operation, int fd, uint32_t events, void *ptr)
+    {
+        epoll_event event;
+        event.events = events;
+        event.data.ptr = ptr;
+        if (::epoll_ctl(epollfd_, operation, fd, &event) < 0)
+        {
+            LOG_ERROR("sr::Epoll epoll_ctl op = %d fd = %d error : %d \n", operation, fd, errno);
+        }
+    }
+
+    int epollfd_;
+    epoll_event events_[kMaxEvents];
+};
+
+// Handler需要提供（可以是模板成员函数）：
+//   void onConnection(Connection &conn);            连接建立
+//   void onMessage(Connection &conn, BufferT &buf); 收到数据，buf是连接的输入缓冲区
+//   void onClose(Connection &conn);                 连接关闭，之后conn失效
+// BufferT需要提供readFd、writeFd、append、peek、retrieve、readableBytes，默认是库里的Buffer
+template <typename Handler, typename BufferT = ::Buffer, typename PollerT = Epoll>
+class Reactor : noncopyable
+{
+public:
+    class Connection : noncopyable
+    {
+    public:
+        int fd() const { return fd_; }
+        bool connected() const { return !closed_; }
+        Reactor& reactor() { return *reactor_; }
+        // 给处理器保存每个连接的状态
+        void setContext(void *context) { context_ = context; }
+        void* context() const { return context_; }
+
+        // 输出缓冲区为空时直接write，写不完的部分放进输出缓冲区等待可写
+        void send(const char *data, size_t len)
+        {
+            if (closed_ || shutdown_)
+            {
+                return;
+            }
+            if (output_.readableBytes() == 0)
+            {
+                ssize_t n = ::write(fd_, data, len);
+                if (n < 0)
+                {
+                    if (errno != EWOULDBLOCK && errno != EINTR)
+                    {
+                        if (errno == EPIPE || errno == ECONNRESET)
+                        {
+                            close();
+                        }
+                        return;
+                    }
+                    n = 0;
+                }
+                data += n;
+                len -= n;
+            }
+            if (len > 0)
+            {
+                output_.append(data, len);
+                if (!(events_ & EPOLLOUT))
+                {
+                    events_ |= EPOLLOUT;
+                    reactor_->poller_.modify(fd_, events_, this);
+                }
+            }
+        }
+
+        // 输出缓冲区的数据发完后关闭写端
+        void shutdown()
+        {
+            shutdown_ = true;
+            if (!closed_ && output_.readableBytes() == 0)
+            {
+                ::shutdown(fd_, SHUT_WR);
+            }
+        }
+
+        // 立即关闭，fd和Connection在本轮事件处理完之后释放
+        void close() { reactor_->closeConnection(this); }
+
+        void setTcpNoDelay(bool on)
+        {
+            int optval = on ? 1 : 0;
+            ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof optval);
+        }
+
+    private:
+        friend class Reactor;
+
+        Connection(Reactor *reactor, int fd)
+            : reactor_(reactor),
+              fd_(fd),
+              events_(EPOLLIN),
+              closed_(false),
+              shutdown_(false),
+              context_(nullptr)
+        {}
+
+        void handleEvent(uint32_t revents)
+        {
+            if ((revents & EPOLLHUP) && !(revents & EPOLLIN))
+            {
+                close();
+                return;
+            }
+            if (revents & (EPOLLIN | EPOLLPRI | EPOLLERR))
+            {
+                int savedErrno = 0;
+                ssize_t n = input_.readFd(fd_, &savedErrno);
+                if (n > 0)
+                {
+                    reactor_->handler_.onMessage(*this, input_);
+                }
+                else if (n == 0 || (savedErrno != EAGAIN && savedErrno != EINTR))
+                {
+                    close();
+                    return;
+                }
+            }
+            if (!closed_ && (revents & EPOLLOUT))
+            {
+                handleWrite();
+            }
+        }
+
+        void handleWrite()
+        {
+            int savedErrno = 0;
+            ssize_t n = output_.writeFd(fd_, &savedErrno);
+            if (n > 0)
+            {
+                output_.retrieve(n);
+            }
+            else if (savedErrno != EAGAIN && savedErrno != EINTR)
+            {
+                close();
+                return;
+            }
+            if (output_.readableBytes() == 0)
+            {
+                events_ &= ~EPOLLOUT;
+                reactor_->poller_.modify(fd_, events_, this);
+                if (shutdown_)
+                {
+                    ::shutdown(fd_, SHUT_WR);
+                }
+            }
+        }
+
+        Reactor *reactor_;
+        const int fd_;
+        uint32_t events_;
+        bool closed_;
+        bool shutdown_;
+        void *context_;
+        BufferT input_;
+        BufferT output_;
+    };
+
+    explicit Reactor(Handler handler = Handler())
+        : handler_(std::move(handler)),
+          listenfd_(-1),
+          wakeupFd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+          quit_(false)
+    {
+        if (wakeupFd_ < 0)
+        {
+            LOG_FATAL("sr::Reactor eventfd error : %d \n", errno);
+        }
+        poller_.add(wakeupFd_, EPOLLIN, &wakeupFd_);
+    }
+
+    ~Reactor()
+    {
+        for (std::unique_ptr<Connection> &conn : connections_)
+        {
+            if (conn)
+            {
+                ::close(conn->fd_);
+            }
+        }
+        if (listenfd_ >= 0)
+        {
+            ::close(listenfd_);
+        }
+        ::close(wakeupFd_);
+    }
+
+    Handler& handler() { return handler_; }
+
+    // 在loop之前调用，出错时LOG_FATAL
+    void listen(const InetAddress &addr)
+    {
+        listenfd_ = ::socket(addr.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenfd_ < 0)
+        {
+            LOG_FATAL("sr::Reactor listen socket create err : %d \n", errno);
+        }
+        int optval = 1;
+        ::setsockopt(listenfd_, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof optval);
+        if (::bind(listenfd_, addr.getSockAddr(), addr.getSockLen()) < 0
+            || ::listen(listenfd_, 1024) < 0)
+        {
+            LOG_FATAL("sr::Reactor listen %s err : %d \n", addr.toIpPort().c_str(), errno);
+        }
+        poller_.add(listenfd_, EPOLLIN, this);
+    }
+
+    // 接管一个已经连接好的非阻塞fd（如socketpair的一端），在loop线程中调用
+    Connection* adopt(int fd)
+    {
+        if (static_cast<size_t>(fd) >= connections_.size())
+        {
+            connections_.resize(fd + 1);
+        }
+        connections_[fd].reset(new Connection(this, fd));
+        Connection *conn = connections_[fd].get();
+        poller_.add(fd, conn->events_, conn);
+        handler_.onConnection(*conn);
+        return conn;
+    }
+
+    void loop()
+    {
+        quit_ = false;
+        while (!quit_.load(std::memory_order_relaxed))
+        {
+            int numEvents = poller_.poll(10000, [this](void *ptr, uint32_t revents) {
+                dispatch(ptr, revents);
+            });
+            if (numEvents < 0 && errno != EINTR)
+            {
+                LOG_ERROR("sr::Reactor poll error : %d \n", errno);
+            }
+            closing_.clear();
+        }
+    }
+
+    // 可以在任意线程调用
+    void quit()
+    {
+        quit_ = true;
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeupFd_, &one, sizeof one);
+        (void)n;
+    }
+
+private:
+    void dispatch(void *ptr, uint32_t revents)
+    {
+        if (ptr == this)
+        {
+            handleAccept();
+        }
+        else if (ptr == &wakeupFd_)
+        {
+            uint64_t one;
+            ssize_t n = ::read(wakeupFd_, &one, sizeof one);
+            (void)n;
+        }
+        else
+        {
+            Connection *conn = static_cast<Connection*>(ptr);
+            // 同一批事件中前面的事件可能已经关闭了这个连接
+            if (!conn->closed_)
+            {
+                conn->handleEvent(revents);
+            }
+        }
+    }
+
+    void handleAccept()
+    {
+        for (;;)
+        {
+            int connfd = ::accept4(listenfd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (connfd < 0)
+            {
+                if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+                {
+                    LOG_ERROR("sr::Reactor accept err : %d \n", errno);
+                }
+                return;
+            }
+            adopt(connfd);
+        }
+    }
+
+    // 关闭的Connection放进closing_，本轮事件处理完后释放，同一批中指向它的事件不会访问到已释放的内存
+    void closeConnection(Connection *conn)
+    {
+        if (conn->closed_)
+        {
+            return;
+        }
+        conn->closed_ = true;
+        handler_.onClose(*conn);
+        int fd = conn->fd_;
+        poller_.remove(fd);
+        ::close(fd);
+        closing_.push_back(std::move(connections_[fd]));
+    }
+
+    Handler handler_;
+    PollerT poller_;
+    int listenfd_;
+    int wakeupFd_;
+    std::atomic<bool> quit_;
+    // 以fd为下标的平坦表，和Poller的channels_一样
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::vector<std::unique_ptr<Connection>> closing_;
+};
+
+} // namespace sr
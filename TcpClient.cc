@@ -0,0 +1,142 @@
+#include "TcpClient.h"
+#include "EventLoop.h"
+#include "SlabAllocator.h"
+#include "logger.h"
+
+#include <sys/socket.h>
+#include <string.h>
+#include <functional>
+
+static EventLoop* checkLoopNotNull(EventLoop *loop)
+{
+    if (loop == nullptr)
+    {
+        LOG_FATAL("%s:%s:%d TcpClient Loop is null! \n", __FILE__, __FUNCTION__, __LINE__);
+    }
+    return loop;
+}
+
+static InetAddress localAddressOf(int sockfd)
+{
+    sockaddr_storage addr;
+    bzero(&addr, sizeof addr);
+    socklen_t addrlen = static_cast<socklen_t>(sizeof addr);
+    if (::getsockname(sockfd, (sockaddr*)&addr, &addrlen) < 0)
+    {
+        LOG_ERROR("TcpClient::getLocalAddr");
+    }
+    return InetAddress((sockaddr*)&addr, addrlen);
+}
+
+static InetAddress peerAddressOf(int sockfd)
+{
+    sockaddr_storage addr;
+    bzero(&addr, sizeof addr);
+    socklen_t addrlen = static_cast<socklen_t>(sizeof addr);
+    if (::getpeername(sockfd, (sockaddr*)&addr, &addrlen) < 0)
+    {
+        LOG_ERROR("TcpClient::getPeerAddr");
+    }
+    return InetAddress((sockaddr*)&addr, addrlen);
+}
+
+// TcpClient已经析构时连接关闭用的回调，不能再访问TcpClient
+static void detachedRemoveConnection(EventLoop *loop, const TcpConnectionPtr &conn)
+{
+    loop->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+}
+
+TcpClient::TcpClient(EventLoop *loop, const InetAddress &serverAddr, const std::string &nameArg)
+    : loop_(checkLoopNotNull(loop)),
+      connector_(std::make_shared<Connector>(loop, serverAddr)),
+      name_(nameArg),
+      connNamePrefix_(std::make_shared<const std::string>(nameArg + "-" + serverAddr.toIpPort())),
+      callbacks_(std::make_shared<ConnectionCallbacks>()),
+      retry_(false),
+      connect_(false),
+      nextConnId_(1)
+{
+    callbacks_->connection = [](const TcpConnectionPtr&) {};
+    callbacks_->message = [](const TcpConnectionPtr&, Buffer *buf, Timestamp) { buf->retrieveAll(); };
+    callbacks_->close = std::bind(&TcpClient::removeConnection, this, std::placeholders::_1);
+    connector_->setNewConnectionCallback(std::bind(&TcpClient::newConnection, this, std::placeholders::_1));
+}
+
+TcpClient::~TcpClient()
+{
+    TcpConnectionPtr conn(connection());
+    if (conn)
+    {
+        // 连接可能比TcpClient活得久，关闭回调改成不再访问this的版本
+        CloseCallback cb = std::bind(&detachedRemoveConnection, loop_, std::placeholders::_1);
+        loop_->runInLoop(std::bind(&TcpConnection::setCloseCallback, conn, cb));
+        conn->forceClose();
+    }
+    else
+    {
+        connector_->stop();
+    }
+}
+
+void TcpClient::connect()
+{
+    LOG_INFO("TcpClient::connect [%s] - connecting to %s \n",
+        name_.c_str(), connector_->serverAddress().toIpPort().c_str());
+    connect_ = true;
+    connector_->start();
+}
+
+void TcpClient::disconnect()
+{
+    connect_ = false;
+    TcpConnectionPtr conn(connection());
+    if (conn)
+    {
+        conn->shutdown();
+    }
+}
+
+void TcpClient::stop()
+{
+    connect_ = false;
+    connector_->stop();
+}
+
+void TcpClient::newConnection(int sockfd)
+{
+    // 连接对象和shared_ptr的控制块一起从slab中分配，压测客户端一次会建上万个连接
+    TcpConnectionPtr conn(std::allocate_shared<TcpConnection>(
+                                SlabAllocator<TcpConnection>(),
+                                loop_,
+                                nextConnId_++,
+                                connNamePrefix_,
+                                sockfd,
+                                localAddressOf(sockfd),
+                                peerAddressOf(sockfd)
+                            ));
+    conn->setCallbacks(callbacks_);
+    if (tlsContext_)
+    {
+        conn->startTls(tlsContext_, tlsHostname_);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connection_ = conn;
+    }
+    conn->connectEstablished();
+}
+
+void TcpClient::removeConnection(const TcpConnectionPtr &conn)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        connection_.reset();
+    }
+    loop_->queueInLoop(std::bind(&TcpConnection::connectDestroyed, conn));
+    if (retry_ && connect_)
+    {
+        LOG_INFO("TcpClient::removeConnection [%s] - reconnecting to %s \n",
+            name_.c_str(), connector_->serverAddress().toIpPort().c_str());
+        connector_->restart();
+    }
+}
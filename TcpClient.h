@@ -0,0 +1,72 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "Connector.h"
+#include "InetAddress.h"
+#include "TcpConnection.h"
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+class EventLoop;
+
+// 客户端：通过Connector发起连接，连接成功后和TcpServer一样创建TcpConnection
+// 一个TcpClient同时最多有一个连接，连接属于构造时传入的loop
+class TcpClient : noncopyable
+{
+public:
+    TcpClient(EventLoop *loop, const InetAddress &serverAddr, const std::string &nameArg);
+    ~TcpClient();
+
+    // 可以在任意线程调用
+    void connect();
+    // 关闭写端，等数据发送完后断开
+    void disconnect();
+    // 停止连接过程（包括等待重试的）
+    void stop();
+
+    TcpConnectionPtr connection() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return connection_;
+    }
+
+    EventLoop* getLoop() const { return loop_; }
+    const std::string& name() const { return name_; }
+    // 连接断开后自动重连
+    void enableRetry() { retry_ = true; }
+    bool retry() const { return retry_; }
+
+    // 在connect之前设置
+    void setConnectionCallback(const ConnectionCallback &cb) { callbacks_->connection = cb; }
+    void setMessageCallback(const MessageCallback &cb) { callbacks_->message = cb; }
+    void setWriteCompleteCallback(const WriteCompleteCallback &cb) { callbacks_->writeComplete = cb; }
+    // 设置后连接走TLS，见TlsContext::newClientContext
+    // hostname是期望的服务端主机名，用于SNI和证书校验，为空时不校验主机名
+    void setTlsContext(const std::shared_ptr<TlsContext> &ctx, const std::string &hostname = std::string())
+    {
+        tlsContext_ = ctx;
+        tlsHostname_ = hostname;
+    }
+
+private:
+    // 在loop线程中调用
+    void newConnection(int sockfd);
+    void removeConnection(const TcpConnectionPtr &conn);
+
+    EventLoop *loop_;
+    ConnectorPtr connector_;
+    const std::string name_;
+    std::shared_ptr<const std::string> connNamePrefix_;
+    ConnectionCallbacksPtr callbacks_;
+    std::atomic_bool retry_;
+    std::atomic_bool connect_;
+    uint64_t nextConnId_;   //只在loop线程中访问
+    std::shared_ptr<TlsContext> tlsContext_;
+    std::string tlsHostname_;
+    mutable std::mutex mutex_;
+    TcpConnectionPtr connection_;   //由mutex_保护
+};
@@ -3,12 +3,20 @@
 #include "Socket.h"
 #include "Channel.h"
 #include "EventLoop.h"
+#include "TlsContext.h"
+#include "BufferPool.h"
 
-#include <error.h>
+#include <errno.h>
 #include <memory>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <strings.h>
+#include <string.h>
 #include <string>
+#include <algorithm>
 
 static EventLoop* checkLoopNotNull(EventLoop* loop)
 {
@@ -19,54 +27,212 @@ static EventLoop* checkLoopNotNull(EventLoop* loop)
     return loop;
 }
 
+// 输入缓冲区预留大小的档位，新连接从1K开始
+static const size_t kReadSizes[] = { 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536 };
+static const int kNumReadSizes = sizeof kReadSizes / sizeof kReadSizes[0];
+static const int kInitialReadSize = 1;
+
+// 还没有设置任何回调的连接共享这一份空回调，它始终被这里引用，不会被原地修改
+static const ConnectionCallbacksPtr& defaultCallbacks()
+{
+    static ConnectionCallbacksPtr callbacks = std::make_shared<ConnectionCallbacks>();
+    return callbacks;
+}
+
 TcpConnection::TcpConnection(EventLoop *loop,
-                const std::string &name,
+                uint64_t id,
+                const std::shared_ptr<const std::string> &namePrefix,
                 int sockfd,
                 const InetAddress &localAddr,
                 const InetAddress &peerAddr) :
         loop_(checkLoopNotNull(loop)),
-        name_(name),
+        id_(id),
+        namePrefix_(namePrefix),
         state_(kConnecting),
-        reading_(true),
-        socket_(new Socket(sockfd)),
-        channel_(new Channel(loop, sockfd)),
+        reading_(false),
+        socket_(sockfd),
+        channel_(loop, sockfd),
         localAddr_(localAddr),
         peerAddr_(peerAddr),
-        highwaterMark_(64 * 1024 * 1024)
-{
-    //下面给channel设置相应的回调函数，poller给channel通知感兴趣的事件发生了，channel进行回调
-    channel_->setReadCallback(
-        std::bind(&TcpConnection::handleRead, this, std::placeholders::_1)
-    );
-    channel_->setWriteCallback(
-        std::bind(&TcpConnection::handleWrite, this)
-    );
-    channel_->setCloseCallback(
-        std::bind(&TcpConnection::handleClose, this)
-    );
-    channel_->setErrorCallback(
-        std::bind(&TcpConnection::handleError, this)
-    );
-
-    LOG_INFO("TcpConnection::ctor [%s] at fd = %d \n", name_.c_str(), sockfd);
-    socket_->setKeepAlive(true);
+        callbacks_(defaultCallbacks()),
+        highwaterMark_(64 * 1024 * 1024),
+        flowHighWaterMark_(0),
+        flowLowWaterMark_(0),
+        flowControl_(false),
+        sourcePaused_(false),
+        userPaused_(false),
+        readHolds_(0),
+        inputBuffer_(0),
+        outputBuffer_(0),
+        outbound_(nullptr),
+        chunkBytes_(0),
+        zeroCopyThreshold_(0),
+        zeroCopySeq_(0),
+        zeroCopyCompleted_(0),
+        zeroCopyCopied_(0),
+        readSizeIndex_(kInitialReadSize),
+        readShrinkPending_(false),
+        fionread_(false),
+        pooledInput_(false),
+        corked_(false),
+        flushPending_(false),
+        loadBytes_(0),
+        migratable_(true)
+{
+    //poller给channel通知感兴趣的事件发生了，channel直接调用本连接的handleRead/handleWrite等
+    channel_.setHandler(this);
+
+    LOG_INFO("TcpConnection::ctor [#%lu] at fd = %d \n", id_, sockfd);
+    // 保活是TCP的选项，Unix域连接不设置
+    if (localAddr.family() == AF_INET || localAddr.family() == AF_INET6)
+    {
+        socket_.setKeepAlive(true);
+    }
 }
 
 TcpConnection::~TcpConnection() 
 {
     int state = state_.load();
-    LOG_INFO("TcpConnection::dtor [%s] at fd = %d state = %d \n",
-        name_.c_str(), channel_->fd(), state);
+    LOG_INFO("TcpConnection::dtor [#%lu] at fd = %d state = %d \n",
+        id_, channel_.fd(), state);
+    // 连接断开后才到达的消息
+    OutboundNode *node = outbound_.load(std::memory_order_acquire);
+    while (node)
+    {
+        OutboundNode *next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+ConnectionCallbacks& TcpConnection::mutableCallbacks()
+{
+    // 只有本连接引用时才能原地修改，否则先复制一份
+    if (callbacks_.use_count() != 1)
+    {
+        callbacks_ = std::make_shared<ConnectionCallbacks>(*callbacks_);
+    }
+    return *callbacks_;
+}
+
+TcpConnection::PackedAddress::PackedAddress(const InetAddress &addr)
+{
+    memset(&ip, 0, sizeof ip);
+    if (addr.family() == AF_INET)
+    {
+        memcpy(&ip.v4, addr.getSockAddr(), sizeof ip.v4);
+    }
+    else if (addr.family() == AF_INET6)
+    {
+        memcpy(&ip.v6, addr.getSockAddr(), sizeof ip.v6);
+    }
+    else
+    {
+        other.reset(new InetAddress(addr));
+    }
+}
+
+InetAddress TcpConnection::PackedAddress::get() const
+{
+    if (other)
+    {
+        return *other;
+    }
+    if (ip.v4.sin_family == AF_INET6)
+    {
+        return InetAddress(ip.v6);
+    }
+    return InetAddress(ip.v4);
+}
+
+TcpConnection::ChunkQueue& TcpConnection::chunkQueue()
+{
+    if (!chunkQueue_)
+    {
+        chunkQueue_.reset(new ChunkQueue);
+    }
+    return *chunkQueue_;
+}
+
+std::string TcpConnection::name() const
+{
+    char buf[32] = {0};
+    snprintf(buf, sizeof buf, "#%lu", id_);
+    return namePrefix_ ? *namePrefix_ + buf : std::string(buf);
 }
 
 void TcpConnection::handleRead(Timestamp receiveTime)
 {
+    if (pendingTakeOver_)
+    {
+        return;     //停止读之前本轮已经取到的读事件，数据留给接管的handler
+    }
+    if (tls_)
+    {
+        if (!tls_->handshakeDone())
+        {
+            handleTlsHandshake();
+            return;
+        }
+        TlsSession::Result result;
+        ssize_t n = tls_->read(&inputBuffer_, &result);
+        if (n > 0)
+        {
+            loadBytes_ += n;
+            lastReceiveTime_ = receiveTime;
+            callbacks_->message(shared_from_this(), &inputBuffer_, receiveTime);
+        }
+        else if (result == TlsSession::kClosed)
+        {
+            handleClose();
+        }
+        else if (result == TlsSession::kError)
+        {
+            handleError();
+            handleClose();
+        }
+        return;
+    }
+
+    // 按预期的消息大小预留输入缓冲区，让数据直接读进缓冲区，不经过溢出区再拷贝一次
+    BufferPool *pool = channel_.ownerLoop()->bufferPool();
+    size_t expected = kReadSizes[readSizeIndex_];
+    if (fionread_)
+    {
+        int available = 0;
+        if (::ioctl(channel_.fd(), FIONREAD, &available) == 0 && available > 0)
+        {
+            expected = static_cast<size_t>(available);
+        }
+    }
+    if (inputBuffer_.writableBytes() < expected)
+    {
+        if (pooledInput_ && !inputBuffer_.allocated())
+        {
+            inputBuffer_.adopt(pool->take(expected));
+        }
+        else
+        {
+            inputBuffer_.ensureWriteableBytes(expected);
+        }
+    }
+
     int saveErrno = 0;
-    ssize_t n = inputBuffer_.readFd(channel_->fd(), &saveErrno);
+    ssize_t n = inputBuffer_.readFd(channel_.fd(), &saveErrno, pool->overflow(), BufferPool::kOverflowSize);
     if (n > 0)
     {
+        loadBytes_ += n;
+        lastReceiveTime_ = receiveTime;
+        if (!fionread_)
+        {
+            adaptReadSize(static_cast<size_t>(n), expected);
+        }
         // 已建立连接的用户，有可读事件发生，调用用户传入的回调操作onMessage
-        messageCallback_(shared_from_this(), &inputBuffer_, receiveTime);
+        callbacks_->message(shared_from_this(), &inputBuffer_, receiveTime);
+        if (pooledInput_ && inputBuffer_.readableBytes() == 0 && inputBuffer_.allocated())
+        {
+            pool->give(inputBuffer_.release());
+        }
     }
     else if (n == 0)
     {
@@ -80,60 +246,253 @@ void TcpConnection::handleRead(Timestamp receiveTime)
     }    
 }
 
+// 读满了说明消息比预期的大，直接升两档；连续两次都不超过下一档才降一档，避免来回抖动
+void TcpConnection::adaptReadSize(size_t n, size_t expected)
+{
+    if (n >= expected)
+    {
+        readSizeIndex_ = static_cast<uint8_t>(std::min(readSizeIndex_ + 2, kNumReadSizes - 1));
+        readShrinkPending_ = false;
+    }
+    else if (readSizeIndex_ > 0 && n <= kReadSizes[readSizeIndex_ - 1])
+    {
+        if (readShrinkPending_)
+        {
+            --readSizeIndex_;
+        }
+        readShrinkPending_ = !readShrinkPending_;
+    }
+    else
+    {
+        readShrinkPending_ = false;
+    }
+}
+
+// 明文直接写socket；TLS连接在内核kTLS接管发送之前走SSL_write
+ssize_t TcpConnection::writeToSocket(const void *data, size_t len, int *saveErrno)
+{
+    if (tls_ && !tls_->ktlsSend())
+    {
+        TlsSession::Result result;
+        ssize_t n = tls_->write(data, len, &result);
+        if (n < 0)
+        {
+            *saveErrno = (result == TlsSession::kWantRead || result == TlsSession::kWantWrite)
+                ? EWOULDBLOCK : EPIPE;
+        }
+        return n;
+    }
+    ssize_t n = ::write(channel_.fd(), data, len);
+    if (n < 0)
+    {
+        *saveErrno = errno;
+    }
+    return n;
+}
+
+// 非阻塞握手，由Channel的读写事件驱动
+void TcpConnection::handleTlsHandshake()
+{
+    TlsSession::Result result = tls_->handshake();
+    if (result == TlsSession::kOk)
+    {
+        // 握手期间send的数据都暂存在outputBuffer_中
+        if (outputBuffer_.readableBytes() > 0)
+        {
+            channel_.enableWriting();
+        }
+        else if (channel_.isWriting())
+        {
+            channel_.disableWriting();
+        }
+        callbacks_->connection(shared_from_this());
+    }
+    else if (result == TlsSession::kWantWrite)
+    {
+        if (!channel_.isWriting())
+        {
+            channel_.enableWriting();
+        }
+    }
+    else if (result == TlsSession::kWantRead)
+    {
+        if (channel_.isWriting())
+        {
+            channel_.disableWriting();
+        }
+    }
+    else
+    {
+        LOG_ERROR("TcpConnection [%s] tls handshake fail \n", name().c_str());
+        handleClose();
+    }
+}
+
 void TcpConnection::handleWrite()
 {
-    if (channel_->isWriting())
+    if (tls_ && !tls_->handshakeDone())
+    {
+        handleTlsHandshake();
+        return;
+    }
+    if (channel_.isWriting())
+    {
+        writeOutput();
+    }
+    else
     {
-        int savedErrno = 0;
-        ssize_t n = outputBuffer_.writeFd(channel_->fd(), &savedErrno);
+        LOG_ERROR("TcpConnection fd = %d is down, no more writing \n", channel_.fd());
+    }
+}
+
+// 把outputBuffer_和排在它后面的整块数据尽量写进socket
+// 全部写完后关闭EPOLLOUT并回调writeComplete，没写完则等待EPOLLOUT
+void TcpConnection::writeOutput()
+{
+    int savedErrno = 0;
+    bool ok = true;
+    if (outputBuffer_.readableBytes() > 0)
+    {
+        ssize_t n = writeToSocket(outputBuffer_.peek(), outputBuffer_.readableBytes(), &savedErrno);
         if (n > 0)
         {
             outputBuffer_.retrieve(n);
-            if (outputBuffer_.readableBytes() == 0)
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+    if (ok && outputBuffer_.readableBytes() == 0)
+    {
+        ok = writeChunks(&savedErrno);
+    }
+    if (ok)
+    {
+        if (sourcePaused_ && outputBytes() <= flowLowWaterMark_)
+        {
+            resumeSource();
+        }
+        if (outputBytes() == 0)
+        {
+            if (channel_.isWriting())
             {
-                channel_->disableWriting();
-                if (writeCompleteCallback_)
-                {
-                    //唤醒loop_对应的thread线程，执行回调
-                    loop_->queueInLoop(
-                        std::bind(writeCompleteCallback_, shared_from_this())
-                    );
-                }
-                if (state_ == kDisconnecting)
-                {
-                    shutdownInLoop();
-                }
+                channel_.disableWriting();
+            }
+            if (callbacks_->writeComplete)
+            {
+                //唤醒loop_对应的thread线程，执行回调
+                channel_.ownerLoop()->queueInLoop(
+                    std::bind(callbacks_->writeComplete, shared_from_this())
+                );
+            }
+            if (pendingTakeOver_)
+            {
+                finishTakeOver();
+            }
+            if (state_ == kDisconnecting)
+            {
+                shutdownInLoop();
             }
         }
-        else
+        else if (!channel_.isWriting())
+        {
+            channel_.enableWriting();
+        }
+    }
+    else if (savedErrno == EWOULDBLOCK)
+    {
+        if (!channel_.isWriting())
         {
-            LOG_ERROR("TcpConnection::handleWrite \n");
+            channel_.enableWriting();
         }
     }
     else
     {
-        LOG_ERROR("TcpConnection fd = %d is down, no more writing \n", channel_->fd());
+        LOG_ERROR("TcpConnection::handleWrite \n");
+    }
+}
+
+// 合并写：本轮循环中的send只追加到outputBuffer_，在循环末尾统一写一次
+void TcpConnection::scheduleFlush()
+{
+    if (!flushPending_)
+    {
+        flushPending_ = true;
+        channel_.ownerLoop()->queueFlush(std::bind(&TcpConnection::flushCorked, shared_from_this()));
     }
 }
 
+void TcpConnection::flushCorked()
+{
+    if (migratedAway())
+    {
+        return;     //迁移时已经写出，见migrateInLoop
+    }
+    flushPending_ = false;
+    if (state_ == kDisconnected || channel_.isWriting())
+    {
+        return;
+    }
+    if (outputBytes() == 0)
+    {
+        if (pendingTakeOver_)
+        {
+            finishTakeOver();
+        }
+        // 合并写期间推迟的shutdown（如只发送了空数据），没有数据要写时在这里补上
+        if (state_ == kDisconnecting)
+        {
+            shutdownInLoop();
+        }
+        return;
+    }
+    writeOutput();
+}
+
+void TcpConnection::setCork(bool on)
+{
+    // 关闭时已经追加的数据仍然由登记过的flush在本轮末尾写出
+    corked_ = on;
+}
+
 void TcpConnection::handleClose()
 {
     int state = state_.load();
-    LOG_INFO("fd = %d state = %d \n", channel_->fd(), state);
+    LOG_INFO("fd = %d state = %d \n", channel_.fd(), state);
     setState(kDisconnected);
-    channel_->disableAll();
+    channel_.disableAll();
+    reading_ = false;
+    // 连接关闭时，被本连接暂停的读源需要恢复，否则会一直停在那里
+    if (sourcePaused_)
+    {
+        resumeSource();
+    }
+    if (pendingTakeOver_)
+    {
+        finishTakeOver();   //状态已经是kDisconnected，接管失败
+    }
 
     TcpConnectionPtr connPtr(shared_from_this());
-    connectionCallback_(connPtr);   
-    closeCallback_(connPtr);    
+    // 先保住回调，用户在connection回调中重新设置回调时不会析构正在执行的closeCallback
+    ConnectionCallbacksPtr callbacks(callbacks_);
+    callbacks->connection(connPtr);
+    callbacks->close(connPtr);
 }
 
 void TcpConnection::handleError()
 {
+    // 零拷贝的完成通知通过错误队列上报，同样表现为EPOLLERR
+    bool zeroCopyPending = chunkQueue_ && !chunkQueue_->pinned.empty();
+    if (zeroCopyPending)
+    {
+        readZeroCopyCompletions();
+    }
+
     int optval;
     socklen_t optlen = sizeof optval;
     int err = 0;
-    if (::getsockopt(channel_->fd(), SOL_SOCKET, SO_ERROR, &optval, &optlen) < 0)
+    if (::getsockopt(channel_.fd(), SOL_SOCKET, SO_ERROR, &optval, &optlen) < 0)
     {
         err = errno;
     }
@@ -141,29 +500,142 @@ void TcpConnection::handleError()
     {
         err = optval;
     }
-    LOG_ERROR("TcpConnection handleError name : %s - So_ERROR : %d \n", name_.c_str(), err);
+    if (err == 0 && zeroCopyPending)
+    {
+        return;
+    }
+    LOG_ERROR("TcpConnection handleError name : %s - So_ERROR : %d \n", name().c_str(), err);
 }
 
 void TcpConnection::send(const std::string& buf)
 {
     if (state_ == kConnected)
     {
-        if (loop_->isInLoopThread())
+        if (getLoop()->isInLoopThread())
         {
             sendInloop(buf.c_str(), buf.size());
         }
         else
         {
-            loop_->runInLoop(std::bind(
-                &TcpConnection::sendInloop, 
-                this,
-                buf.c_str(), 
-                buf.size()
-            ));
+            // 拷贝一份数据，调用者的buf在返回后就可能失效
+            queueOutbound(std::string(buf));
         }   
     }
 }
 
+void TcpConnection::send(std::string&& message)
+{
+    if (state_ == kConnected)
+    {
+        bool zeroCopy = zeroCopyThreshold_ > 0 && message.size() >= zeroCopyThreshold_;
+        if (!zeroCopy)
+        {
+            if (getLoop()->isInLoopThread())
+            {
+                sendInloop(message.data(), message.size());
+            }
+            else
+            {
+                queueOutbound(std::move(message));
+            }
+            return;
+        }
+        std::shared_ptr<std::string> data(std::make_shared<std::string>(std::move(message)));
+        getLoop()->runInLoop(std::bind(
+            &TcpConnection::sendChunkInLoop,
+            shared_from_this(),
+            data
+        ));
+    }
+}
+
+void TcpConnection::send(const SharedPayload &message)
+{
+    if (state_ == kConnected)
+    {
+        if (getLoop()->isInLoopThread())
+        {
+            sendSharedInLoop(message);
+        }
+        else
+        {
+            getLoop()->runInLoop(std::bind(
+                &TcpConnection::sendSharedInLoop,
+                shared_from_this(),
+                message
+            ));
+        }
+    }
+}
+
+// 多个线程同时push，只有把队列从空变为非空的那一个投递drain；drain取走整条链表之后，
+// 下一次push重新投递，所以一个连接同时最多排着一个drain任务
+void TcpConnection::queueOutbound(std::string &&message)
+{
+    OutboundNode *node = new OutboundNode{nullptr, std::move(message)};
+    OutboundNode *head = outbound_.load(std::memory_order_relaxed);
+    do
+    {
+        node->next = head;
+    } while (!outbound_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    if (head == nullptr)
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::drainOutbound, shared_from_this()));
+    }
+}
+
+void TcpConnection::drainOutbound()
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::drainOutbound, shared_from_this()));
+        return;
+    }
+    OutboundNode *node = outbound_.exchange(nullptr, std::memory_order_acquire);
+    // 反转成先进先出
+    OutboundNode *list = nullptr;
+    while (node)
+    {
+        OutboundNode *next = node->next;
+        node->next = list;
+        list = node;
+        node = next;
+    }
+    if (list == nullptr)
+    {
+        return;
+    }
+    if (state_ == kDisconnected)
+    {
+        LOG_ERROR("disconnected, give up writing");
+    }
+    else if (list->next == nullptr)
+    {
+        sendInloop(list->data.data(), list->data.size());
+    }
+    else
+    {
+        // 多条消息先按合并写追加进outputBuffer_，再一次写出
+        bool corked = corked_;
+        corked_ = true;
+        for (OutboundNode *n = list; n; n = n->next)
+        {
+            sendInloop(n->data.data(), n->data.size());
+        }
+        corked_ = corked;
+        if (!corked_ && flushPending_)
+        {
+            flushCorked();
+        }
+    }
+    while (list)
+    {
+        OutboundNode *next = list->next;
+        delete list;
+        list = next;
+    }
+}
+
 //发送数据 应用写得快，内核发送数据慢，需要把待发送数据写入缓冲区，且设置了水位回调
 void TcpConnection::sendInloop(const void* message, size_t len)
 {
@@ -176,28 +648,37 @@ void TcpConnection::sendInloop(const void* message, size_t len)
     {
         LOG_ERROR("disconnected, give up writing");
     }
+    // 前面还有排队的整块数据，为了保证顺序这次的数据也只能排在它们后面
+    if (hasChunks())
+    {
+        sendChunkInLoop(std::make_shared<std::string>(static_cast<const char*>(message), len));
+        return;
+    }
     // 表示channel第一次开始写数据，而且缓冲区没有待发送数据
-    if (!channel_->isWriting() && outputBuffer_.readableBytes() == 0)
+    // TLS握手完成之前，数据只能先放到outputBuffer_中
+    if (!channel_.isWriting() && outputBuffer_.readableBytes() == 0
+        && !corked_ && !(tls_ && !tls_->handshakeDone()))
     {
-        nwrote = ::write(channel_->fd(), message, len);
+        int saveErrno = 0;
+        nwrote = writeToSocket(message, len, &saveErrno);
         if (nwrote >= 0)
         {
             remaining = len - nwrote;
-            if (remaining == 0 && writeCompleteCallback_)
+            if (remaining == 0 && callbacks_->writeComplete)
             {
                 // 数据全部发送完成，就不用再给channel设置EPOLLOUT事件
-                loop_->queueInLoop(std::bind(
-                    writeCompleteCallback_, shared_from_this()
+                channel_.ownerLoop()->queueInLoop(std::bind(
+                    callbacks_->writeComplete, shared_from_this()
                 ));
             }
         }
         else    // nwrote < 0
         {
             nwrote = 0;
-            if (errno != EWOULDBLOCK)
+            if (saveErrno != EWOULDBLOCK)
             {
                 LOG_ERROR("TcpConnection::sendInLoop \n");
-                if (errno == EPIPE || errno == ECONNRESET)  //SIGPIPE   RESET
+                if (saveErrno == EPIPE || saveErrno == ECONNRESET)  //SIGPIPE   RESET
                 {
                     faultError = true;
                 }    
@@ -213,17 +694,375 @@ void TcpConnection::sendInloop(const void* message, size_t len)
         // 目前发送缓冲区剩余待发送数据的长度
         size_t oldLen = outputBuffer_.readableBytes();
         if (oldLen + remaining >= highwaterMark_ 
-            && oldLen < highwaterMark_)
+            && oldLen < highwaterMark_
+            && callbacks_->highWaterMark)
         {
-            loop_->queueInLoop(
-                std::bind(highWaterMarkCallback_, shared_from_this(), oldLen + remaining)
+            channel_.ownerLoop()->queueInLoop(
+                std::bind(callbacks_->highWaterMark, shared_from_this(), oldLen + remaining)
             );
         }
         outputBuffer_.append((char*)message + nwrote, remaining);
-        if (!channel_->isWriting())
+        if (!channel_.isWriting() && !(tls_ && !tls_->handshakeDone()))
         {
-            channel_->enableWriting();  // 这里一定要注册channel的写事件,否则poller不会给channel通知EPOLLOUT
-        }   
+            if (corked_)
+            {
+                scheduleFlush();
+            }
+            else
+            {
+                channel_.enableWriting();  // 这里一定要注册channel的写事件,否则poller不会给channel通知EPOLLOUT
+            }
+        }
+        // 超过高水位，暂停读源，直到outputBuffer_回落到低水位
+        // 和恢复读的判断一样按outputBytes()计算，包括chunkQueue_中还没有发送的数据
+        if (flowControl_ && !sourcePaused_
+            && outputBytes() >= flowHighWaterMark_)
+        {
+            pauseSource();
+        }
+
+    }
+}
+
+void TcpConnection::sendChunkInLoop(const SharedPayload &message)
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendChunkInLoop, shared_from_this(), message));
+        return;
+    }
+    if (state_ == kDisconnected)
+    {
+        LOG_ERROR("disconnected, give up writing");
+        return;
+    }
+    bool zeroCopy = zeroCopyThreshold_ > 0 && message->size() >= zeroCopyThreshold_ && !tls_;
+    if (!zeroCopy && !hasChunks())
+    {
+        // 不走零拷贝，按普通数据拷贝发送
+        sendInloop(message->data(), message->size());
+        return;
+    }
+    queueChunkInLoop(message, zeroCopy);
+}
+
+// 共享消息的数据可能同时排在成千上万个连接的发送队列里，写不完的部分只保存引用
+void TcpConnection::sendSharedInLoop(const SharedPayload &message)
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::sendSharedInLoop, shared_from_this(), message));
+        return;
+    }
+    if (state_ == kDisconnected)
+    {
+        LOG_ERROR("disconnected, give up writing");
+        return;
+    }
+    if (tls_)
+    {
+        sendInloop(message->data(), message->size());
+        return;
+    }
+    queueChunkInLoop(message, zeroCopyThreshold_ > 0 && message->size() >= zeroCopyThreshold_);
+}
+
+void TcpConnection::queueChunkInLoop(const SharedPayload &message, bool zeroCopy)
+{
+    OutputChunk chunk = { message, 0, zeroCopy };
+    if (!channel_.isWriting() && outputBytes() == 0 && !corked_)
+    {
+        int saveErrno = 0;
+        ssize_t nwrote = writeChunk(chunk, &saveErrno);
+        if (nwrote >= 0)
+        {
+            chunk.offset = nwrote;
+        }
+        else if (saveErrno != EWOULDBLOCK)
+        {
+            LOG_ERROR("TcpConnection::sendChunkInLoop \n");
+            if (saveErrno == EPIPE || saveErrno == ECONNRESET)
+            {
+                return;
+            }
+        }
+    }
+
+    size_t remaining = message->size() - chunk.offset;
+    if (remaining == 0)
+    {
+        if (callbacks_->writeComplete)
+        {
+            channel_.ownerLoop()->queueInLoop(std::bind(
+                callbacks_->writeComplete, shared_from_this()
+            ));
+        }
+        return;
+    }
+
+    size_t oldLen = outputBytes();
+    if (oldLen + remaining >= highwaterMark_
+        && oldLen < highwaterMark_
+        && callbacks_->highWaterMark)
+    {
+        channel_.ownerLoop()->queueInLoop(
+            std::bind(callbacks_->highWaterMark, shared_from_this(), oldLen + remaining)
+        );
+    }
+    chunkQueue().chunks.push_back(chunk);
+    chunkBytes_ += remaining;
+    if (!channel_.isWriting())
+    {
+        if (corked_)
+        {
+            scheduleFlush();
+        }
+        else
+        {
+            channel_.enableWriting();
+        }
+    }
+    if (flowControl_ && !sourcePaused_ && outputBytes() >= flowHighWaterMark_)
+    {
+        pauseSource();
+    }
+}
+
+ssize_t TcpConnection::writeChunk(const OutputChunk &chunk, int *saveErrno)
+{
+    const char *data = chunk.data->data() + chunk.offset;
+    size_t len = chunk.data->size() - chunk.offset;
+#ifdef MSG_ZEROCOPY
+    if (chunk.zeroCopy && zeroCopyThreshold_ > 0)
+    {
+        ssize_t n = ::send(channel_.fd(), data, len, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            // 每次成功的MSG_ZEROCOPY发送占用一个序号，内核按序号区间通知完成
+            // 完成之前这块数据的引用一直留在pinned中
+            chunkQueue().pinned.push_back(std::make_pair(zeroCopySeq_++, chunk.data));
+            return n;
+        }
+        if (errno != ENOBUFS)
+        {
+            *saveErrno = errno;
+            return n;
+        }
+        // ENOBUFS：超过了socket的optmem限制，这一次退回拷贝发送
+    }
+#endif
+    return writeToSocket(data, len, saveErrno);
+}
+
+bool TcpConnection::writeChunks(int *saveErrno)
+{
+    while (hasChunks())
+    {
+        OutputChunk &chunk = chunkQueue_->chunks.front();
+        ssize_t n = writeChunk(chunk, saveErrno);
+        if (n <= 0)
+        {
+            return false;
+        }
+        chunk.offset += n;
+        chunkBytes_ -= n;
+        if (chunk.offset < chunk.data->size())
+        {
+            return true;    //socket发送缓冲区写满了，等下一次EPOLLOUT
+        }
+        chunkQueue_->chunks.pop_front();
+    }
+    return true;
+}
+
+void TcpConnection::readZeroCopyCompletions()
+{
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+    std::deque<std::pair<uint32_t, SharedPayload>> &pinned = chunkQueue().pinned;
+    for (;;)
+    {
+        char control[128];
+        struct msghdr msg;
+        bzero(&msg, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        if (::recvmsg(channel_.fd(), &msg, MSG_ERRQUEUE) < 0)
+        {
+            break;  //错误队列已经读空
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+            const struct sock_extended_err *serr =
+                reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cmsg));
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+            {
+                continue;
+            }
+            // [ee_info, ee_data]区间内的发送已经完成，通知之间可能乱序
+            uint32_t lo = serr->ee_info;
+            uint32_t hi = serr->ee_data;
+            uint32_t count = hi - lo + 1;
+            zeroCopyCompleted_ += count;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                zeroCopyCopied_ += count;
+            }
+            if (!pinned.empty())
+            {
+                uint32_t base = pinned.front().first;
+                for (uint32_t seq = lo; seq != hi + 1; ++seq)
+                {
+                    uint32_t index = seq - base;
+                    if (index < pinned.size())
+                    {
+                        pinned[index].second.reset();
+                    }
+                }
+            }
+        }
+    }
+    while (!pinned.empty() && !pinned.front().second)
+    {
+        pinned.pop_front();
+    }
+
+    // 内核每次都退回了拷贝（例如回环网卡），零拷贝只会多出通知的开销，关掉
+    if (zeroCopyThreshold_ > 0 && zeroCopyCompleted_ >= 64 && zeroCopyCopied_ == zeroCopyCompleted_)
+    {
+        LOG_INFO("TcpConnection [#%lu] kernel always copies, disable zerocopy \n", id_);
+        zeroCopyThreshold_ = 0;
+    }
+#endif
+}
+
+bool TcpConnection::setZeroCopy(size_t threshold)
+{
+    if (threshold == 0 || !socket_.setZeroCopy(true))
+    {
+        zeroCopyThreshold_ = 0;
+        return false;
+    }
+    zeroCopyThreshold_ = threshold;
+    return true;
+}
+
+void TcpConnection::startRead()
+{
+    getLoop()->runInLoop(std::bind(&TcpConnection::startReadInLoop, shared_from_this()));
+}
+
+void TcpConnection::startReadInLoop()
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::startReadInLoop, shared_from_this()));
+        return;
+    }
+    userPaused_ = false;
+    updateReadingInLoop();
+}
+
+void TcpConnection::stopRead()
+{
+    getLoop()->runInLoop(std::bind(&TcpConnection::stopReadInLoop, shared_from_this()));
+}
+
+void TcpConnection::stopReadInLoop()
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::stopReadInLoop, shared_from_this()));
+        return;
+    }
+    userPaused_ = true;
+    updateReadingInLoop();
+}
+
+void TcpConnection::holdReadInLoop()
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::holdReadInLoop, shared_from_this()));
+        return;
+    }
+    ++readHolds_;
+    updateReadingInLoop();
+}
+
+void TcpConnection::releaseReadInLoop()
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::releaseReadInLoop, shared_from_this()));
+        return;
+    }
+    if (readHolds_ > 0)
+    {
+        --readHolds_;
+    }
+    updateReadingInLoop();
+}
+
+void TcpConnection::updateReadingInLoop()
+{
+    if (ioHandler_)
+    {
+        return;     //接管之后由handler决定关注的事件
+    }
+    if (!userPaused_ && readHolds_ == 0 && !pendingTakeOver_)
+    {
+        if (state_ == kConnected && (!reading_ || !channel_.isReading()))
+        {
+            channel_.enabeReading();
+            reading_ = true;
+        }
+    }
+    else if (reading_ || channel_.isReading())
+    {
+        channel_.disableReading();
+        reading_ = false;
+    }
+}
+
+void TcpConnection::setFlowControl(size_t highWaterMark, size_t lowWaterMark)
+{
+    flowHighWaterMark_ = highWaterMark;
+    flowLowWaterMark_ = lowWaterMark < highWaterMark ? lowWaterMark : highWaterMark / 2;
+    flowControl_ = true;
+}
+
+void TcpConnection::setTcpNotSentLowat(int bytes)
+{
+    socket_.setTcpNotSentLowat(bytes);
+}
+
+// 读源可能在其他loop中，通过runInLoop切换到读源的线程
+// 不用stopRead/startRead：背压恢复时不能打开应用自己暂停的读，也不能放开其他连接对同一个读源的暂停
+void TcpConnection::pauseSource()
+{
+    TcpConnectionPtr source = backpressureSource_.lock();
+    if (!source)
+    {
+        source = shared_from_this();
+    }
+    sourcePaused_ = true;
+    pausedSource_ = source;
+    source->getLoop()->runInLoop(std::bind(&TcpConnection::holdReadInLoop, source));
+}
+
+void TcpConnection::resumeSource()
+{
+    TcpConnectionPtr source = pausedSource_.lock();
+    sourcePaused_ = false;
+    pausedSource_.reset();
+    if (source)
+    {
+        source->getLoop()->runInLoop(std::bind(&TcpConnection::releaseReadInLoop, source));
     }
 }
 
@@ -231,22 +1070,54 @@ void TcpConnection::sendInloop(const void* message, size_t len)
 void TcpConnection::connectEstablished()
 {
     setState(kConnected);
-    channel_->tie(shared_from_this());
-    channel_->enabeReading();   //向poller注册EPOLLIN事件
+    lastReceiveTime_ = Timestamp::now();
+    channel_.tie(shared_from_this());
+    channel_.enabeReading();   //向poller注册EPOLLIN事件
+    reading_ = true;
 
+    if (tls_)
+    {
+        // TLS连接在握手完成后再回调connection回调
+        handleTlsHandshake();
+        return;
+    }
     // 新连接建立，执行回调
-    connectionCallback_(shared_from_this());
+    callbacks_->connection(shared_from_this());
+}
+
+bool TcpConnection::startTls(const std::shared_ptr<TlsContext> &ctx, const std::string &hostname)
+{
+    if (!ctx)
+    {
+        LOG_ERROR("TcpConnection [%s] startTls without TlsContext \n", name().c_str());
+        return false;
+    }
+    if (ctx->isServer())
+    {
+        tls_.reset(new TlsSession(ctx, socket_.fd(), std::string()));
+        return true;
+    }
+    // 同一个IP上可能有多个主机名，session只能复用给同一个主机名
+    InetAddress peer = peerAddr_.get();
+    std::string key = hostname.empty() ? peer.toIpPort() : hostname + ":" + std::to_string(peer.toPort());
+    tls_.reset(new TlsSession(ctx, socket_.fd(), key, hostname));
+    return true;
 }
 //连接销毁
 void TcpConnection::connectDestroyed()
 {
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::connectDestroyed, shared_from_this()));
+        return;
+    }
     if (state_ == kConnected)
     {
         setState(kDisconnected);
-        channel_->disableAll(); //把所有channel的感兴趣事件，从poller中del掉
-        connectionCallback_(shared_from_this());
+        channel_.disableAll(); //把所有channel的感兴趣事件，从poller中del掉
+        callbacks_->connection(shared_from_this());
     }
-    channel_->remove(); //把channel从poller中删除掉
+    channel_.remove(); //把channel从poller中删除掉
 }
 
 // 关闭连接
@@ -255,15 +1126,216 @@ void TcpConnection::shutdown()
     if (state_ == kConnected)
     {
         setState(kDisconnecting);
-        loop_->runInLoop(
+        getLoop()->runInLoop(
             std::bind(&TcpConnection::shutdownInLoop, this)
         );
     }
 }
 void TcpConnection::shutdownInLoop()
 {
-    if (!channel_->isWriting())
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::shutdownInLoop, shared_from_this()));
+        return;
+    }
+    // 还有合并写的数据没有写出时，等flush写完后再关闭写端
+    if (!channel_.isWriting() && !flushPending_)
+    {
+        if (tls_)
+        {
+            tls_->shutdown();
+        }
+        socket_.shudownWrite();
+    }
+}
+
+void TcpConnection::forceClose()
+{
+    if (state_ == kConnected || state_ == kDisconnecting)
     {
-        socket_->shudownWrite();
+        setState(kDisconnecting);
+        getLoop()->queueInLoop(
+            std::bind(&TcpConnection::forceCloseInLoop, shared_from_this())
+        );
     }
-}
\ No newline at end of file
+}
+
+void TcpConnection::forceCloseInLoop()
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::forceCloseInLoop, shared_from_this()));
+        return;
+    }
+    if (state_ == kConnected || state_ == kDisconnecting)
+    {
+        // 不等待outputBuffer_发送完，直接按对端关闭处理
+        handleClose();
+    }
+}
+
+void TcpConnection::takeOverIo(const std::shared_ptr<ChannelHandler> &handler, const TakeOverCallback &done)
+{
+    if (state_ != kConnected || tls_ || ioHandler_ || pendingTakeOver_)
+    {
+        std::string unread;
+        done(false, unread);
+        return;
+    }
+    setMigratable(false);
+    pendingTakeOver_.reset(new PendingTakeOver);
+    pendingTakeOver_->handler = handler;
+    pendingTakeOver_->done = done;
+    if (outputBytes() == 0 && !flushPending_)
+    {
+        finishTakeOver();
+        return;
+    }
+    // 等待期间读到的数据会交给message回调，先停止读，留在socket中由handler读取
+    updateReadingInLoop();
+}
+
+void TcpConnection::finishTakeOver()
+{
+    std::unique_ptr<PendingTakeOver> pending(std::move(pendingTakeOver_));
+    std::string unread;
+    if (state_ != kConnected)
+    {
+        pending->done(false, unread);
+        return;
+    }
+    unread.assign(inputBuffer_.peek(), inputBuffer_.readableBytes());
+    inputBuffer_.retrieveAll();
+    ioHandler_ = pending->handler;
+    channel_.setHandler(ioHandler_.get());
+    channel_.disableAll();
+    reading_ = false;
+    pending->done(true, unread);
+}
+
+bool TcpConnection::migratedAway() const
+{
+    return !getLoop()->isInLoopThread();
+}
+
+void TcpConnection::migrateTo(EventLoop *loop, const ConnectionCallback &done)
+{
+    // 总是排队执行：迁移不能发生在本连接的handleEvent中途
+    getLoop()->queueInLoop(std::bind(&TcpConnection::migrateInLoop, shared_from_this(), loop, done));
+}
+
+void TcpConnection::migrateInLoop(EventLoop *loop, const ConnectionCallback &done)
+{
+    if (migratedAway())
+    {
+        getLoop()->queueInLoop(std::bind(&TcpConnection::migrateInLoop, shared_from_this(), loop, done));
+        return;
+    }
+    EventLoop *oldLoop = channel_.ownerLoop();
+    if (loop == oldLoop || (state_ != kConnected && state_ != kDisconnecting))
+    {
+        return;
+    }
+    if (!migratable() || ioHandler_)
+    {
+        LOG_INFO("TcpConnection::migrateTo [#%lu] pinned to loop %p, not migrated \n", id_, oldLoop);
+        return;
+    }
+    LOG_INFO("TcpConnection::migrateTo [#%lu] fd = %d loop %p => %p \n", id_, channel_.fd(), oldLoop, loop);
+
+    // 登记在本轮末尾的合并写现在就写出，之后原loop的flush不会再碰这个连接
+    if (flushPending_)
+    {
+        flushCorked();
+    }
+    bool writing = channel_.isWriting();
+    channel_.disableAll();
+    channel_.remove();
+    // 读缓冲区池属于原loop，空闲的缓冲区还给它；有数据的缓冲区带走，以后还给新loop的池
+    if (pooledInput_ && inputBuffer_.readableBytes() == 0 && inputBuffer_.allocated())
+    {
+        oldLoop->bufferPool()->give(inputBuffer_.release());
+    }
+    channel_.setLoop(loop);
+    // 先把adopt排进新loop再公布新的loop_：其他线程按新loop_投递的操作一定排在adopt之后
+    loop->queueInLoop(std::bind(&TcpConnection::adoptInLoop, shared_from_this(), oldLoop, writing, done));
+    publishLoop(oldLoop, loop);
+}
+
+void TcpConnection::addMigrationObserver(const void *key, const MigrationCallback &cb)
+{
+    if (!migrationObservers_)
+    {
+        migrationObservers_.reset(new std::vector<std::pair<const void*, MigrationCallback>>);
+    }
+    for (auto& item : *migrationObservers_)
+    {
+        if (item.first == key)
+        {
+            item.second = cb;
+            return;
+        }
+    }
+    migrationObservers_->emplace_back(key, cb);
+}
+
+void TcpConnection::removeMigrationObserver(const void *key)
+{
+    if (!migrationObservers_)
+    {
+        return;
+    }
+    auto& observers = *migrationObservers_;
+    for (size_t i = 0; i < observers.size(); ++i)
+    {
+        if (observers[i].first == key)
+        {
+            observers.erase(observers.begin() + i);
+            return;
+        }
+    }
+}
+
+// 原loop和新loop都会尝试更新loop_，先到的生效；连接随后又被迁走时，迟到的一方不会把它改回来
+void TcpConnection::publishLoop(EventLoop *from, EventLoop *to)
+{
+    loop_.compare_exchange_strong(from, to, std::memory_order_acq_rel);
+}
+
+// 在新loop中执行，这时原loop可能还没来得及更新loop_，这里先更新，
+// 保证之后本线程中的send直接执行，不会绕到原loop而排到后面的数据之后
+void TcpConnection::adoptInLoop(EventLoop *from, bool writing, const ConnectionCallback &done)
+{
+    publishLoop(from, channel_.ownerLoop());
+    TcpConnectionPtr self(shared_from_this());
+    if (callbacks_->migrated)
+    {
+        callbacks_->migrated(self, from);
+    }
+    if (done)
+    {
+        done(self);
+    }
+    if (migrationObservers_)
+    {
+        // 观察者可能增删观察者，遍历一份拷贝
+        std::vector<std::pair<const void*, MigrationCallback>> observers(*migrationObservers_);
+        for (auto& item : observers)
+        {
+            item.second(self, from);
+        }
+    }
+    if (state_ == kDisconnected)
+    {
+        return;
+    }
+    channel_.tie(self);
+    if (reading_ && !channel_.isReading())
+    {
+        channel_.enabeReading();
+    }
+    if (writing && !channel_.isWriting())
+    {
+        channel_.enableWriting();
+    }
+}
@@ -5,54 +5,166 @@
 #include "Callbacks.h"
 #include "Buffer.h"
 #include "Timestamp.h"
+#include "Socket.h"
+#include "Channel.h"
 
 #include <memory>
 #include <string>
 #include <atomic>
+#include <deque>
+#include <utility>
+#include <vector>
 
-class Channel;
 class EventLoop;
-class Socket;
+class TlsContext;
+class TlsSession;
 
 //TcpServer => Acceptor => 有一个新用户连接， 通过accept（）拿到connfd
 // => TcpConnection 设置回调 => Channel => poller =>channel的回调操作
 
+// 为了支撑百万级连接，每个连接的内存尽量紧凑：Socket和Channel内嵌，Channel通过ChannelHandler分发事件，
+// 回调与TcpServer共享（写时复制），收发缓冲区和整块发送队列第一次用到时才分配，
+// TcpServer从slab中分配连接对象（见SlabAllocator）
 class TcpConnection : noncopyable,
-         public std::enable_shared_from_this<TcpConnection>
+         public std::enable_shared_from_this<TcpConnection>,
+         private ChannelHandler
 {
 public:
     TcpConnection(EventLoop *loop,
-                const std::string &name,
+                uint64_t id,
+                const std::shared_ptr<const std::string> &namePrefix,
                 int sockfd,
                 const InetAddress &localAddr,
                 const InetAddress &peerAddr);
     ~TcpConnection();
 
-    EventLoop* getLoop() const { return loop_; }
-    const std::string& name() const { return name_; }
-    const InetAddress& localAddress() const { return localAddr_; }
-    const InetAddress& peerAddress() const { return peerAddr_; }
+    // 连接当前所属的loop，迁移后会改变，可以在任意线程调用
+    EventLoop* getLoop() const { return loop_.load(std::memory_order_acquire); }
+    uint64_t id() const { return id_; }
+    // 连接名按需格式化："前缀#id"，不在每个连接上保存字符串
+    std::string name() const;
+    InetAddress localAddress() const { return localAddr_.get(); }
+    InetAddress peerAddress() const { return peerAddr_.get(); }
 
     bool connected () const {return state_ == kConnected; }
     bool disconnected() const { return state_ == kDisconnected; }
 
-    //发送数据
+    // 还没有写进socket的数据长度（outputBuffer_加上排队的整块数据），只能在所属loop线程中调用
+    size_t outputBytes() const { return outputBuffer_.readableBytes() + chunkBytes_; }
+
+    // 用户附加在连接上的任意数据
+    void setContext(const std::shared_ptr<void> &context) { context_ = context; }
+    const std::shared_ptr<void>& getContext() const { return context_; }
+
+    //发送数据，可以在任意线程调用
+    // 在其他线程调用时数据（拷贝或移动后）进入连接的无锁发送队列，同一批排队的消息只投递一次drain任务，
+    // 在所属loop中合并写出；同一个线程发出的消息保持顺序
     void send(const std::string& buf);
+    // 发送数据并接管message，开启零拷贝且长度不小于阈值时直接把message交给内核，不再拷贝
+    void send(std::string&& message);
+    // 发送共享的只读消息，可以在任意线程调用；一次写不完的部分以引用排队，不拷贝进outputBuffer_
+    // TLS连接需要先加密，仍然拷贝发送
+    void send(const SharedPayload &message);
     //关闭连接
     void shutdown();
+    //立即关闭连接，丢弃还没有发送的数据
+    void forceClose();
+
+    // 读端流量控制：暂停/恢复监听EPOLLIN
+    // 和背压的暂停分开计：stopRead之后只有startRead才恢复，背压回落不会恢复它；
+    // startRead也不会越过还没有回落的背压
+    void startRead();
+    void stopRead();
+    bool isReading() const { return reading_; }
+
+    // 开启背压：outputBuffer_超过高水位时暂停读源连接，回落到低水位后恢复
+    void setFlowControl(size_t highWaterMark, size_t lowWaterMark);
+    // 设置读源连接（如代理中的对端），默认暂停的是自身的读
+    // 一个读源可以被多个连接暂停，所有暂停它的连接都回落到低水位后才恢复读
+    void setBackpressureSource(const TcpConnectionPtr &source)
+        { backpressureSource_ = source; }
+
+    // TCP_NODELAY 关闭Nagle算法，小请求流水线发送时不用等对端ACK
+    void setTcpNoDelay(bool on) { socket_.setTcpNoDelay(on); }
+
+    // TCP_NOTSENT_LOWAT 限制内核中未发送数据的长度
+    void setTcpNotSentLowat(int bytes);
+
+    // 开启MSG_ZEROCOPY：send(std::string&&)不小于threshold字节的数据直接由内核引用发送，
+    // 数据一直由连接持有，直到从socket错误队列读到内核的完成通知才释放
+    // 内核或socket不支持时返回false，继续使用拷贝发送；TLS连接不使用零拷贝
+    // 在connectEstablished之前或所属loop线程中调用
+    bool setZeroCopy(size_t threshold);
+    bool zeroCopy() const { return zeroCopyThreshold_ > 0; }
+    uint64_t zeroCopyCompleted() const { return zeroCopyCompleted_; }   //内核确认完成的零拷贝发送次数
+    uint64_t zeroCopyCopied() const { return zeroCopyCopied_; }         //其中内核实际做了拷贝的次数
 
-    //回调函数
+    // 合并写：开启后同一轮循环中的多次send只追加到发送缓冲区，
+    // 在本轮循环末尾(EventLoop::queueFlush)统一写一次，减少系统调用和小报文
+    // 只能在所属loop线程中调用
+    void setCork(bool on);
+    bool corked() const { return corked_; }
+
+    // 输入缓冲区的预留大小按最近的读自适应调整，下面两个选项只能在所属loop线程中调用
+    // 每次读之前用FIONREAD查询socket中的可读字节数，按实际大小预留（多一次系统调用）
+    void setFionread(bool on) { fionread_ = on; }
+    // 输入缓冲区读空后把内存还给loop的BufferPool，下次可读时再按预期大小取出；空闲连接不占输入缓冲区
+    void setPooledInput(bool on) { pooledInput_ = on; }
+
+    // 在connectEstablished之前调用，开启TLS；握手完成后才回调connection回调
+    // 库编译时没有开启OpenSSL或ctx为空时返回false
+    // 客户端的hostname非空时发送SNI并校验服务端证书的主机名，会话按"hostname:端口"复用
+    bool startTls(const std::shared_ptr<TlsContext> &ctx, const std::string &hostname = std::string());
+    bool isTls() const { return static_cast<bool>(tls_); }
+
+    //回调函数，单独设置时从共享的回调中复制出本连接自己的一份
     void setHighWaterMarkCallback(const HighWaterMarkCallback &cb, size_t highwaterMark) 
-        { highWaterMarkCallback_ = cb; highwaterMark_ = highwaterMark;}
+        { mutableCallbacks().highWaterMark = cb; highwaterMark_ = highwaterMark;}
     void setConnectionCallback(const ConnectionCallback &cb) 
-        { connectionCallback_ = cb; }
+        { mutableCallbacks().connection = cb; }
     void setMessageCallback(const MessageCallback &cb) 
-        { messageCallback_ = cb; }
+        { mutableCallbacks().message = cb; }
     void setWriteCompleteCallback(const WriteCompleteCallback &cb) 
-        { writeCompleteCallback_ = cb; }
+        { mutableCallbacks().writeComplete = cb; }
     void setCloseCallback(const CloseCallback &cb) 
-        { closeCallback_ = cb; }
+        { mutableCallbacks().close = cb; }
+    // 整组设置，TcpServer用它让所有连接共享同一份回调
+    void setCallbacks(const ConnectionCallbacksPtr &callbacks) { callbacks_ = callbacks; }
+    // 当前生效的写完成回调，用来在它外面再包一层（如协程的写等待）
+    const WriteCompleteCallback& writeCompleteCallback() const { return callbacks_->writeComplete; }
+    void setHighWaterMark(size_t highwaterMark) { highwaterMark_ = highwaterMark; }
     
+    // 把连接迁移到loop：在原loop两次事件处理之间注销channel，再到loop中重新注册，
+    // 收发缓冲区、排队的整块数据、TLS和零拷贝状态原样带过去；可以在任意线程调用
+    // 迁移完成后在loop线程中先回调migrated（见ConnectionCallbacks），再回调done，此时连接还没有开始在loop中处理事件
+    // 迁移前后发给连接的send/shutdown等操作会转交给新loop，保持顺序；
+    // 已经排进原loop的用户回调（如writeComplete）仍在原loop线程执行，用户自己保存的getLoop()也不会跟着改变
+    // 连接没有处于已建立状态时放弃迁移，不回调done
+    void migrateTo(EventLoop *loop, const ConnectionCallback &done = ConnectionCallback());
+    // 按key登记迁移的观察者（如BroadcastGroup把成员挪到新loop的分片），每次迁移完成后在新loop中回调，
+    // 时机和migrateTo的done相同；同一个key重复登记时替换。只能在所属loop线程中调用
+    void addMigrationObserver(const void *key, const MigrationCallback &cb);
+    void removeMigrationObserver(const void *key);
+    // 设为false后连接固定在当前loop上，migrateTo不再迁移它（如协程的定时器绑在当前loop上）
+    // TcpServer移除loop和负载均衡时跳过这样的连接；线程安全
+    void setMigratable(bool on) { migratable_.store(on, std::memory_order_relaxed); }
+    bool migratable() const { return migratable_.load(std::memory_order_relaxed); }
+
+    // 把连接上的IO事件交给handler（如SpliceProxy在内核中搬运数据），只能在所属loop线程中调用
+    // 还有没写完的数据时先停止读，等它们全部写进socket再接管；接管完成或失败时回调done，
+    // ok表示是否接管，unread是输入缓冲区中还没有取走的数据
+    // 接管后连接的收发缓冲区不再使用，事件全部关闭，handler通过ioChannel()调整关注的事件，结束时调用forceClose；
+    // 连接持有handler直到析构，从调用起固定在当前loop上（见setMigratable）
+    // 连接不是已建立状态、使用TLS、已经接管或者在等待写完期间关闭时不接管
+    using TakeOverCallback = std::function<void(bool ok, std::string &unread)>;
+    void takeOverIo(const std::shared_ptr<ChannelHandler> &handler, const TakeOverCallback &done);
+    Channel* ioChannel() { return &channel_; }
+
+    // 自上次取样以来读到的字节数，取样后清零，负载均衡用它挑选迁移的连接，只能在所属loop线程中调用
+    uint64_t takeLoadSample() { uint64_t n = loadBytes_; loadBytes_ = 0; return n; }
+    // 最近一次读到数据的时间（连接建立时的时间作为初值），只能在所属loop线程中调用
+    Timestamp lastReceiveTime() const { return lastReceiveTime_; }
+
     //连接建立
     void connectEstablished();
     //连接销毁
@@ -61,35 +173,156 @@ public:
 private:
     enum StateE {kDisconnected, kConnecting, kConnected, kDisconnecting };
     void setState(StateE s) { state_ = s; }
-    
+    ConnectionCallbacks& mutableCallbacks();
+
+    // ChannelHandler
     void handleRead(Timestamp receiveTime);
     void handleWrite();
     void handleClose();
     void handleError();
+    const char* traceName(uint64_t *id) const { *id = id_; return namePrefix_->c_str(); }
+    void writeOutput();
+    void scheduleFlush();
+    void flushCorked();
 
     void sendInloop(const void *message, size_t len);
+    // 其他线程的send：压入outbound_，队列由空变为非空时投递drainOutbound
+    void queueOutbound(std::string &&message);
+    void drainOutbound();
+    void sendChunkInLoop(const SharedPayload &message);
+    void sendSharedInLoop(const SharedPayload &message);
+    // 把整块数据写进socket，写不完的部分排进chunkQueue_
+    void queueChunkInLoop(const SharedPayload &message, bool zeroCopy);
+    ssize_t writeToSocket(const void *data, size_t len, int *saveErrno);
+    void handleTlsHandshake();
+    // 根据这次读到的字节数调整下一次预留的大小
+    void adaptReadSize(size_t n, size_t expected);
+
+    // outputBuffer_之后排队的整块数据，零拷贝发送的数据不进outputBuffer_
+    struct OutputChunk
+    {
+        SharedPayload data;
+        size_t offset;
+        bool zeroCopy;
+    };
+    // 其他线程send的消息，无锁的后进先出链表，drain时整条取下再反转
+    struct OutboundNode
+    {
+        OutboundNode *next;
+        std::string data;
+    };
+
+    // 整块数据的发送队列和零拷贝状态，第一次用到时才分配（std::deque默认构造就会分配内存）
+    struct ChunkQueue
+    {
+        std::deque<OutputChunk> chunks;
+        // 已经交给内核的零拷贝数据，按序号排列；完成后data置空，队头连续完成的部分出队
+        std::deque<std::pair<uint32_t, SharedPayload>> pinned;
+    };
+    bool hasChunks() const { return chunkQueue_ && !chunkQueue_->chunks.empty(); }
+    ChunkQueue& chunkQueue();
+
+    // 连接上保存的地址：IP地址直接内嵌，Unix域地址（sockaddr_un有110字节）才放到堆上
+    struct PackedAddress
+    {
+        explicit PackedAddress(const InetAddress &addr);
+        InetAddress get() const;
+
+        union
+        {
+            sockaddr_in v4;
+            sockaddr_in6 v6;
+        } ip;
+        std::unique_ptr<InetAddress> other;
+    };
+
+    ssize_t writeChunk(const OutputChunk &chunk, int *saveErrno);
+    // 尽量发送排队的整块数据，直到全部发完或socket发送缓冲区写满
+    bool writeChunks(int *saveErrno);
+    // 读取socket错误队列中的零拷贝完成通知，释放内核已经不再引用的数据
+    void readZeroCopyCompletions();
     void shutdownInLoop();
+    void forceCloseInLoop();
+    void startReadInLoop();
+    void stopReadInLoop();
+    void migrateInLoop(EventLoop *loop, const ConnectionCallback &done);
+    void adoptInLoop(EventLoop *from, bool writing, const ConnectionCallback &done);
+    void publishLoop(EventLoop *from, EventLoop *to);
+    // 排队期间连接已经迁移到其他loop，本线程不再拥有它
+    bool migratedAway() const;
 
+    void pauseSource();
+    void resumeSource();
+    // 读源一侧：被暂停的次数加减一，在读源所属的loop中执行
+    void holdReadInLoop();
+    void releaseReadInLoop();
+    // 没有被stopRead暂停、也没有被背压暂停、也不在等待接管时才监听EPOLLIN
+    void updateReadingInLoop();
+    // 发送缓冲区写空之后完成等待中的takeOverIo
+    void finishTakeOver();
 
-    EventLoop *loop_;    //绝对不是baseLoop， 因为TcpConnection都是在subloop中
-    const std::string name_;    
+
+    // 绝对不是baseLoop， 因为TcpConnection都是在subloop中
+    // 迁移时会改变：其他线程用它决定把操作投递到哪个loop，loop线程内部使用channel_.ownerLoop()
+    std::atomic<EventLoop*> loop_;
+    const uint64_t id_;
+    std::shared_ptr<const std::string> namePrefix_;    //同一个TcpServer的连接共享名字前缀
     std::atomic_int state_;
     bool reading_;
 
-    std::unique_ptr<Socket> socket_;
-    std::unique_ptr<Channel> channel_;
+    Socket socket_;
+    Channel channel_;
+    std::unique_ptr<TlsSession> tls_;   //非TLS连接为空
 
-    const InetAddress localAddr_;
-    const InetAddress peerAddr_;
+    const PackedAddress localAddr_;
+    const PackedAddress peerAddr_;
 
-    ConnectionCallback connectionCallback_; //有新连接时的回调
-    MessageCallback messageCallback_;       //有读写消息时的回调
-    WriteCompleteCallback writeCompleteCallback_;   //信息发送完成后的回调
-    CloseCallback closeCallback_;   //关闭连接时的回调
-    HighWaterMarkCallback highWaterMarkCallback_;   //发送速率过高的回调
+    // connection 有新连接时的回调，message 有读写消息时的回调，writeComplete 信息发送完成后的回调，
+    // close 关闭连接时的回调，highWaterMark 发送速率过高的回调
+    ConnectionCallbacksPtr callbacks_;
 
-    size_t highwaterMark_;
+    size_t highwaterMark_;      //highWaterMark回调的水位
+    size_t flowHighWaterMark_;  //背压的高低水位，和回调的水位分开设置
+    size_t flowLowWaterMark_;
+    bool flowControl_;  //是否开启背压
+    bool sourcePaused_; //当前是否因为高水位暂停了读源
+    bool userPaused_;   //本连接被stopRead暂停
+    uint32_t readHolds_;    //暂停着本连接的读的背压数
+    std::weak_ptr<TcpConnection> backpressureSource_;
+    std::weak_ptr<TcpConnection> pausedSource_;     //暂停时的读源，读源中途更换时恢复的仍是它
 
     Buffer inputBuffer_;
     Buffer outputBuffer_;
+
+    std::atomic<OutboundNode*> outbound_;
+    std::unique_ptr<ChunkQueue> chunkQueue_;
+    size_t chunkBytes_;     //chunkQueue_中还没有发送的字节数
+    size_t zeroCopyThreshold_;  //0表示没有开启零拷贝
+    uint32_t zeroCopySeq_;      //下一次MSG_ZEROCOPY发送的序号，与内核的计数一致
+    uint64_t zeroCopyCompleted_;
+    uint64_t zeroCopyCopied_;
+
+    uint8_t readSizeIndex_;     //下一次读预留的大小在kReadSizes中的下标
+    bool readShrinkPending_;    //上一次读已经小于下一档，再小一次就降档
+    bool fionread_;
+    bool pooledInput_;
+
+    bool corked_;       //合并写模式
+    bool flushPending_; //已经登记了本轮末尾的flush
+
+    uint64_t loadBytes_;    //见takeLoadSample
+    Timestamp lastReceiveTime_;
+    std::atomic<bool> migratable_;
+
+    std::shared_ptr<void> context_;
+    // 见addMigrationObserver，大多数连接没有，用到时才分配
+    std::unique_ptr<std::vector<std::pair<const void*, MigrationCallback>>> migrationObservers_;
+    std::shared_ptr<ChannelHandler> ioHandler_;     //见takeOverIo，为空时事件由本连接处理
+    // 等待发送缓冲区写空的takeOverIo，没有时为空
+    struct PendingTakeOver
+    {
+        std::shared_ptr<ChannelHandler> handler;
+        TakeOverCallback done;
+    };
+    std::unique_ptr<PendingTakeOver> pendingTakeOver_;
 };
\ No newline at end of file
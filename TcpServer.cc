@@ -1,7 +1,12 @@
 #include "TcpServer.h"
 #include "logger.h"
+#include "SlabAllocator.h"
 
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <algorithm>
 
 static EventLoop* checkLoopNotNull(EventLoop* loop)
 {
@@ -12,38 +17,173 @@ static EventLoop* checkLoopNotNull(EventLoop* loop)
     return loop;
 }
 
+// 通过sockfd获取其绑定的本机的地址信息
+static InetAddress localAddressOf(int sockfd)
+{
+    sockaddr_storage local;
+    bzero(&local, sizeof local);
+    socklen_t addrlen = static_cast<socklen_t>(sizeof local);
+    if (::getsockname(sockfd, (sockaddr*)&local, &addrlen) < 0)
+    {
+        LOG_ERROR("socket::getLocalAddr");
+    }
+    return InetAddress((sockaddr*)&local, addrlen);
+}
+
+namespace
+{
+
+// 从sysfs读取的CPU拓扑，用来判断两个CPU之间的远近
+struct CpuTopology
+{
+    static const int kFar = 3;
+
+    CpuTopology()
+    {
+        long n = ::sysconf(_SC_NPROCESSORS_CONF);
+        for (long cpu = 0; cpu < n; ++cpu)
+        {
+            core.push_back(readTopology(cpu, "core_id"));
+            package.push_back(readTopology(cpu, "physical_package_id"));
+        }
+    }
+
+    static int readTopology(long cpu, const char *name)
+    {
+        char path[128];
+        snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%ld/topology/%s", cpu, name);
+        FILE *fp = ::fopen(path, "r");
+        int value = -1;
+        if (fp != nullptr)
+        {
+            if (fscanf(fp, "%d", &value) != 1)
+            {
+                value = -1;
+            }
+            ::fclose(fp);
+        }
+        return value;
+    }
+
+    // 0 同一个CPU，1 同一个物理核的超线程，2 同一个封装，kFar 其余或不知道
+    int distance(int a, int b) const
+    {
+        if (a < 0 || b < 0)
+        {
+            return kFar;
+        }
+        if (a == b)
+        {
+            return 0;
+        }
+        int n = static_cast<int>(package.size());
+        if (a >= n || b >= n || package[a] < 0 || package[a] != package[b])
+        {
+            return kFar;
+        }
+        return core[a] >= 0 && core[a] == core[b] ? 1 : 2;
+    }
+
+    std::vector<int> core;
+    std::vector<int> package;
+};
+
+const CpuTopology& cpuTopology()
+{
+    static CpuTopology topology;
+    return topology;
+}
+
+} // namespace
+
+// loop健康检查的间隔（秒），不健康的loop连续达标这么多次才恢复
+static const double kHealthCheckInterval = 0.1;
+static const int kRecoverChecks = 5;
+
 TcpServer::TcpServer(EventLoop* loop, 
             const InetAddress &listenAddr,
             const std::string nameArg, 
             Option option)
+            : TcpServer(loop, new Acceptor(loop, listenAddr, option == kReusePort),
+                        listenAddr.toIpPort(), nameArg)
+{
+}
+
+TcpServer::TcpServer(EventLoop* loop, int listenFd, const std::string nameArg)
+            : TcpServer(loop, new Acceptor(loop, listenFd),
+                        localAddressOf(listenFd).toIpPort(), nameArg)
+{
+}
+
+TcpServer::TcpServer(EventLoop* loop,
+            Acceptor *acceptor,
+            const std::string &ipPort,
+            const std::string &nameArg)
             : loop_(checkLoopNotNull(loop)), 
-              ipPort_(listenAddr.toIpPort()),
+              ipPort_(ipPort),
               name_(nameArg),
-              acceptor_(new Acceptor(loop, listenAddr, option == kReusePort)),
+              acceptor_(acceptor),
               threadPool_(new EventLoopThreadPool(loop, name_)),
               connectionCallback_(),
               messageCallback_(),
+              highWaterMark_(64 * 1024 * 1024),
+              flowHighWaterMark_(0),
+              flowLowWaterMark_(0),
+              flowControl_(false),
+              notSentLowat_(0),
+              zeroCopyThreshold_(0),
+              cork_(false),
+              fionread_(false),
+              pooledInput_(false),
               nextConnId_(1),
-              started_(0)
+              connNamePrefix_(std::make_shared<const std::string>(nameArg + "-" + ipPort_)),
+              started_(0),
+              shards_(nullptr),
+              migrations_(0),
+              rebalanceInterval_(0),
+              rebalanceThreshold_(0),
+              maxConnections_(0),
+              maxConnectionsPerLoop_(0),
+              maxLagMs_(0),
+              maxQueueSize_(0),
+              shedActions_(kShedReject),
+              shedIdleSeconds_(1.0),
+              overloaded_(false),
+              admissionState_(kAdmitting),
+              numConnections_(0),
+              rejected_(0),
+              shed_(0),
+              placement_(kRoundRobin),
+              placedSameCpu_(0),
+              placedNearCpu_(0),
+              placedFallback_(0),
+              draining_(false)
 {
     // 当有新用户连接时，会执行TcpConnection回调
     acceptor_->setNewConnectionCallback(std::bind(&TcpServer::newConnection, this,
             std::placeholders::_1, std::placeholders::_2));
+    std::unique_lock<std::mutex> lock(shardsMutex_);
+    publishShards(new ConnectionShardMap);
 }
 
 //析构函数
 TcpServer::~TcpServer()
 {
-    for (auto& item : connections_)
+    for (const ConnectionShardPtr &shard : allShards())
     {
-        //这个局部的shared_ptr智能指针对象出右括号，可以自动释放资源
-        TcpConnectionPtr conn(item.second); 
-        item.second.reset();
-
-        // 销毁连接
-        conn->getLoop()->runInLoop(
-            std::bind(&TcpConnection::connectDestroyed, conn)
-        );
+        std::unordered_map<uint64_t, TcpConnectionPtr> connections;
+        {
+            std::unique_lock<std::mutex> lock(shard->mutex);
+            connections.swap(shard->connections);
+        }
+        for (auto& item : connections)
+        {
+            // 销毁连接
+            TcpConnectionPtr conn(item.second);
+            conn->getLoop()->runInLoop(
+                std::bind(&TcpConnection::connectDestroyed, conn)
+            );
+        }
     }
 }
 
@@ -59,69 +199,808 @@ void TcpServer::start()
     if (started_++ == 0)   //防止一个TcpServer对象被start多次
     {
         threadPool_->start(threadInitCallback_);    //启动底层线程池
+        // baseloop也有一个分片：移除所有subloop之后，连接迁回baseloop
+        addShard(loop_);
+        for (EventLoop *ioLoop : threadPool_->getAllLoops())
+        {
+            addShard(ioLoop);
+        }
         loop_->runInLoop(std::bind(&Acceptor::listen, acceptor_.get()));
+        if (rebalanceInterval_ > 0)
+        {
+            loop_->runEvery(rebalanceInterval_, std::bind(&TcpServer::rebalance, this));
+        }
+        if (maxLagMs_ > 0 || maxQueueSize_ > 0)
+        {
+            loop_->runEvery(kHealthCheckInterval, std::bind(&TcpServer::checkHealth, this));
+        }
     }
 }
 
-// 有一个新的客户端连接，acceptor会执行这个回调操作
-void TcpServer::newConnection(int sockfd, const InetAddress &peerAddr)
+void TcpServer::drain(double timeoutSeconds, const std::function<void()> &done)
 {
-    EventLoop* ioLoop = threadPool_->getNextLoop();
-    char buf[64] = {0};
-    snprintf(buf, sizeof buf, "-%s#%d", ipPort_.c_str(), nextConnId_);
-    ++nextConnId_;
-    std::string connName = name_ + buf;
+    loop_->runInLoop(std::bind(&TcpServer::drainInLoop, this, timeoutSeconds, done));
+}
 
-    LOG_INFO("TcpServer::newConnection [%s] - new connection [%s] from %s \n",
-        name_.c_str(), connName.c_str(), peerAddr.toIpPort().c_str());
+void TcpServer::drainInLoop(double timeoutSeconds, const std::function<void()> &done)
+{
+    if (draining_)
+    {
+        return;
+    }
+    draining_ = true;
+    drainCallback_ = done;
+    drainDeadline_ = addTime(Timestamp::now(), timeoutSeconds);
+    acceptor_->stop();
+    LOG_INFO("TcpServer::drain [%s] - stop accepting, %lu connections left \n",
+        name_.c_str(), numConnections());
+    // 已经accept但还在转交给subloop途中的连接会在下一次检查时计入
+    drainTimer_ = loop_->runEvery(0.1, std::bind(&TcpServer::checkDrained, this));
+}
 
-    // 通过sockfd获取其绑定的本机的ip地址和端口信息
-    sockaddr_in local;
-    bzero(&local, sizeof local);
-    socklen_t addrlen = static_cast<socklen_t>(sizeof local);
-    if (::getsockname(sockfd, (sockaddr*)&local, &addrlen) < 0)
+void TcpServer::checkDrained()
+{
+    size_t left = numConnections();
+    if (left == 0)
     {
-        LOG_ERROR("socket::getLocalAddr");
+        loop_->cancel(drainTimer_);
+        LOG_INFO("TcpServer::drain [%s] - all connections closed \n", name_.c_str());
+        if (drainCallback_)
+        {
+            std::function<void()> cb;
+            cb.swap(drainCallback_);
+            cb();
+        }
+    }
+    else if (drainDeadline_ < Timestamp::now())
+    {
+        LOG_INFO("TcpServer::drain [%s] - deadline reached, force close %lu connections \n",
+            name_.c_str(), left);
+        forEachConnection([](const TcpConnectionPtr &conn) { conn->forceClose(); });
+        drainDeadline_ = Timestamp(INT64_MAX);  //只强制关闭一次
     }
-    InetAddress localAddr(local);
+}
+
+// 有一个新的客户端连接，acceptor会执行这个回调操作
+void TcpServer::newConnection(int sockfd, const InetAddress &peerAddr)
+{
+    EventLoop* ioLoop = pickLoop(sockfd);
+    if (ioLoop == nullptr)
+    {
+        if (shedActions_ & kShedReject)
+        {
+            rejectConnection(sockfd);
+            updateAdmission();
+            return;
+        }
+        // 没有设置kShedReject时已经accept的连接照常接纳（暂停accept之前取出的连接，或者只靠kShedCloseIdle腾出空间）
+        ioLoop = threadPool_->getNextLoop();
+    }
+    shardOf(ioLoop)->load.fetch_add(1, std::memory_order_relaxed);
+    numConnections_.fetch_add(1, std::memory_order_relaxed);
+    if (maxConnections_ > 0 || maxConnectionsPerLoop_ > 0)
+    {
+        updateAdmission();
+    }
+    uint64_t connId = nextConnId_++;
+
+    LOG_INFO("TcpServer::newConnection [%s] - new connection [#%lu] from %s \n",
+        name_.c_str(), connId, peerAddr.toIpPort().c_str());
+
+    InetAddress localAddr(localAddressOf(sockfd));
 
     // 根据连接成功的sockefd，创建TcpConnection连接对象
-    TcpConnectionPtr conn(new TcpConnection(
+    // 连接对象和shared_ptr的控制块一起从slab中分配
+    TcpConnectionPtr conn(std::allocate_shared<TcpConnection>(
+                                SlabAllocator<TcpConnection>(),
                                 ioLoop, 
-                                connName, 
+                                connId,
+                                connNamePrefix_,
                                 sockfd,
                                 localAddr,
                                 peerAddr
                             ));
-    connections_[connName] = conn;
     // 下面回调都是用户设置给TcpServer => TcpConnection => Channel => poller => notify channel
-    conn->setConnectionCallback(connectionCallback_);
-    conn->setMessageCallback(messageCallback_);
-    conn->setWriteCompleteCallback(writeCompleteCallback_);
+    // 所有连接共享同一份回调，设置了如何关闭连接的回调 conn => shutDown()
+    if (!connCallbacks_)
+    {
+        connCallbacks_ = std::make_shared<ConnectionCallbacks>();
+        connCallbacks_->connection = connectionCallback_;
+        connCallbacks_->message = messageCallback_;
+        connCallbacks_->writeComplete = writeCompleteCallback_;
+        connCallbacks_->highWaterMark = highWaterMarkCallback_;
+        connCallbacks_->close = std::bind(&TcpServer::removeConnection, this, std::placeholders::_1);
+        connCallbacks_->migrated = std::bind(&TcpServer::connectionMigrated, this,
+            std::placeholders::_1, std::placeholders::_2);
+    }
+    conn->setCallbacks(connCallbacks_);
+    if (highWaterMarkCallback_)
+    {
+        conn->setHighWaterMark(highWaterMark_);
+    }
+    if (flowControl_)
+    {
+        conn->setFlowControl(flowHighWaterMark_, flowLowWaterMark_);
+    }
+    // TCP的选项只对IPv4/IPv6连接设置，Unix域连接上setsockopt会失败
+    bool tcp = localAddr.family() == AF_INET || localAddr.family() == AF_INET6;
+    if (notSentLowat_ > 0 && tcp)
+    {
+        conn->setTcpNotSentLowat(notSentLowat_);
+    }
+    if (zeroCopyThreshold_ > 0)
+    {
+        conn->setZeroCopy(zeroCopyThreshold_);
+    }
+    conn->setCork(cork_);
+    conn->setFionread(fionread_);
+    conn->setPooledInput(pooledInput_);
+    if (tlsContext_)
+    {
+        conn->startTls(tlsContext_);
+    }
 
-    // 设置了如何关闭连接的回调 conn => shutDown()
-    conn->setCloseCallback(
-        std::bind(&TcpServer::removeConnection, this, std::placeholders::_1)
-    );
-    
-    //直接调用TcpConnection::connectEstablished
-    ioLoop->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+    // 登记和建立连接都在ioLoop中完成，之后该连接的生命周期不再经过baseloop
+    ioLoop->runInLoop(std::bind(&TcpServer::connectionEstablishedInLoop, this, conn));
 }
 
-void TcpServer::removeConnection(const TcpConnectionPtr &conn)
+void TcpServer::connectionEstablishedInLoop(const TcpConnectionPtr &conn)
 {
-    loop_->runInLoop(
-        std::bind(&TcpServer::removeConnectionInLoop, this, conn)
-    );
+    ConnectionShardPtr shard = shardOf(conn->getLoop());
+    {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        shard->connections[conn->id()] = conn;
+    }
+    conn->connectEstablished();
 }
-void TcpServer::removeConnectionInLoop(const TcpConnectionPtr &conn)
+
+// 在连接所属的ioLoop中调用
+void TcpServer::removeConnection(const TcpConnectionPtr &conn)
 {
-    LOG_INFO("TcpServer::removeConnectionInLoop [%s] - connection %s \n",
-        name_.c_str(), conn->name().c_str());
+    LOG_INFO("TcpServer::removeConnection [%s] - connection [#%lu] \n",
+        name_.c_str(), conn->id());
 
-    connections_.erase(conn->name());
     EventLoop *ioLoop = conn->getLoop();
+    // 迁到了不属于本服务器的loop上的连接已经不在任何分片中
+    ConnectionShardPtr shard = findShard(ioLoop);
+    size_t erased = 0;
+    if (shard)
+    {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        erased = shard->connections.erase(conn->id());
+    }
+    // 迁移途中关闭的连接可能还登记在原来的分片上，由connectionMigrated计数
+    if (erased > 0)
+    {
+        connectionRemoved(shard);
+    }
+    // 当前还处在该连接channel的handleEvent中，销毁操作放到本轮循环的末尾
     ioLoop->queueInLoop(
         std::bind(&TcpConnection::connectDestroyed, conn)
     );
 }
+
+TcpServer::ConnectionShardPtr TcpServer::shardOf(EventLoop *loop) const
+{
+    ConnectionShardPtr shard = findShard(loop);
+    if (!shard)
+    {
+        LOG_FATAL("%s:%s:%d loop %p has no connection shard \n", __FILE__, __FUNCTION__, __LINE__, loop);
+    }
+    return shard;
+}
+
+// 不属于本服务器的loop返回空
+TcpServer::ConnectionShardPtr TcpServer::findShard(EventLoop *loop) const
+{
+    const ConnectionShardMap *shards = shards_.load(std::memory_order_acquire);
+    auto it = shards->find(loop);
+    return it == shards->end() ? ConnectionShardPtr() : it->second;
+}
+
+std::vector<TcpServer::ConnectionShardPtr> TcpServer::allShards() const
+{
+    const ConnectionShardMap *shards = shards_.load(std::memory_order_acquire);
+    std::vector<ConnectionShardPtr> result;
+    result.reserve(shards->size());
+    for (auto& item : *shards)
+    {
+        result.push_back(item.second);
+    }
+    return result;
+}
+
+void TcpServer::addShard(EventLoop *loop)
+{
+    std::unique_lock<std::mutex> lock(shardsMutex_);
+    const ConnectionShardMap *current = shards_.load(std::memory_order_relaxed);
+    if (current->count(loop) > 0)
+    {
+        return;
+    }
+    ConnectionShardMap *shards = new ConnectionShardMap(*current);
+    (*shards)[loop] = std::make_shared<ConnectionShard>();
+    publishShards(shards);
+}
+
+void TcpServer::removeShard(EventLoop *loop)
+{
+    std::unique_lock<std::mutex> lock(shardsMutex_);
+    ConnectionShardMap *shards = new ConnectionShardMap(*shards_.load(std::memory_order_relaxed));
+    shards->erase(loop);
+    publishShards(shards);
+}
+
+// 持有shardsMutex_时调用，接管shards
+void TcpServer::publishShards(ConnectionShardMap *shards)
+{
+    shardMaps_.emplace_back(shards);
+    shards_.store(shards, std::memory_order_release);
+}
+
+size_t TcpServer::numConnections() const
+{
+    size_t n = 0;
+    for (const ConnectionShardPtr &shard : allShards())
+    {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        n += shard->connections.size();
+    }
+    return n;
+}
+
+void TcpServer::forEachConnection(const ConnectionCallback &cb) const
+{
+    std::vector<TcpConnectionPtr> snapshot;
+    for (const ConnectionShardPtr &shard : allShards())
+    {
+        snapshot.clear();
+        {
+            std::unique_lock<std::mutex> lock(shard->mutex);
+            snapshot.reserve(shard->connections.size());
+            for (auto& item : shard->connections)
+            {
+                snapshot.push_back(item.second);
+            }
+        }
+        for (const TcpConnectionPtr &conn : snapshot)
+        {
+            cb(conn);
+        }
+    }
+}
+
+EventLoop* TcpServer::addLoop()
+{
+    EventLoop *ioLoop = threadPool_->addLoop();
+    addShard(ioLoop);
+    LOG_INFO("TcpServer::addLoop [%s] - loop %p \n", name_.c_str(), ioLoop);
+    return ioLoop;
+}
+
+bool TcpServer::removeLoop(EventLoop *loop)
+{
+    if (loop == loop_ || retiring_.count(loop) > 0)
+    {
+        return false;
+    }
+    if (!findShard(loop))
+    {
+        return false;
+    }
+    threadPool_->retireLoop(loop);
+    RetiringLoop &retiring = retiring_[loop];
+    retiring.emptySince = Timestamp();
+    retiring.waitingPinned = false;
+    LOG_INFO("TcpServer::removeLoop [%s] - loop %p \n", name_.c_str(), loop);
+    // 排在已经转交给它的新连接之后，这些连接登记完分片后也会被迁走
+    loop->queueInLoop(std::bind(&TcpServer::evacuateLoop, this, loop, threadPool_->getAllLoops()));
+    loop_->runAfter(0.1, std::bind(&TcpServer::checkRetired, this, loop));
+    return true;
+}
+
+// 在要移除的loop中执行
+void TcpServer::evacuateLoop(EventLoop *loop, const std::vector<EventLoop*> &targets)
+{
+    std::vector<TcpConnectionPtr> connections;
+    {
+        ConnectionShardPtr shard = shardOf(loop);
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        for (auto& item : shard->connections)
+        {
+            // 不能迁移的连接留在原地，checkRetired等它们关闭
+            if (item.second->migratable())
+            {
+                connections.push_back(item.second);
+            }
+        }
+    }
+    for (size_t i = 0; i < connections.size(); ++i)
+    {
+        migrateConnection(connections[i], targets[i % targets.size()]);
+    }
+}
+
+// 迁空之后再等一秒才停止线程：其他线程可能刚刚读到连接原来的loop，正要往里投递操作
+void TcpServer::checkRetired(EventLoop *loop)
+{
+    static const double kGraceSeconds = 1.0;
+    RetiringLoop &retiring = retiring_[loop];
+    Timestamp &emptySince = retiring.emptySince;
+    size_t left = 0;
+    size_t pinned = 0;
+    {
+        ConnectionShardPtr shard = shardOf(loop);
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        left = shard->connections.size();
+        for (auto& item : shard->connections)
+        {
+            if (!item.second->migratable())
+            {
+                ++pinned;
+            }
+        }
+    }
+    Timestamp now(Timestamp::now());
+    if (left > pinned)
+    {
+        // 迁移途中又有连接迁了进来
+        emptySince = Timestamp();
+        loop->queueInLoop(std::bind(&TcpServer::evacuateLoop, this, loop, threadPool_->getAllLoops()));
+    }
+    else if (left > 0)
+    {
+        // 只剩下不能迁移的连接，不再反复投递迁移，等它们关闭
+        emptySince = Timestamp();
+        if (!retiring.waitingPinned)
+        {
+            retiring.waitingPinned = true;
+            LOG_INFO("TcpServer::removeLoop [%s] - loop %p waiting for %lu pinned connections to close \n",
+                name_.c_str(), loop, left);
+        }
+    }
+    else if (!emptySince.valid())
+    {
+        emptySince = now;
+    }
+    else if (timeDifference(now, emptySince) >= kGraceSeconds)
+    {
+        threadPool_->removeLoop(loop);
+        removeShard(loop);
+        retiring_.erase(loop);
+        lastBusy_.erase(loop);
+        LOG_INFO("TcpServer::removeLoop [%s] - loop %p stopped \n", name_.c_str(), loop);
+        return;
+    }
+    loop_->runAfter(0.1, std::bind(&TcpServer::checkRetired, this, loop));
+}
+
+void TcpServer::migrateConnection(const TcpConnectionPtr &conn, EventLoop *loop)
+{
+    if (!findShard(loop))
+    {
+        LOG_ERROR("TcpServer::migrateConnection [%s] - loop %p does not belong to this server \n",
+            name_.c_str(), loop);
+        return;
+    }
+    conn->migrateTo(loop);
+}
+
+// 每次迁移完成后在新loop中、连接开始处理事件之前执行（见ConnectionCallbacks::migrated），
+// 把连接从原来的分片挪到新loop的分片
+void TcpServer::connectionMigrated(const TcpConnectionPtr &conn, EventLoop *from)
+{
+    ConnectionShardPtr source = findShard(from);
+    ConnectionShardPtr target = findShard(conn->getLoop());
+    size_t erased = 0;
+    if (source)
+    {
+        std::unique_lock<std::mutex> lock(source->mutex);
+        erased = source->connections.erase(conn->id());
+    }
+    if (erased > 0 && (conn->disconnected() || !target))
+    {
+        // 迁移途中已经关闭（removeConnection没有在原分片上找到它），
+        // 或者迁到了不属于本服务器的loop上，之后不再由本服务器登记和计数
+        if (!target)
+        {
+            LOG_INFO("TcpServer::connectionMigrated [%s] - connection [#%lu] left for loop %p \n",
+                name_.c_str(), conn->id(), conn->getLoop());
+        }
+        connectionRemoved(source);
+    }
+    else if (erased > 0)
+    {
+        source->load.fetch_sub(1, std::memory_order_relaxed);
+        target->load.fetch_add(1, std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lock(target->mutex);
+        target->connections[conn->id()] = conn;
+    }
+    migrations_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TcpServer::rebalance()
+{
+    Timestamp now(Timestamp::now());
+    double elapsed = timeDifference(now, lastRebalance_);
+    lastRebalance_ = now;
+
+    EventLoop *hottest = nullptr;
+    EventLoop *coldest = nullptr;
+    double hotBusy = 0, coldBusy = 0;
+    std::unordered_map<EventLoop*, int64_t> samples;
+    for (EventLoop *ioLoop : threadPool_->getAllLoops())
+    {
+        int64_t busy = ioLoop->busyMicroseconds();
+        samples[ioLoop] = busy;
+        auto it = lastBusy_.find(ioLoop);
+        if (it == lastBusy_.end() || ioLoop == loop_ || elapsed <= 0)
+        {
+            continue;   //新加入的loop下一次才有完整的取样
+        }
+        double ratio = (busy - it->second) / (elapsed * Timestamp::kMicroSecondsPerSecond);
+        if (hottest == nullptr || ratio > hotBusy)
+        {
+            hottest = ioLoop;
+            hotBusy = ratio;
+        }
+        if (coldest == nullptr || ratio < coldBusy)
+        {
+            coldest = ioLoop;
+            coldBusy = ratio;
+        }
+    }
+    lastBusy_.swap(samples);
+
+    if (hottest != coldest && hotBusy - coldBusy > rebalanceThreshold_)
+    {
+        LOG_INFO("TcpServer::rebalance [%s] - loop %p busy %.2f, loop %p busy %.2f \n",
+            name_.c_str(), hottest, hotBusy, coldest, coldBusy);
+        // 按读流量估计每个连接占的负载，迁走的部分不超过差值的一半
+        double maxShare = (hotBusy - coldBusy) / 2 / hotBusy;
+        hottest->queueInLoop(std::bind(&TcpServer::migrateHeaviest, this, hottest, coldest, maxShare));
+    }
+}
+
+// 在from中执行：各连接的读流量只能在所属loop中取样
+void TcpServer::migrateHeaviest(EventLoop *from, EventLoop *to, double maxShare)
+{
+    std::vector<TcpConnectionPtr> connections;
+    {
+        ConnectionShardPtr shard = shardOf(from);
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        for (auto& item : shard->connections)
+        {
+            connections.push_back(item.second);
+        }
+    }
+    std::vector<uint64_t> loads(connections.size());
+    uint64_t total = 0;
+    for (size_t i = 0; i < connections.size(); ++i)
+    {
+        // 已经迁走、还没有从本分片摘掉的连接不属于本线程；不能迁移的连接不参与挑选
+        if (connections[i]->getLoop() != from || !connections[i]->migratable())
+        {
+            loads[i] = 0;
+            continue;
+        }
+        loads[i] = connections[i]->takeLoadSample();
+        total += loads[i];
+    }
+    uint64_t limit = static_cast<uint64_t>(total * maxShare);
+    size_t best = connections.size();
+    for (size_t i = 0; i < connections.size(); ++i)
+    {
+        if (loads[i] > 0 && loads[i] <= limit && (best == connections.size() || loads[i] > loads[best]))
+        {
+            best = i;
+        }
+    }
+    if (best < connections.size())
+    {
+        migrateConnection(connections[best], to);
+    }
+}
+
+bool TcpServer::admits(const ConnectionShard &shard) const
+{
+    return shard.healthy.load(std::memory_order_relaxed)
+        && (maxConnectionsPerLoop_ == 0 || shard.load.load(std::memory_order_relaxed) < maxConnectionsPerLoop_);
+}
+
+// 在baseloop中执行：轮询到的loop已满或不健康时换下一个，所有loop都不能接纳时返回nullptr
+EventLoop* TcpServer::pickLoop(int sockfd)
+{
+    if (maxConnections_ > 0 && numConnections_.load(std::memory_order_relaxed) >= maxConnections_)
+    {
+        return nullptr;
+    }
+    if (placement_ == kIncomingCpu)
+    {
+        return pickLoopByCpu(sockfd);
+    }
+    EventLoop *ioLoop = threadPool_->getNextLoop();
+    if (maxConnectionsPerLoop_ == 0 && maxLagMs_ <= 0 && maxQueueSize_ == 0)
+    {
+        return ioLoop;
+    }
+    size_t tries = threadPool_->getAllLoops().size();
+    for (size_t i = 0; i < tries; ++i)
+    {
+        if (i > 0)
+        {
+            ioLoop = threadPool_->getNextLoop();
+        }
+        if (admits(*shardOf(ioLoop)))
+        {
+            return ioLoop;
+        }
+    }
+    return nullptr;
+}
+
+// 收包的软中断在哪个CPU上处理，连接的事件就交给那个CPU上的loop，
+// 协议栈刚刚处理过的socket数据还在这个CPU的缓存里；同样近的loop之间选连接最少的
+EventLoop* TcpServer::pickLoopByCpu(int sockfd)
+{
+    int cpu = -1;
+#ifdef SO_INCOMING_CPU
+    socklen_t len = sizeof cpu;
+    if (::getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0)
+    {
+        cpu = -1;
+    }
+#endif
+    const CpuTopology &topology = cpuTopology();
+    EventLoop *best = nullptr;
+    int bestDistance = CpuTopology::kFar;
+    size_t bestLoad = 0;
+    for (EventLoop *ioLoop : threadPool_->getAllLoops())
+    {
+        ConnectionShardPtr shard = shardOf(ioLoop);
+        if (!admits(*shard))
+        {
+            continue;
+        }
+        int distance = topology.distance(cpu, ioLoop->cpu());
+        size_t load = shard->load.load(std::memory_order_relaxed);
+        if (best == nullptr || distance < bestDistance || (distance == bestDistance && load < bestLoad))
+        {
+            best = ioLoop;
+            bestDistance = distance;
+            bestLoad = load;
+        }
+    }
+    if (best != nullptr)
+    {
+        if (bestDistance == 0)
+        {
+            placedSameCpu_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (bestDistance < CpuTopology::kFar)
+        {
+            placedNearCpu_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            placedFallback_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    return best;
+}
+
+TcpServer::PlacementStats TcpServer::placementStats() const
+{
+    PlacementStats stats;
+    stats.sameCpu = placedSameCpu_.load(std::memory_order_relaxed);
+    stats.nearCpu = placedNearCpu_.load(std::memory_order_relaxed);
+    stats.fallback = placedFallback_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void TcpServer::rejectConnection(int sockfd)
+{
+    if (!rejectMessage_.empty())
+    {
+        // 新连接的发送缓冲区是空的，一次非阻塞写就能写完；写不完也不再等，对端已经关闭时不产生SIGPIPE
+        ssize_t n = ::send(sockfd, rejectMessage_.data(), rejectMessage_.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        (void)n;
+    }
+    ::close(sockfd);
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 连接从分片中摘掉之后调用，可以在任意loop线程中执行
+void TcpServer::connectionRemoved(const ConnectionShardPtr &shard)
+{
+    shard->load.fetch_sub(1, std::memory_order_relaxed);
+    numConnections_.fetch_sub(1, std::memory_order_relaxed);
+    if (admissionState() == kFull)
+    {
+        loop_->queueInLoop(std::bind(&TcpServer::updateAdmission, this));
+    }
+}
+
+double TcpServer::loopLagMs(const ConnectionShard &shard, int64_t nowMicros) const
+{
+    int64_t lag = shard.lagMicros.load(std::memory_order_relaxed);
+    int64_t sent = shard.probeSent.load(std::memory_order_relaxed);
+    if (sent != 0 && nowMicros - sent > lag)
+    {
+        lag = nowMicros - sent;
+    }
+    return lag / 1000.0;
+}
+
+// 在baseloop中定时执行：根据探测延迟和回调队列长度更新各loop的健康状态，再投递下一次探测
+void TcpServer::checkHealth()
+{
+    int64_t now = Timestamp::now().microSecondsSinceEpoch();
+    bool anyHealthy = false;
+    std::vector<EventLoop*> unhealthy;
+    for (EventLoop *ioLoop : threadPool_->getAllLoops())
+    {
+        ConnectionShardPtr shard = shardOf(ioLoop);
+        double lagMs = loopLagMs(*shard, now);
+        size_t queued = ioLoop->queueSize();
+        bool healthy = shard->healthy.load(std::memory_order_relaxed);
+        if (healthy)
+        {
+            healthy = !((maxLagMs_ > 0 && lagMs > maxLagMs_) || (maxQueueSize_ > 0 && queued > maxQueueSize_));
+        }
+        else if ((maxLagMs_ <= 0 || lagMs < maxLagMs_ / 2) && (maxQueueSize_ == 0 || queued < maxQueueSize_ / 2))
+        {
+            healthy = ++shard->goodChecks >= kRecoverChecks;
+        }
+        else
+        {
+            shard->goodChecks = 0;
+        }
+        if (healthy != shard->healthy.load(std::memory_order_relaxed))
+        {
+            LOG_INFO("TcpServer::checkHealth [%s] - loop %p %s, lag %.1f ms, queue %lu \n",
+                name_.c_str(), ioLoop, healthy ? "recovered" : "unhealthy", lagMs, queued);
+            shard->healthy.store(healthy, std::memory_order_relaxed);
+            shard->goodChecks = 0;
+        }
+        if (healthy)
+        {
+            anyHealthy = true;
+        }
+        else
+        {
+            unhealthy.push_back(ioLoop);
+        }
+
+        // 上一次的探测还没执行时不再投递，避免在过载的loop上越积越多
+        if (shard->probeSent.load(std::memory_order_relaxed) == 0)
+        {
+            shard->probeSent.store(now, std::memory_order_relaxed);
+            ioLoop->queueInLoop([shard, now]() {
+                shard->lagMicros.store(Timestamp::now().microSecondsSinceEpoch() - now, std::memory_order_relaxed);
+                shard->probeSent.store(0, std::memory_order_relaxed);
+            });
+        }
+    }
+    overloaded_ = !anyHealthy;
+    updateAdmission();
+    if (overloaded_ && (shedActions_ & kShedCloseIdle))
+    {
+        for (EventLoop *ioLoop : unhealthy)
+        {
+            ioLoop->queueInLoop(std::bind(&TcpServer::shedIdle, this, ioLoop));
+        }
+    }
+}
+
+// 在baseloop中执行
+void TcpServer::updateAdmission()
+{
+    AdmissionState state = kAdmitting;
+    if (overloaded_)
+    {
+        state = kOverloaded;
+    }
+    else if (maxConnections_ > 0 && numConnections_.load(std::memory_order_relaxed) >= maxConnections_)
+    {
+        state = kFull;
+    }
+    else if (maxConnectionsPerLoop_ > 0)
+    {
+        state = kFull;
+        for (EventLoop *ioLoop : threadPool_->getAllLoops())
+        {
+            if (shardOf(ioLoop)->load.load(std::memory_order_relaxed) < maxConnectionsPerLoop_)
+            {
+                state = kAdmitting;
+                break;
+            }
+        }
+    }
+    if (state == admissionState())
+    {
+        return;
+    }
+    static const char *names[] = { "admitting", "full", "overloaded" };
+    LOG_INFO("TcpServer::updateAdmission [%s] - %s, %lu connections, %lu rejected \n",
+        name_.c_str(), names[state], numConnections_.load(), rejected_.load());
+    admissionState_.store(state, std::memory_order_relaxed);
+    if (shedActions_ & kShedPauseAccept)
+    {
+        if (state == kAdmitting)
+        {
+            acceptor_->resume();
+        }
+        else
+        {
+            acceptor_->pause();
+        }
+    }
+    if (admissionCallback_)
+    {
+        admissionCallback_(state);
+    }
+}
+
+// 在过载的loop中执行：关闭最新建立的一批空闲连接（最近shedIdleSeconds_秒没有读到数据，也没有待发送的数据），
+// 新连接还没有积累状态，关掉它们对客户端的影响最小
+void TcpServer::shedIdle(EventLoop *loop)
+{
+    if (admissionState() != kOverloaded)
+    {
+        return;
+    }
+    std::vector<TcpConnectionPtr> connections;
+    {
+        ConnectionShardPtr shard = shardOf(loop);
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        connections.reserve(shard->connections.size());
+        for (auto& item : shard->connections)
+        {
+            connections.push_back(item.second);
+        }
+    }
+    size_t quota = std::max<size_t>(1, connections.size() / 100);
+    Timestamp now(Timestamp::now());
+    std::vector<TcpConnectionPtr> idle;
+    for (const TcpConnectionPtr &conn : connections)
+    {
+        if (conn->getLoop() == loop && conn->connected() && conn->outputBytes() == 0
+            && timeDifference(now, conn->lastReceiveTime()) >= shedIdleSeconds_)
+        {
+            idle.push_back(conn);
+        }
+    }
+    quota = std::min(quota, idle.size());
+    std::partial_sort(idle.begin(), idle.begin() + quota, idle.end(),
+        [](const TcpConnectionPtr &a, const TcpConnectionPtr &b) { return a->id() > b->id(); });
+    for (size_t i = 0; i < quota; ++i)
+    {
+        idle[i]->forceClose();
+    }
+    if (quota > 0)
+    {
+        shed_.fetch_add(quota, std::memory_order_relaxed);
+        LOG_INFO("TcpServer::shedIdle [%s] - closed %lu idle connections on loop %p \n",
+            name_.c_str(), quota, loop);
+    }
+}
+
+std::vector<TcpServer::LoopHealth> TcpServer::loopHealth() const
+{
+    std::vector<LoopHealth> health;
+    int64_t now = Timestamp::now().microSecondsSinceEpoch();
+    const ConnectionShardMap *shards = shards_.load(std::memory_order_acquire);
+    for (auto& item : *shards)
+    {
+        const ConnectionShard &shard = *item.second;
+        LoopHealth h;
+        h.loop = item.first;
+        h.connections = shard.load.load(std::memory_order_relaxed);
+        h.queueSize = item.first->queueSize();
+        h.lagMs = loopLagMs(shard, now);
+        h.healthy = shard.healthy.load(std::memory_order_relaxed);
+        health.push_back(h);
+    }
+    return health;
+}
@@ -9,12 +9,15 @@
 #include "EventLoopThreadPool.h"
 #include "Callbacks.h"
 #include "TcpConnection.h"
+#include "TlsContext.h"
 
 #include <functional>
 #include <string>
 #include <memory>
 #include <atomic>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
 //对外的服务器编程使用的类
 class TcpServer : noncopyable
@@ -28,30 +31,193 @@ public:
         kReusePort,
     };
 
+    // 准入状态：kFull 达到连接数上限，kOverloaded 所有loop都不健康（见setOverloadThresholds）
+    enum AdmissionState
+    {
+        kAdmitting,
+        kFull,
+        kOverloaded,
+    };
+    using AdmissionCallback = std::function<void(AdmissionState)>;
+
+    // 不接纳新连接时的处理方式，可以组合
+    enum ShedAction
+    {
+        kShedPauseAccept = 1,   //暂停accept，连接留在内核监听队列中，队列满后客户端的SYN被丢弃
+        kShedReject = 2,        //accept后立即关闭，关闭前尽量写出一条拒绝消息；和kShedPauseAccept同时设置时暂停优先
+                                //没有设置时已经accept的连接超出上限也照常接纳
+        kShedCloseIdle = 4,     //过载时每次检查关闭不健康loop上最新的一批空闲连接
+    };
+
+    // 新连接分配到哪个loop
+    enum Placement
+    {
+        kRoundRobin,
+        // 用SO_INCOMING_CPU取得处理该连接收包的CPU，分给绑定在这个CPU上的loop（见setThreadCpus），
+        // 没有时依次找同一物理核、同一封装上的loop，都没有时分给连接最少的loop
+        kIncomingCpu,
+    };
+
+    // 按接收CPU分配的结果计数：落在同一个CPU、落在相邻CPU（同一物理核或同一封装）、退回到最少连接
+    struct PlacementStats
+    {
+        uint64_t sameCpu;
+        uint64_t nearCpu;
+        uint64_t fallback;
+    };
+
+    // 一个loop的健康状况，见loopHealth
+    struct LoopHealth
+    {
+        EventLoop *loop;
+        size_t connections;     //包括已经分配还没有建立完成的
+        size_t queueSize;       //EventLoop::queueSize
+        double lagMs;           //最近一次探测回调从投递到执行的延迟，还没执行完的探测按已经等待的时间算
+        bool healthy;
+    };
+
     TcpServer(EventLoop* loop, 
                 const InetAddress &listenAddr,
                 const std::string nameArg, 
                 Option option = kNoReusePort);
+    // 在已有的监听fd上提供服务，见Acceptor::createListenSocket和HotRestart
+    TcpServer(EventLoop* loop, int listenFd, const std::string nameArg);
     ~TcpServer();
 
     //设置底层subloop的个数
     void setThreadNum(int numThreads);
+    // 在start之前调用：subloop线程依次绑定到这些CPU上，见EventLoopThreadPool::setThreadCpus
+    void setThreadCpus(const std::vector<int> &cpus) { threadPool_->setThreadCpus(cpus); }
+    // 在start之前调用，默认kRoundRobin
+    void setPlacement(Placement placement) { placement_ = placement; }
+    // 线程安全
+    PlacementStats placementStats() const;
 
     //回调函数
     void setThreadInitCallback(const ThreadInitCallback &cb) { threadInitCallback_ = cb; }
-    void setConnectionCallback(const ConnectionCallback &cb) { connectionCallback_ = cb; }
-    void setMessageCallback(const MessageCallback &cb) { messageCallback_ = cb; }
-    void setWriteCompleteCallback(const WriteCompleteCallback &cb) { writeCompleteCallback_ = cb; }
+    void setConnectionCallback(const ConnectionCallback &cb) { connectionCallback_ = cb; connCallbacks_.reset(); }
+    void setMessageCallback(const MessageCallback &cb) { messageCallback_ = cb; connCallbacks_.reset(); }
+    void setWriteCompleteCallback(const WriteCompleteCallback &cb)
+        { writeCompleteCallback_ = cb; connCallbacks_.reset(); }
+    void setHighWaterMarkCallback(const HighWaterMarkCallback &cb, size_t highWaterMark)
+        { highWaterMarkCallback_ = cb; highWaterMark_ = highWaterMark; connCallbacks_.reset(); }
+
+    // 新连接开启背压：outputBuffer_超过highWaterMark暂停读，回落到lowWaterMark恢复读
+    // 水位和setHighWaterMarkCallback的水位互不影响
+    void setFlowControl(size_t highWaterMark, size_t lowWaterMark)
+        { flowControl_ = true; flowHighWaterMark_ = highWaterMark; flowLowWaterMark_ = lowWaterMark; }
+    // 新连接设置TCP_NOTSENT_LOWAT，0表示不设置；只对IPv4/IPv6连接生效
+    void setTcpNotSentLowat(int bytes) { notSentLowat_ = bytes; }
+    // 新连接开启MSG_ZEROCOPY，send(std::string&&)不小于threshold字节时零拷贝发送，0表示不开启
+    void setZeroCopyThreshold(size_t threshold) { zeroCopyThreshold_ = threshold; }
+    // 新连接开启合并写，见TcpConnection::setCork
+    void setCork(bool on) { cork_ = on; }
+    // 新连接的读缓冲选项，见TcpConnection::setFionread和setPooledInput
+    void setFionread(bool on) { fionread_ = on; }
+    void setPooledInput(bool on) { pooledInput_ = on; }
+    // 设置后所有新连接都走TLS，见TlsContext::newServerContext
+    void setTlsContext(const std::shared_ptr<TlsContext> &ctx) { tlsContext_ = ctx; }
     
     //开启服务器监听
     void start();
 
+    // 优雅退出：停止accept，等待已有连接关闭；超过timeoutSeconds还没关闭的连接被强制关闭
+    // 所有连接都关闭后在baseloop中回调done，一般用来loop->quit()
+    void drain(double timeoutSeconds, const std::function<void()> &done);
+
+    const std::string& name() const { return name_; }
+    const std::string& ipPort() const { return ipPort_; }
+
+    // 运行中增减subloop，只能在baseloop线程中调用，见EventLoopThreadPool::addLoop
+    EventLoop* addLoop();
+    // 移除subloop：不再给它分配新连接，把它上面的连接迁移到其他loop，迁空之后再停止线程
+    // 没有其他subloop时连接迁回baseloop；loop不是本服务器的subloop时返回false
+    // 不能迁移的连接（见TcpConnection::setMigratable）留在原loop上，等它们都关闭后才停止线程
+    bool removeLoop(EventLoop *loop);
+    // 把连接迁移到本服务器的另一个loop（subloop或baseloop），可以在任意线程调用，见TcpConnection::migrateTo
+    // 直接调用conn->migrateTo迁移的连接同样会挪到新loop的分片；迁到不属于本服务器的loop后不再由本服务器登记和计数
+    void migrateConnection(const TcpConnectionPtr &conn, EventLoop *loop);
+    // 在start之前调用，开启负载均衡：每interval秒比较各subloop的忙碌比例（见EventLoop::busyMicroseconds），
+    // 最忙和最闲的相差超过threshold（0~1）时，从最忙的loop迁一个连接到最闲的loop，
+    // 挑选的是读流量不超过两者差值一半的连接中最大的一个，迁移后不会反过来变得更不均衡
+    void setRebalance(double interval, double threshold)
+        { rebalanceInterval_ = interval; rebalanceThreshold_ = threshold; }
+    // 已经完成的连接迁移次数，线程安全
+    uint64_t migrations() const { return migrations_.load(std::memory_order_relaxed); }
+
+    // 准入控制，在start之前设置，0表示不限制
+    // 连接总数上限和每个loop的连接数上限：新连接轮询到已满的loop时换下一个，全部已满时按ShedAction处理
+    void setMaxConnections(size_t maxConnections) { maxConnections_ = maxConnections; }
+    void setMaxConnectionsPerLoop(size_t maxConnections) { maxConnectionsPerLoop_ = maxConnections; }
+    // 开启loop健康检查：baseloop每100ms向各loop投递一个探测回调，回调的排队延迟超过maxLagMs
+    // 或loop的回调队列超过maxQueueSize时该loop不健康，不再给它分配新连接；
+    // 两项连续0.5秒都在一半以下才恢复，偶尔的卡顿不会让准入状态来回切换
+    // 所有loop都不健康时进入kOverloaded
+    void setOverloadThresholds(double maxLagMs, size_t maxQueueSize)
+        { maxLagMs_ = maxLagMs; maxQueueSize_ = maxQueueSize; }
+    // 不接纳时的处理方式（ShedAction按位组合，默认kShedReject），rejectMessage是拒绝时写给客户端的消息，
+    // 例如"HTTP/1.1 503 Service Unavailable\r\n\r\n"；idleSeconds是kShedCloseIdle判断空闲的时长
+    void setShedPolicy(int actions, const std::string &rejectMessage = std::string(), double idleSeconds = 1.0)
+        { shedActions_ = actions; rejectMessage_ = rejectMessage; shedIdleSeconds_ = idleSeconds; }
+    // 准入状态变化时在baseloop中回调，可以用来让负载均衡的健康检查失败，把流量导走
+    void setAdmissionCallback(const AdmissionCallback &cb) { admissionCallback_ = cb; }
+
+    // 以下线程安全
+    AdmissionState admissionState() const { return admissionState_.load(std::memory_order_relaxed); }
+    uint64_t rejectedConnections() const { return rejected_.load(std::memory_order_relaxed); }
+    uint64_t shedConnections() const { return shed_.load(std::memory_order_relaxed); }
+    std::vector<LoopHealth> loopHealth() const;
+
+    // 当前连接总数，线程安全
+    size_t numConnections() const;
+    // 遍历所有连接（管理任务用），线程安全；cb在调用线程中执行，不持有任何分片锁
+    void forEachConnection(const ConnectionCallback &cb) const;
+
 private:
-    using ConnectionMap = std::unordered_map<std::string, TcpConnectionPtr>;
+    // 每个subloop一个连接分片，连接的建立和销毁都只在所属loop线程中修改分片
+    struct ConnectionShard
+    {
+        ConnectionShard() : load(0), probeSent(0), lagMicros(0), healthy(true), goodChecks(0) {}
+
+        mutable std::mutex mutex;   //只在管理任务遍历时才会有竞争
+        std::unordered_map<uint64_t, TcpConnectionPtr> connections;
+        // connections的大小加上已经分配给本loop、还没有登记的连接，准入控制用
+        std::atomic<size_t> load;
+        // 健康检查：还没有执行的探测的投递时间（0表示没有），最近一次完成的探测的延迟
+        std::atomic<int64_t> probeSent;
+        std::atomic<int64_t> lagMicros;
+        std::atomic<bool> healthy;
+        int goodChecks;     //不健康之后连续达标的检查次数，只在baseloop中访问
+    };
+    using ConnectionShardPtr = std::shared_ptr<ConnectionShard>;
+    using ConnectionShardMap = std::unordered_map<EventLoop*, ConnectionShardPtr>;
 
     void newConnection(int sockfd, const InetAddress &peerAddr);
+    void connectionEstablishedInLoop(const TcpConnectionPtr &conn);
     void removeConnection(const TcpConnectionPtr &conn);
-    void removeConnectionInLoop(const TcpConnectionPtr &conn);
+    ConnectionShardPtr shardOf(EventLoop *loop) const;
+    ConnectionShardPtr findShard(EventLoop *loop) const;
+    std::vector<ConnectionShardPtr> allShards() const;
+    void addShard(EventLoop *loop);
+    void removeShard(EventLoop *loop);
+    void publishShards(ConnectionShardMap *shards);
+    void connectionMigrated(const TcpConnectionPtr &conn, EventLoop *from);
+    void evacuateLoop(EventLoop *loop, const std::vector<EventLoop*> &targets);
+    void checkRetired(EventLoop *loop);
+    void rebalance();
+    void migrateHeaviest(EventLoop *from, EventLoop *to, double maxShare);
+    EventLoop* pickLoop(int sockfd);
+    EventLoop* pickLoopByCpu(int sockfd);
+    bool admits(const ConnectionShard &shard) const;
+    void rejectConnection(int sockfd);
+    void connectionRemoved(const ConnectionShardPtr &shard);
+    void checkHealth();
+    double loopLagMs(const ConnectionShard &shard, int64_t nowMicros) const;
+    void updateAdmission();
+    void shedIdle(EventLoop *loop);
+    TcpServer(EventLoop* loop, Acceptor *acceptor, const std::string &ipPort, const std::string &nameArg);
+    void drainInLoop(double timeoutSeconds, const std::function<void()> &done);
+    void checkDrained();
 
     EventLoop *loop_; // baseloop 用户定义的loop
     const std::string ipPort_;
@@ -62,11 +228,71 @@ private:
     ConnectionCallback connectionCallback_; //有新连接时的回调
     MessageCallback messageCallback_;       //有读写消息时的回调
     WriteCompleteCallback writeCompleteCallback_;   //信息发送完成后的回调
+    HighWaterMarkCallback highWaterMarkCallback_;   //发送缓冲区超过高水位的回调
+    // 上面几个回调打包成一份，所有新连接共享；修改回调后置空，下一个新连接到来时重新打包
+    ConnectionCallbacksPtr connCallbacks_;
+
+    size_t highWaterMark_;      //highWaterMarkCallback_的水位
+    size_t flowHighWaterMark_;  //背压的高低水位
+    size_t flowLowWaterMark_;
+    bool flowControl_;
+    int notSentLowat_;
+    size_t zeroCopyThreshold_;
+    bool cork_;
+    bool fionread_;
+    bool pooledInput_;
+    std::shared_ptr<TlsContext> tlsContext_;
 
     ThreadInitCallback threadInitCallback_; //loop线程初始化的回调
     std::atomic_int started_;
 
-    int nextConnId_;
-    ConnectionMap connections_; //保存所有的连接
+    uint64_t nextConnId_;    //只在baseloop中递增
+    std::shared_ptr<const std::string> connNamePrefix_;  //"name-ip:port"，所有连接共享
+    // loop到分片的映射，连接建立和销毁时无锁读取：增减loop时复制一份修改后整体替换，
+    // 替换下来的旧映射可能还有线程在读，保留到析构时再释放，增减loop很少，占用可以忽略
+    std::atomic<const ConnectionShardMap*> shards_;
+    std::vector<std::unique_ptr<const ConnectionShardMap>> shardMaps_;  //发布过的所有映射，由shardsMutex_保护
+    std::mutex shardsMutex_;    //只用来串行化增减loop
+    std::atomic<uint64_t> migrations_;
+
+    // 移除中的loop，只在baseloop中访问
+    struct RetiringLoop
+    {
+        Timestamp emptySince;   //连接全部迁走或关闭的时间点，还没空时无效
+        bool waitingPinned;     //只剩下不能迁移的连接，已经打印过日志
+    };
+    std::unordered_map<EventLoop*, RetiringLoop> retiring_;
+
+    // 负载均衡的状态，只在baseloop中访问
+    double rebalanceInterval_;
+    double rebalanceThreshold_;
+    Timestamp lastRebalance_;
+    std::unordered_map<EventLoop*, int64_t> lastBusy_;  //上一次取样时各loop的busyMicroseconds
+
+    // 准入控制的配置在start之前设置，状态只在baseloop中修改
+    size_t maxConnections_;
+    size_t maxConnectionsPerLoop_;
+    double maxLagMs_;
+    size_t maxQueueSize_;
+    int shedActions_;
+    std::string rejectMessage_;
+    double shedIdleSeconds_;
+    AdmissionCallback admissionCallback_;
+    bool overloaded_;
+    std::atomic<AdmissionState> admissionState_;
+    std::atomic<size_t> numConnections_;    //包括已经分配还没有登记的连接
+    std::atomic<uint64_t> rejected_;
+    std::atomic<uint64_t> shed_;
+
+    Placement placement_;
+    std::atomic<uint64_t> placedSameCpu_;
+    std::atomic<uint64_t> placedNearCpu_;
+    std::atomic<uint64_t> placedFallback_;
+
+    // 优雅退出的状态，只在baseloop中访问
+    bool draining_;
+    Timestamp drainDeadline_;
+    TimerId drainTimer_;
+    std::function<void()> drainCallback_;
 };
 
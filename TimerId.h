@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+class Timer;
+
+// 用户持有的定时器标识，只用于EventLoop::cancel
+class TimerId
+{
+public:
+    TimerId()
+        : timer_(nullptr),
+        sequence_(0)
+    {}
+
+    TimerId(Timer *timer, int64_t seq)
+        : timer_(timer),
+        sequence_(seq)
+    {}
+
+    friend class TimerQueue;
+
+private:
+    Timer *timer_;
+    int64_t sequence_;
+};
@@ -0,0 +1,405 @@
+#include "TlsContext.h"
+#include "Buffer.h"
+#include "logger.h"
+
+#include <errno.h>
+
+#ifdef MYMUDUO_WITH_OPENSSL
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+static void logSslError(const char *what)
+{
+    unsigned long err = ERR_get_error();
+    char errbuf[256] = {0};
+    ERR_error_string_n(err, errbuf, sizeof errbuf);
+    LOG_ERROR("%s : %s \n", what, errbuf);
+}
+
+// 客户端校验服务端的主机名：IP地址匹配证书的IP SAN，域名同时作为SNI发送（SNI不能是IP地址）
+// 证书不匹配时SSL_do_handshake失败，所以无论上下文是否配置了CA都要求校验证书
+static bool setHostname(SSL *ssl, const std::string &hostname)
+{
+    X509_VERIFY_PARAM *param = SSL_get0_param(ssl);
+    if (X509_VERIFY_PARAM_set1_ip_asc(param, hostname.c_str()) != 1)
+    {
+        ERR_clear_error();
+        if (SSL_set_tlsext_host_name(ssl, hostname.c_str()) != 1)
+        {
+            logSslError("TlsSession SNI");
+            return false;
+        }
+        X509_VERIFY_PARAM_set_hostflags(param, X509_CHECK_FLAG_NO_PARTIAL_WILDCARDS);
+        if (SSL_set1_host(ssl, hostname.c_str()) != 1)
+        {
+            logSslError("TlsSession hostname");
+            return false;
+        }
+    }
+    SSL_set_verify(ssl, SSL_VERIFY_PEER, nullptr);
+    return true;
+}
+
+// 客户端收到新的session（TLS1.3在握手之后才下发ticket），按主机名和端口缓存起来
+static int newSessionCallback(SSL *ssl, SSL_SESSION *session)
+{
+    TlsSession *tls = static_cast<TlsSession*>(SSL_get_app_data(ssl));
+    if (tls)
+    {
+        tls->onNewSession(session);
+        return 1;   //session的引用交给了缓存
+    }
+    return 0;
+}
+
+std::shared_ptr<TlsContext> TlsContext::newServerContext(const std::string &certFile,
+                                                         const std::string &keyFile)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == nullptr)
+    {
+        logSslError("SSL_CTX_new");
+        return nullptr;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx, certFile.c_str()) != 1
+        || SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(ctx) != 1)
+    {
+        logSslError("TlsContext load certificate");
+        SSL_CTX_free(ctx);
+        return nullptr;
+    }
+
+    // 服务端会话缓存，配合TLS1.3 ticket完成会话复用
+    static const unsigned char kSessionIdContext[] = "mymuduo";
+    SSL_CTX_set_session_id_context(ctx, kSessionIdContext, sizeof kSessionIdContext - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+
+    std::shared_ptr<TlsContext> context(new TlsContext(ctx, true));
+    context->setSessionCacheSize(context->sessionCacheSize_);
+    context->setKtls(true);
+    return context;
+}
+
+std::shared_ptr<TlsContext> TlsContext::newClientContext(const std::string &caFile)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == nullptr)
+    {
+        logSslError("SSL_CTX_new");
+        return nullptr;
+    }
+    if (!caFile.empty())
+    {
+        if (SSL_CTX_load_verify_locations(ctx, caFile.c_str(), nullptr) != 1)
+        {
+            logSslError("TlsContext load ca");
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+    else if (SSL_CTX_set_default_verify_paths(ctx) != 1)
+    {
+        // 只有指定了hostname的连接才会用到默认CA，加载失败不影响不校验的连接
+        logSslError("TlsContext default verify paths");
+    }
+
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, newSessionCallback);
+
+    std::shared_ptr<TlsContext> context(new TlsContext(ctx, false));
+    context->setKtls(true);
+    return context;
+}
+
+TlsContext::TlsContext(void *ctx, bool server)
+    : ctx_(ctx),
+    server_(server),
+    sessionCacheSize_(20480)
+{
+    SSL_CTX_set_mode(static_cast<SSL_CTX*>(ctx_),
+        SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    // 对端不发close_notify直接关闭连接时，按普通的连接关闭处理
+    SSL_CTX_set_options(static_cast<SSL_CTX*>(ctx_), SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+}
+
+TlsContext::~TlsContext()
+{
+    for (auto &item : sessions_)
+    {
+        SSL_SESSION_free(static_cast<SSL_SESSION*>(item.second));
+    }
+    SSL_CTX_free(static_cast<SSL_CTX*>(ctx_));
+}
+
+void TlsContext::setSessionCacheSize(long size)
+{
+    sessionCacheSize_ = size;
+    if (server_)
+    {
+        SSL_CTX_sess_set_cache_size(static_cast<SSL_CTX*>(ctx_), size);
+    }
+}
+
+void TlsContext::setKtls(bool on)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    if (on)
+    {
+        SSL_CTX_set_options(static_cast<SSL_CTX*>(ctx_), SSL_OP_ENABLE_KTLS);
+    }
+    else
+    {
+        SSL_CTX_clear_options(static_cast<SSL_CTX*>(ctx_), SSL_OP_ENABLE_KTLS);
+    }
+#else
+    if (on)
+    {
+        LOG_INFO("TlsContext::setKtls - OpenSSL built without kTLS support \n");
+    }
+#endif
+}
+
+void TlsContext::saveSession(const std::string &peer, void *session)
+{
+    void *old = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = sessions_.find(peer);
+        if (it != sessions_.end())
+        {
+            old = it->second;
+            it->second = session;
+        }
+        else
+        {
+            if (static_cast<long>(sessions_.size()) >= sessionCacheSize_ && !sessions_.empty())
+            {
+                old = sessions_.begin()->second;
+                sessions_.erase(sessions_.begin());
+            }
+            sessions_[peer] = session;
+        }
+    }
+    if (old)
+    {
+        SSL_SESSION_free(static_cast<SSL_SESSION*>(old));
+    }
+}
+
+void* TlsContext::takeSession(const std::string &peer)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = sessions_.find(peer);
+    if (it == sessions_.end())
+    {
+        return nullptr;
+    }
+    void *session = it->second;
+    sessions_.erase(it);
+    return session;
+}
+
+TlsSession::TlsSession(const std::shared_ptr<TlsContext> &ctx, int sockfd, const std::string &peer,
+                       const std::string &hostname)
+    : context_(ctx),
+    ssl_(SSL_new(static_cast<SSL_CTX*>(ctx->nativeHandle()))),
+    peer_(peer),
+    handshakeDone_(false),
+    ktlsSend_(false)
+{
+    SSL *ssl = static_cast<SSL*>(ssl_);
+    if (ssl == nullptr)
+    {
+        logSslError("SSL_new");
+        return;
+    }
+    SSL_set_fd(ssl, sockfd);
+    SSL_set_app_data(ssl, this);
+    if (context_->isServer())
+    {
+        SSL_set_accept_state(ssl);
+    }
+    else
+    {
+        SSL_set_connect_state(ssl);
+        if (!hostname.empty() && !setHostname(ssl, hostname))
+        {
+            // 设置失败时不能握手，否则会在没有校验主机名的情况下建立连接
+            SSL_free(ssl);
+            ssl_ = nullptr;
+            return;
+        }
+        SSL_SESSION *session = static_cast<SSL_SESSION*>(context_->takeSession(peer_));
+        if (session)
+        {
+            SSL_set_session(ssl, session);
+            SSL_SESSION_free(session);
+        }
+    }
+}
+
+TlsSession::~TlsSession()
+{
+    if (ssl_)
+    {
+        SSL_free(static_cast<SSL*>(ssl_));
+    }
+}
+
+TlsSession::Result TlsSession::toResult(int ret)
+{
+    int err = SSL_get_error(static_cast<SSL*>(ssl_), ret);
+    switch (err)
+    {
+    case SSL_ERROR_WANT_READ:
+        return kWantRead;
+    case SSL_ERROR_WANT_WRITE:
+        return kWantWrite;
+    case SSL_ERROR_ZERO_RETURN:
+        return kClosed;
+    case SSL_ERROR_SYSCALL:
+        if (ERR_peek_error() == 0 && (ret == 0 || errno == 0))
+        {
+            return kClosed;   //对端没有发close_notify就关闭了连接
+        }
+        LOG_ERROR("TlsSession SSL_ERROR_SYSCALL errno : %d \n", errno);
+        ERR_clear_error();
+        return kError;
+    default:
+        LOG_ERROR("TlsSession SSL_get_error : %d \n", err);
+        logSslError("TlsSession");
+        return kError;
+    }
+}
+
+TlsSession::Result TlsSession::handshake()
+{
+    if (ssl_ == nullptr)
+    {
+        return kError;
+    }
+    SSL *ssl = static_cast<SSL*>(ssl_);
+    int ret = SSL_do_handshake(ssl);
+    if (ret != 1)
+    {
+        return toResult(ret);
+    }
+    handshakeDone_ = true;
+    ktlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl)) == 1;
+    LOG_INFO("TlsSession handshake done fd = %d %s reused = %d ktls send = %d \n",
+        SSL_get_fd(ssl), SSL_get_cipher_name(ssl), SSL_session_reused(ssl), ktlsSend_);
+    return kOk;
+}
+
+bool TlsSession::sessionReused() const
+{
+    return ssl_ && SSL_session_reused(static_cast<SSL*>(ssl_)) == 1;
+}
+
+void TlsSession::onNewSession(void *session)
+{
+    if (!peer_.empty())
+    {
+        context_->saveSession(peer_, session);
+    }
+    else
+    {
+        SSL_SESSION_free(static_cast<SSL_SESSION*>(session));
+    }
+}
+
+// LT模式下SSL内部可能还缓存着已解密的记录，需要一直读到WANT_READ为止
+ssize_t TlsSession::read(Buffer *buf, Result *result)
+{
+    SSL *ssl = static_cast<SSL*>(ssl_);
+    ssize_t total = 0;
+    for (;;)
+    {
+        buf->ensureWriteableBytes(16 * 1024);
+        int n = SSL_read(ssl, buf->beginWrite(), static_cast<int>(buf->writableBytes()));
+        if (n > 0)
+        {
+            buf->hasWritten(n);
+            total += n;
+            continue;
+        }
+        *result = toResult(n);
+        if (*result == kClosed)
+        {
+            // 对端不发close_notify直接断开时OpenSSL会清掉已经发送close_notify的标记，
+            // SSL_free把这样的连接当作异常断开并丢弃它的session，客户端缓存的session就无法复用
+            SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        }
+        if (total > 0 && *result != kError)
+        {
+            *result = kOk;
+        }
+        return total;
+    }
+}
+
+ssize_t TlsSession::write(const void *data, size_t len, Result *result)
+{
+    int n = SSL_write(static_cast<SSL*>(ssl_), data, static_cast<int>(len));
+    if (n > 0)
+    {
+        *result = kOk;
+        return n;
+    }
+    *result = toResult(n);
+    return -1;
+}
+
+void TlsSession::shutdown()
+{
+    if (ssl_ && handshakeDone_)
+    {
+        SSL_shutdown(static_cast<SSL*>(ssl_));
+    }
+}
+
+#else   // MYMUDUO_WITH_OPENSSL
+
+std::shared_ptr<TlsContext> TlsContext::newServerContext(const std::string&, const std::string&)
+{
+    LOG_ERROR("TlsContext - mymuduo built without OpenSSL (MYMUDUO_WITH_OPENSSL=OFF) \n");
+    return nullptr;
+}
+
+std::shared_ptr<TlsContext> TlsContext::newClientContext(const std::string&)
+{
+    LOG_ERROR("TlsContext - mymuduo built without OpenSSL (MYMUDUO_WITH_OPENSSL=OFF) \n");
+    return nullptr;
+}
+
+TlsContext::TlsContext(void *ctx, bool server)
+    : ctx_(ctx), server_(server), sessionCacheSize_(0)
+{}
+
+TlsContext::~TlsContext() {}
+void TlsContext::setSessionCacheSize(long size) { sessionCacheSize_ = size; }
+void TlsContext::setKtls(bool) {}
+void TlsContext::saveSession(const std::string&, void*) {}
+void* TlsContext::takeSession(const std::string&) { return nullptr; }
+
+TlsSession::TlsSession(const std::shared_ptr<TlsContext> &ctx, int, const std::string &peer,
+                       const std::string&)
+    : context_(ctx), ssl_(nullptr), peer_(peer), handshakeDone_(false), ktlsSend_(false)
+{}
+
+TlsSession::~TlsSession() {}
+TlsSession::Result TlsSession::toResult(int) { return kError; }
+TlsSession::Result TlsSession::handshake() { return kError; }
+bool TlsSession::sessionReused() const { return false; }
+void TlsSession::onNewSession(void*) {}
+ssize_t TlsSession::read(Buffer*, Result *result) { *result = kError; return -1; }
+ssize_t TlsSession::write(const void*, size_t, Result *result) { *result = kError; return -1; }
+void TlsSession::shutdown() {}
+
+#endif  // MYMUDUO_WITH_OPENSSL
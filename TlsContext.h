@@ -0,0 +1,94 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+class Buffer;
+
+// TLS上下文，封装OpenSSL的SSL_CTX，一个TcpServer的所有连接共享一个
+// 头文件不依赖OpenSSL，编译时未开启MYMUDUO_WITH_OPENSSL则工厂函数返回nullptr
+class TlsContext : noncopyable
+{
+public:
+    // 服务端上下文，certFile/keyFile为PEM格式
+    static std::shared_ptr<TlsContext> newServerContext(const std::string &certFile,
+                                                        const std::string &keyFile);
+    // 客户端上下文，caFile为空时不校验对端证书；连接指定了hostname时用系统默认的CA校验
+    static std::shared_ptr<TlsContext> newClientContext(const std::string &caFile = std::string());
+
+    ~TlsContext();
+
+    bool isServer() const { return server_; }
+
+    // 会话复用缓存的大小（服务端session cache / 客户端按对端保存的session个数）
+    void setSessionCacheSize(long size);
+    // 握手完成后把记录加密交给内核(kTLS)，默认开启，内核或套件不支持时自动退回用户态加密
+    void setKtls(bool on);
+
+    void* nativeHandle() const { return ctx_; }    // SSL_CTX*
+
+    // 客户端会话复用：按"主机名:端口"（没有主机名时按对端地址）保存/取出session，内部使用
+    void saveSession(const std::string &peer, void *session);
+    void* takeSession(const std::string &peer);
+
+private:
+    TlsContext(void *ctx, bool server);
+
+    void *ctx_;     // SSL_CTX*
+    bool server_;
+    long sessionCacheSize_;
+
+    std::mutex mutex_;  //保护下面的客户端session缓存
+    std::map<std::string, void*> sessions_;    // host:port => SSL_SESSION*
+};
+
+// 一条连接上的TLS状态，由TcpConnection持有，只在连接所属的loop线程中使用
+class TlsSession : noncopyable
+{
+public:
+    enum Result
+    {
+        kOk,
+        kWantRead,
+        kWantWrite,
+        kClosed,
+        kError,
+    };
+
+    // peer是客户端会话复用的key，服务端可以为空
+    // hostname是客户端期望的服务端主机名：握手时作为SNI发送，并校验证书，不匹配时握手失败
+    TlsSession(const std::shared_ptr<TlsContext> &ctx, int sockfd, const std::string &peer,
+               const std::string &hostname = std::string());
+    ~TlsSession();
+
+    // 非阻塞握手，返回kWantRead/kWantWrite时等待相应的Channel事件后再次调用
+    Result handshake();
+    bool handshakeDone() const { return handshakeDone_; }
+    // 握手后发送方向是否已经由内核kTLS加密，此时可以直接write
+    bool ktlsSend() const { return ktlsSend_; }
+    bool sessionReused() const;
+
+    // 解密数据追加到buf，返回读到的字节数
+    ssize_t read(Buffer *buf, Result *result);
+    // 加密发送，返回写出的明文字节数
+    ssize_t write(const void *data, size_t len, Result *result);
+    // 发送close_notify
+    void shutdown();
+
+    // 客户端收到新session时由OpenSSL回调，内部使用
+    void onNewSession(void *session);
+
+private:
+    Result toResult(int ret);
+
+    std::shared_ptr<TlsContext> context_;
+    void *ssl_;     // SSL*
+    std::string peer_;
+    bool handshakeDone_;
+    bool ktlsSend_;
+};
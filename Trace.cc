@@ -0,0 +1,226 @@
+#include "Trace.h"
+#include "CurrentThread.h"
+#include "SignalWatcher.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+
+struct TraceEvent
+{
+    int64_t timestampNs;
+    const char *name;
+    const char *argName;
+    uint64_t arg;
+    int32_t fd;
+    char phase;
+    char prefix[32];
+};
+
+// 一个线程的环形缓冲区，只有所属线程写；head是已经写入的事件总数
+struct TraceRing
+{
+    explicit TraceRing(size_t capacity)
+        : events(new TraceEvent[capacity]),
+          mask(capacity - 1),
+          head(0),
+          tid(CurrentThread::tid())
+    {}
+
+    std::unique_ptr<TraceEvent[]> events;
+    const size_t mask;
+    std::atomic<uint64_t> head;
+    const int tid;
+};
+
+std::mutex g_ringsMutex;
+// 线程退出后缓冲区仍然保留在这里，它的事件照样可以导出
+std::vector<std::shared_ptr<TraceRing>> g_rings;
+std::atomic<size_t> g_ringCapacity(64 * 1024);
+
+thread_local TraceRing *t_ring = nullptr;
+
+TraceRing* threadRing()
+{
+    if (t_ring == nullptr)
+    {
+        std::shared_ptr<TraceRing> ring(std::make_shared<TraceRing>(g_ringCapacity.load()));
+        std::lock_guard<std::mutex> lock(g_ringsMutex);
+        g_rings.push_back(ring);
+        t_ring = ring.get();
+    }
+    return t_ring;
+}
+
+int64_t nowNs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+size_t roundUpPowerOfTwo(size_t n)
+{
+    size_t capacity = 1;
+    while (capacity < n)
+    {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+// 只输出普通字符，避免破坏JSON
+void writeJsonChars(FILE *fp, const char *s)
+{
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            fputc('\\', fp);
+        }
+        if (static_cast<unsigned char>(*s) >= 0x20)
+        {
+            fputc(*s, fp);
+        }
+    }
+}
+
+void writeJsonString(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    writeJsonChars(fp, s);
+    fputc('"', fp);
+}
+
+} // namespace
+
+std::atomic<bool> Trace::enabled_(false);
+
+void Trace::enable(size_t eventsPerThread)
+{
+    g_ringCapacity = roundUpPowerOfTwo(eventsPerThread > 0 ? eventsPerThread : 1);
+    enabled_ = true;
+}
+
+void Trace::disable()
+{
+    enabled_ = false;
+}
+
+void Trace::record(char phase, const char *name, const char *argName, uint64_t arg,
+                   int fd, const char *prefix)
+{
+    TraceRing *ring = threadRing();
+    uint64_t index = ring->head.load(std::memory_order_relaxed);
+    TraceEvent &event = ring->events[index & ring->mask];
+    event.timestampNs = nowNs();
+    event.name = name;
+    event.argName = argName;
+    event.arg = arg;
+    event.fd = fd;
+    event.phase = phase;
+    if (prefix != nullptr)
+    {
+        strncpy(event.prefix, prefix, sizeof event.prefix - 1);
+        event.prefix[sizeof event.prefix - 1] = '\0';
+    }
+    else
+    {
+        event.prefix[0] = '\0';
+    }
+    ring->head.store(index + 1, std::memory_order_release);
+}
+
+int Trace::dump(const std::string &path)
+{
+    std::vector<std::shared_ptr<TraceRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(g_ringsMutex);
+        rings = g_rings;
+    }
+    FILE *fp = ::fopen(path.c_str(), "w");
+    if (fp == nullptr)
+    {
+        LOG_ERROR("Trace::dump open %s fail : %d \n", path.c_str(), errno);
+        return -1;
+    }
+
+    int pid = ::getpid();
+    int written = 0;
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (const std::shared_ptr<TraceRing> &ring : rings)
+    {
+        fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"tid %d\"}}",
+            written > 0 ? ",\n" : "", pid, ring->tid, ring->tid);
+        ++written;
+
+        // 先复制再检查：复制期间被写线程覆盖掉的最旧事件丢弃
+        size_t capacity = ring->mask + 1;
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > capacity ? head - capacity : 0;
+        std::vector<TraceEvent> events(head - first);
+        for (uint64_t i = first; i < head; ++i)
+        {
+            events[i - first] = ring->events[i & ring->mask];
+        }
+        uint64_t headAfter = ring->head.load(std::memory_order_acquire);
+        uint64_t valid = headAfter > capacity ? headAfter - capacity : 0;
+
+        for (uint64_t i = std::max(first, valid); i < head; ++i)
+        {
+            const TraceEvent &e = events[i - first];
+            fprintf(fp, ",\n{\"ph\":\"%c\",\"name\":", e.phase);
+            writeJsonString(fp, e.name);
+            fprintf(fp, ",\"pid\":%d,\"tid\":%d,\"ts\":%.3f", pid, ring->tid, e.timestampNs / 1000.0);
+            if (e.phase == 'i')
+            {
+                fprintf(fp, ",\"s\":\"t\"");
+            }
+            if (e.fd >= 0 || e.argName != nullptr || e.prefix[0] != '\0')
+            {
+                const char *sep = "";
+                fprintf(fp, ",\"args\":{");
+                if (e.fd >= 0)
+                {
+                    fprintf(fp, "\"fd\":%d", e.fd);
+                    sep = ",";
+                }
+                if (e.prefix[0] != '\0')
+                {
+                    fprintf(fp, "%s\"conn\":\"", sep);
+                    writeJsonChars(fp, e.prefix);
+                    fprintf(fp, "#%lu\"", static_cast<unsigned long>(e.arg));
+                }
+                else if (e.argName != nullptr)
+                {
+                    fprintf(fp, "%s", sep);
+                    writeJsonString(fp, e.argName);
+                    fprintf(fp, ":%lu", static_cast<unsigned long>(e.arg));
+                }
+                fputc('}', fp);
+            }
+            fputc('}', fp);
+            ++written;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    ::fclose(fp);
+    LOG_INFO("Trace::dump %d events to %s \n", written, path.c_str());
+    return written;
+}
+
+std::unique_ptr<SignalWatcher> Trace::dumpOnSignal(EventLoop *loop, int signo, const std::string &path)
+{
+    return std::unique_ptr<SignalWatcher>(new SignalWatcher(loop, {signo}, [path](int) {
+        Trace::dump(path);
+    }));
+}
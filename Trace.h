@@ -0,0 +1,83 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+
+class EventLoop;
+class SignalWatcher;
+
+// 事件追踪：每个线程把begin/end事件写进自己的环形缓冲区，只有本线程写，不加锁，
+// 写满后覆盖最旧的事件；dump时导出为Chrome trace格式的JSON（chrome://tracing 或 ui.perfetto.dev）
+// 库里的埋点：poll等待、Channel::handleEvent（fd和连接名）、doPendingFunctors批次、跨线程的queueInLoop
+// 没有开启时每个埋点只有一次分支判断
+class Trace : noncopyable
+{
+public:
+    // eventsPerThread向上取整到2的幂，只对之后第一次记录事件的线程生效
+    static void enable(size_t eventsPerThread = 64 * 1024);
+    static void disable();
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // name、argName必须是静态字符串，缓冲区里只保存指针
+    static void begin(const char *name, const char *argName = nullptr, uint64_t arg = 0)
+    {
+        if (enabled())
+        {
+            record('B', name, argName, arg, -1, nullptr);
+        }
+    }
+    static void end(const char *name)
+    {
+        if (enabled())
+        {
+            record('E', name, nullptr, 0, -1, nullptr);
+        }
+    }
+    static void instant(const char *name, const char *argName = nullptr, uint64_t arg = 0)
+    {
+        if (enabled())
+        {
+            record('i', name, argName, arg, -1, nullptr);
+        }
+    }
+    // fd上的事件，prefix非空时在导出的参数中显示为连接名"prefix#id"（prefix会被复制，最多31个字节）
+    static void beginFd(const char *name, int fd, const char *prefix, uint64_t id)
+    {
+        if (enabled())
+        {
+            record('B', name, nullptr, id, fd, prefix);
+        }
+    }
+
+    // 把所有线程缓冲区中的事件写到path，可以在任意线程调用，返回写出的事件数，失败返回-1
+    // 追踪仍在进行时导出，正在被覆盖的最旧事件会被丢弃
+    static int dump(const std::string &path);
+    // 在loop中处理signo（如SIGUSR2），收到时dump到path；和SignalWatcher一样要在启动其他线程之前调用
+    static std::unique_ptr<SignalWatcher> dumpOnSignal(EventLoop *loop, int signo, const std::string &path);
+
+private:
+    static void record(char phase, const char *name, const char *argName, uint64_t arg,
+                       int fd, const char *prefix);
+
+    static std::atomic<bool> enabled_;
+};
+
+// 作用域内的一对begin/end
+class TraceScope : noncopyable
+{
+public:
+    explicit TraceScope(const char *name, const char *argName = nullptr, uint64_t arg = 0)
+        : name_(name)
+    {
+        Trace::begin(name, argName, arg);
+    }
+    ~TraceScope() { Trace::end(name_); }
+
+private:
+    const char *name_;
+};
@@ -0,0 +1,363 @@
+#include "UdpServer.h"
+#include "EventLoop.h"
+#include "EventLoopThreadPool.h"
+#include "logger.h"
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+static int createUdpSocket(const InetAddress &listenAddr)
+{
+    int sockfd = ::socket(listenAddr.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (sockfd < 0)
+    {
+        LOG_FATAL("%s: %s : %d udp socket create err: %d \n", __FILE__, __FUNCTION__, __LINE__, errno);
+    }
+    int on = 1;
+    ::setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    ::setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on);
+    if (::bind(sockfd, listenAddr.getSockAddr(), listenAddr.getSockLen()) != 0)
+    {
+        LOG_FATAL("bind udp sockfd fail : %d errno : %d \n", sockfd, errno);
+    }
+    return sockfd;
+}
+
+UdpEndpoint::UdpEndpoint(EventLoop *loop, const InetAddress &listenAddr, const UdpOptions &options)
+    : loop_(loop),
+    sockfd_(createUdpSocket(listenAddr)),
+    channel_(loop, sockfd_),
+    options_(options),
+    pendingSends_(0),
+    inReadBatch_(false),
+    flushScheduled_(false),
+    datagramsReceived_(0),
+    datagramsSent_(0),
+    datagramsDropped_(0),
+    recvBatches_(0)
+{
+    if (options_.batchSize <= 0)
+    {
+        options_.batchSize = 1;
+    }
+    if (options_.gro)
+    {
+        int on = 1;
+        if (::setsockopt(sockfd_, IPPROTO_UDP, UDP_GRO, &on, sizeof on) < 0)
+        {
+            LOG_ERROR("setsockopt UDP_GRO fail : %d, GRO disabled \n", errno);
+            options_.gro = false;
+        }
+        else if (options_.maxDatagramSize < 65536)
+        {
+            options_.maxDatagramSize = 65536;   //合并后的报文最大64K
+        }
+    }
+
+    const size_t batch = static_cast<size_t>(options_.batchSize);
+    const size_t controlLen = CMSG_SPACE(sizeof(int));
+    recvPool_.resize(batch * options_.maxDatagramSize);
+    recvControl_.resize(batch * controlLen);
+    recvIov_.resize(batch);
+    recvAddrs_.resize(batch);
+    recvMsgs_.resize(batch);
+    for (size_t i = 0; i < batch; ++i)
+    {
+        recvIov_[i].iov_base = &recvPool_[i * options_.maxDatagramSize];
+        recvIov_[i].iov_len = options_.maxDatagramSize;
+    }
+
+    sendPool_.resize(batch * options_.maxDatagramSize);
+    sendIov_.resize(batch);
+    sendAddrs_.resize(batch);
+    sendMsgs_.resize(batch);
+
+    channel_.setReadCallback(std::bind(&UdpEndpoint::handleRead, this, std::placeholders::_1));
+}
+
+UdpEndpoint::~UdpEndpoint()
+{
+    channel_.disableAll();
+    channel_.remove();
+    ::close(sockfd_);
+}
+
+void UdpEndpoint::start()
+{
+    channel_.enabeReading();
+}
+
+void UdpEndpoint::handleRead(Timestamp receiveTime)
+{
+    const size_t batch = recvMsgs_.size();
+    const size_t controlLen = CMSG_SPACE(sizeof(int));
+    inReadBatch_ = true;
+    // 每次事件最多读若干批，避免一个高流量端口饿死同一loop上的其他事件
+    for (int round = 0; round < 4; ++round)
+    {
+        for (size_t i = 0; i < batch; ++i)
+        {
+            msghdr &hdr = recvMsgs_[i].msg_hdr;
+            hdr.msg_name = &recvAddrs_[i];
+            hdr.msg_namelen = sizeof(sockaddr_storage);
+            hdr.msg_iov = &recvIov_[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = options_.gro ? &recvControl_[i * controlLen] : nullptr;
+            hdr.msg_controllen = options_.gro ? controlLen : 0;
+            hdr.msg_flags = 0;
+            recvMsgs_[i].msg_len = 0;
+        }
+
+        int n = ::recvmmsg(sockfd_, &recvMsgs_[0], static_cast<unsigned int>(batch), MSG_DONTWAIT, nullptr);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                LOG_ERROR("UdpEndpoint::handleRead recvmmsg errno : %d \n", errno);
+            }
+            break;
+        }
+        ++recvBatches_;
+
+        for (int i = 0; i < n; ++i)
+        {
+            const msghdr &hdr = recvMsgs_[i].msg_hdr;
+            if (hdr.msg_flags & MSG_TRUNC)
+            {
+                ++datagramsDropped_;
+                continue;
+            }
+            const char *data = static_cast<const char*>(recvIov_[i].iov_base);
+            size_t len = recvMsgs_[i].msg_len;
+            size_t segment = len;
+            if (options_.gro)
+            {
+                for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+                     cmsg = CMSG_NXTHDR(const_cast<msghdr*>(&hdr), cmsg))
+                {
+                    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                    {
+                        int gsoSize = 0;
+                        memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof gsoSize);
+                        if (gsoSize > 0)
+                        {
+                            segment = static_cast<size_t>(gsoSize);
+                        }
+                    }
+                }
+            }
+
+            InetAddress peer(reinterpret_cast<const sockaddr*>(&recvAddrs_[i]), hdr.msg_namelen);
+            // GRO合并的报文按gso大小拆回原来的datagram
+            for (size_t off = 0; off < len; off += segment)
+            {
+                size_t segLen = std::min(segment, len - off);
+                ++datagramsReceived_;
+                if (datagramCallback_)
+                {
+                    datagramCallback_(this, peer, data + off, segLen, receiveTime);
+                }
+            }
+        }
+
+        if (static_cast<size_t>(n) < batch)
+        {
+            break;
+        }
+    }
+    inReadBatch_ = false;
+    flush();
+}
+
+void UdpEndpoint::sendTo(const InetAddress &peer, const void *data, size_t len)
+{
+    if (!loop_->isInLoopThread())
+    {
+        loop_->runInLoop(std::bind(&UdpEndpoint::sendToInLoop, this, peer,
+            std::string(static_cast<const char*>(data), len)));
+        return;
+    }
+    if (len > options_.maxDatagramSize)
+    {
+        // 超过发送池块大小的datagram直接发送
+        flush();
+        ssize_t n = ::sendto(sockfd_, data, len, 0, peer.getSockAddr(), peer.getSockLen());
+        if (n < 0)
+        {
+            ++datagramsDropped_;
+        }
+        else
+        {
+            ++datagramsSent_;
+        }
+        return;
+    }
+    if (pendingSends_ == static_cast<int>(sendMsgs_.size()))
+    {
+        flush();
+    }
+
+    const int i = pendingSends_++;
+    char *slot = &sendPool_[i * options_.maxDatagramSize];
+    memcpy(slot, data, len);
+    memcpy(&sendAddrs_[i], peer.getSockAddr(), peer.getSockLen());
+    sendIov_[i].iov_base = slot;
+    sendIov_[i].iov_len = len;
+    msghdr &hdr = sendMsgs_[i].msg_hdr;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.msg_name = &sendAddrs_[i];
+    hdr.msg_namelen = peer.getSockLen();
+    hdr.msg_iov = &sendIov_[i];
+    hdr.msg_iovlen = 1;
+
+    if (!inReadBatch_)
+    {
+        scheduleFlush();
+    }
+}
+
+void UdpEndpoint::sendToInLoop(const InetAddress &peer, const std::string &data)
+{
+    sendTo(peer, data.data(), data.size());
+}
+
+// 不在接收批次中产生的发送，在本轮循环的末尾统一flush
+void UdpEndpoint::scheduleFlush()
+{
+    if (!flushScheduled_)
+    {
+        flushScheduled_ = true;
+        loop_->queueInLoop(std::bind(&UdpEndpoint::flush, this));
+    }
+}
+
+void UdpEndpoint::flush()
+{
+    flushScheduled_ = false;
+    int sent = 0;
+    while (sent < pendingSends_)
+    {
+        int n = ::sendmmsg(sockfd_, &sendMsgs_[sent], static_cast<unsigned int>(pendingSends_ - sent), 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // 发送缓冲区满等情况，UDP直接丢弃剩余的datagram
+            LOG_ERROR("UdpEndpoint::flush sendmmsg errno : %d \n", errno);
+            datagramsDropped_ += pendingSends_ - sent;
+            break;
+        }
+        sent += n;
+        datagramsSent_ += n;
+    }
+    pendingSends_ = 0;
+}
+
+void UdpEndpoint::sendSegmented(const InetAddress &peer, const void *data, size_t len, uint16_t segmentSize)
+{
+    if (!loop_->isInLoopThread())
+    {
+        loop_->runInLoop(std::bind(&UdpEndpoint::sendSegmentedInLoop, this, peer,
+            std::string(static_cast<const char*>(data), len), segmentSize));
+        return;
+    }
+    if (segmentSize == 0 || len <= segmentSize)
+    {
+        sendTo(peer, data, len);
+        return;
+    }
+    flush();    //保证和之前攒批的datagram的顺序
+
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof control);
+    iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = len;
+    msghdr hdr;
+    memset(&hdr, 0, sizeof hdr);
+    hdr.msg_name = const_cast<sockaddr*>(peer.getSockAddr());
+    hdr.msg_namelen = peer.getSockLen();
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof control;
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof segmentSize);
+
+    const size_t segments = (len + segmentSize - 1) / segmentSize;
+    if (::sendmsg(sockfd_, &hdr, 0) >= 0)
+    {
+        datagramsSent_ += segments;
+        return;
+    }
+    // 内核或网卡不支持GSO，退回逐个发送
+    LOG_DEBUG("UdpEndpoint::sendSegmented UDP_SEGMENT fail errno : %d \n", errno);
+    const char *p = static_cast<const char*>(data);
+    for (size_t off = 0; off < len; off += segmentSize)
+    {
+        sendTo(peer, p + off, std::min(static_cast<size_t>(segmentSize), len - off));
+    }
+}
+
+void UdpEndpoint::sendSegmentedInLoop(const InetAddress &peer, const std::string &data, uint16_t segmentSize)
+{
+    sendSegmented(peer, data.data(), data.size(), segmentSize);
+}
+
+UdpServer::UdpServer(EventLoop *loop, const InetAddress &listenAddr, const std::string &nameArg)
+    : loop_(loop),
+    listenAddr_(listenAddr),
+    name_(nameArg),
+    threadPool_(new EventLoopThreadPool(loop, nameArg)),
+    started_(0)
+{
+}
+
+UdpServer::~UdpServer()
+{
+    // endpoint要在所属loop中析构；loop已经停止时排队的回调不会再执行，没有线程在用它的poller，直接析构
+    for (auto &ep : endpoints_)
+    {
+        EventLoop *loop = ep->getLoop();
+        if (loop->isInLoopThread() || !loop->isLooping())
+        {
+            ep.reset();
+        }
+        else
+        {
+            UdpEndpoint *endpoint = ep.release();
+            loop->runInLoop([endpoint]() { delete endpoint; });
+        }
+    }
+}
+
+void UdpServer::setThreadNum(int numThreads)
+{
+    threadPool_->setThreadNum(numThreads);
+}
+
+void UdpServer::start()
+{
+    if (started_++ == 0)
+    {
+        threadPool_->start(threadInitCallback_);
+        for (EventLoop *ioLoop : threadPool_->getAllLoops())
+        {
+            UdpEndpoint *endpoint = new UdpEndpoint(ioLoop, listenAddr_, options_);
+            endpoint->setDatagramCallback(datagramCallback_);
+            endpoints_.push_back(std::unique_ptr<UdpEndpoint>(endpoint));
+            ioLoop->runInLoop(std::bind(&UdpEndpoint::start, endpoint));
+        }
+        LOG_INFO("UdpServer [%s] started on %s with %zu sockets \n",
+            name_.c_str(), listenAddr_.toIpPort().c_str(), endpoints_.size());
+    }
+}
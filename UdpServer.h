@@ -0,0 +1,127 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "InetAddress.h"
+#include "Timestamp.h"
+#include "Channel.h"
+
+#include <sys/socket.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+
+class EventLoop;
+class EventLoopThreadPool;
+class UdpEndpoint;
+
+// 收到一个datagram的回调，data只在回调期间有效
+using DatagramCallback = std::function<void(UdpEndpoint*,
+                                            const InetAddress &peer,
+                                            const char *data,
+                                            size_t len,
+                                            Timestamp)>;
+
+struct UdpOptions
+{
+    int batchSize = 64;             // 一次recvmmsg/sendmmsg的消息个数
+    size_t maxDatagramSize = 2048;  // 接收缓冲池中每个消息的大小，开启GRO时至少64K
+    bool gro = false;               // UDP_GRO，内核把同一个流的多个datagram合并后一次上交
+};
+
+// 一个loop上的UDP socket，多个loop之间通过SO_REUSEPORT分担同一个端口的负载
+// 接收使用recvmmsg批量读到复用的缓冲池中，发送先攒批再sendmmsg
+class UdpEndpoint : noncopyable
+{
+public:
+    UdpEndpoint(EventLoop *loop, const InetAddress &listenAddr, const UdpOptions &options);
+    ~UdpEndpoint();
+
+    EventLoop* getLoop() const { return loop_; }
+    int fd() const { return sockfd_; }
+
+    void setDatagramCallback(const DatagramCallback &cb) { datagramCallback_ = cb; }
+    // 注册到loop的poller上，需在所属loop中调用
+    void start();
+
+    // 发送一个datagram，数据被拷贝进发送批次，在本轮读批次结束或本轮循环末尾统一sendmmsg
+    // 非所属loop线程调用时会拷贝数据并转到所属loop中执行
+    void sendTo(const InetAddress &peer, const void *data, size_t len);
+    // UDP_SEGMENT(GSO)：data按segmentSize切分成多个datagram，一次系统调用发给同一个对端
+    // 内核不支持时退回逐个datagram发送
+    void sendSegmented(const InetAddress &peer, const void *data, size_t len, uint16_t segmentSize);
+    // 立即发送已攒批的datagram
+    void flush();
+
+    uint64_t datagramsReceived() const { return datagramsReceived_; }
+    uint64_t datagramsSent() const { return datagramsSent_; }
+    uint64_t datagramsDropped() const { return datagramsDropped_; }
+    uint64_t recvBatches() const { return recvBatches_; }
+
+private:
+    void handleRead(Timestamp receiveTime);
+    void sendToInLoop(const InetAddress &peer, const std::string &data);
+    void sendSegmentedInLoop(const InetAddress &peer, const std::string &data, uint16_t segmentSize);
+    void scheduleFlush();
+
+    EventLoop *loop_;
+    const int sockfd_;
+    Channel channel_;
+    UdpOptions options_;
+    DatagramCallback datagramCallback_;
+
+    // 接收缓冲池，batchSize个maxDatagramSize大小的块，整个生命周期复用
+    std::vector<char> recvPool_;
+    std::vector<char> recvControl_;
+    std::vector<iovec> recvIov_;
+    std::vector<sockaddr_storage> recvAddrs_;
+    std::vector<mmsghdr> recvMsgs_;
+
+    // 发送批次
+    std::vector<char> sendPool_;
+    std::vector<iovec> sendIov_;
+    std::vector<sockaddr_storage> sendAddrs_;
+    std::vector<mmsghdr> sendMsgs_;
+    int pendingSends_;
+    bool inReadBatch_;      //正在处理接收批次，结束时统一flush
+    bool flushScheduled_;   //已经queueInLoop了flush
+
+    std::atomic<uint64_t> datagramsReceived_;
+    std::atomic<uint64_t> datagramsSent_;
+    std::atomic<uint64_t> datagramsDropped_;
+    std::atomic<uint64_t> recvBatches_;
+};
+
+// UDP服务器：每个loop一个绑定在同一端口上的SO_REUSEPORT socket
+class UdpServer : noncopyable
+{
+public:
+    using ThreadInitCallback = std::function<void(EventLoop*)>;
+
+    UdpServer(EventLoop *loop, const InetAddress &listenAddr, const std::string &nameArg);
+    ~UdpServer();
+
+    //设置底层subloop的个数，0表示只在baseloop上收发
+    void setThreadNum(int numThreads);
+    void setThreadInitCallback(const ThreadInitCallback &cb) { threadInitCallback_ = cb; }
+    void setDatagramCallback(const DatagramCallback &cb) { datagramCallback_ = cb; }
+    void setOptions(const UdpOptions &options) { options_ = options; }
+
+    void start();
+
+    const std::string& name() const { return name_; }
+    // start()之后可用，每个loop一个
+    const std::vector<std::unique_ptr<UdpEndpoint>>& endpoints() const { return endpoints_; }
+
+private:
+    EventLoop *loop_;   //baseloop
+    const InetAddress listenAddr_;
+    const std::string name_;
+    std::unique_ptr<EventLoopThreadPool> threadPool_;
+    UdpOptions options_;
+    DatagramCallback datagramCallback_;
+    ThreadInitCallback threadInitCallback_;
+    std::atomic_int started_;
+    std::vector<std::unique_ptr<UdpEndpoint>> endpoints_;
+};
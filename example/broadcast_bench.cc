@@ -0,0 +1,136 @@
+#include <mymuduo/BroadcastGroup.h>
+#include <mymuduo/TcpConnection.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/EventLoopThreadPool.h>
+#include <mymuduo/logger.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 广播扇出压测：用socketpair构造订阅者，主线程连续发布消息，等所有订阅者收完后统计耗时和堆内存峰值
+// naive：对每个订阅者调用一次send，每个连接一次拷贝和一次跨线程投递
+// group：BroadcastGroup，每条消息一个共享块，每个loop一次投递
+// 订阅者一侧由单独的线程用epoll读到栈上的缓冲区，堆内存的变化只来自发送一侧
+// 用法：./broadcast_bench [naive|group] [订阅者数] [loop线程数] [消息大小] [消息条数]
+
+std::atomic<uint64_t> g_received(0);
+
+void readSubscribers(int epfd)
+{
+    char buf[64 * 1024];
+    struct epoll_event events[256];
+    for (;;)
+    {
+        int n = ::epoll_wait(epfd, events, 256, 100);
+        for (int i = 0; i < n; ++i)
+        {
+            ssize_t nread;
+            while ((nread = ::read(events[i].data.fd, buf, sizeof buf)) > 0)
+            {
+                g_received += nread;
+            }
+        }
+    }
+}
+
+size_t heapInUse()
+{
+    return mallinfo2().uordblks;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string mode = argc > 1 ? argv[1] : "group";
+    int numSubscribers = argc > 2 ? atoi(argv[2]) : 1000;
+    int numThreads = argc > 3 ? atoi(argv[3]) : 4;
+    int messageSize = argc > 4 ? atoi(argv[4]) : 1024;
+    int numMessages = argc > 5 ? atoi(argv[5]) : 100;
+
+    EventLoop baseLoop;
+    EventLoopThreadPool pool(&baseLoop, "broadcast");
+    pool.setThreadNum(numThreads);
+    pool.start();
+
+    std::vector<TcpConnectionPtr> publishers;
+    std::shared_ptr<const std::string> prefix = std::make_shared<const std::string>("broadcast");
+    InetAddress addr;
+    int epfd = ::epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < numSubscribers; ++i)
+    {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0)
+        {
+            LOG_FATAL("socketpair error : %d \n", errno);
+        }
+        TcpConnectionPtr conn(new TcpConnection(pool.getNextLoop(), i, prefix, fds[0], addr, addr));
+        conn->setConnectionCallback([](const TcpConnectionPtr&) {});
+        conn->setCloseCallback([](const TcpConnectionPtr&) {});
+        conn->setMessageCallback([](const TcpConnectionPtr&, Buffer *buf, Timestamp) { buf->retrieveAll(); });
+        conn->getLoop()->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+        publishers.push_back(conn);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = fds[1];
+        ::epoll_ctl(epfd, EPOLL_CTL_ADD, fds[1], &ev);
+    }
+    std::thread reader(readSubscribers, epfd);
+    reader.detach();
+
+    BroadcastGroup group;
+    for (const TcpConnectionPtr &conn : publishers)
+    {
+        group.add(conn);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));    //等连接建立
+
+    const std::string message(messageSize, 'b');
+    const uint64_t expected = static_cast<uint64_t>(numSubscribers) * messageSize * numMessages;
+    size_t heapBefore = heapInUse();
+    size_t heapPeak = heapBefore;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numMessages; ++i)
+    {
+        if (mode == "naive")
+        {
+            for (const TcpConnectionPtr &conn : publishers)
+            {
+                conn->send(message);
+            }
+        }
+        else
+        {
+            group.broadcast(message);
+        }
+        heapPeak = std::max(heapPeak, heapInUse());
+    }
+    double publishSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    while (g_received < expected)
+    {
+        heapPeak = std::max(heapPeak, heapInUse());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%s subscribers %d threads %d size %d messages %d\n",
+        mode.c_str(), numSubscribers, numThreads, messageSize, numMessages);
+    printf("  publish %.1f ms, delivered %.1f ms, %.0f deliveries/s\n",
+        publishSeconds * 1000, seconds * 1000, numSubscribers * static_cast<double>(numMessages) / seconds);
+    printf("  heap peak +%.1f MB, loop tasks %lu\n",
+        (static_cast<double>(heapPeak) - heapBefore) / (1024 * 1024),
+        mode == "naive" ? static_cast<unsigned long>(numSubscribers) * numMessages
+                        : static_cast<unsigned long>(group.loopTasks()));
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,195 @@
+#include <mymuduo/Buffer.h>
+#include <mymuduo/BufferSearch.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+
+// Buffer查找内核压测：在一段随机文本里反复找行尾/分隔符，比较逐字节扫描、基于memchr的扫描
+// 和BufferSearch的各个实现，输出每种方式的扫描速度(MB/s)，并检查找到的位置个数一致
+// 用法：./buffer_search_bench [平均行长] [数据MB] [轮数]
+
+typedef std::function<const char*(const char*, const char*)> Finder;
+
+const char* naiveCRLF(const char *begin, const char *end)
+{
+    for (const char *p = begin; p + 1 < end; ++p)
+    {
+        if (p[0] == '\r' && p[1] == '\n')
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+const char* memchrCRLF(const char *begin, const char *end)
+{
+    for (const char *p = begin; p < end; ++p)
+    {
+        p = static_cast<const char*>(memchr(p, '\r', end - p));
+        if (p == nullptr || p + 1 >= end)
+        {
+            return nullptr;
+        }
+        if (p[1] == '\n')
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+const char* naiveEOL(const char *begin, const char *end)
+{
+    for (const char *p = begin; p < end; ++p)
+    {
+        if (*p == '\n')
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+const char* memchrEOL(const char *begin, const char *end)
+{
+    return static_cast<const char*>(memchr(begin, '\n', end - begin));
+}
+
+const char kDelimiters[] = " \t\r\n";
+const size_t kNumDelimiters = 4;
+
+const char* naiveAny(const char *begin, const char *end)
+{
+    for (const char *p = begin; p < end; ++p)
+    {
+        if (memchr(kDelimiters, *p, kNumDelimiters))
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+const char* strpbrkAny(const char *begin, const char *end)
+{
+    // 数据里没有'\0'，strpbrk会在末尾的'\0'停下
+    const char *p = strpbrk(begin, kDelimiters);
+    return p != nullptr && p < end ? p : nullptr;
+}
+
+// 从头到尾找出所有匹配，返回匹配个数
+size_t scanAll(const Finder &find, const char *begin, const char *end)
+{
+    size_t count = 0;
+    const char *p = begin;
+    while ((p = find(p, end)) != nullptr)
+    {
+        ++count;
+        ++p;
+    }
+    return count;
+}
+
+void run(const char *name, const Finder &find, const std::string &data, int rounds, size_t expected)
+{
+    const char *begin = data.data();
+    const char *end = begin + data.size();
+    size_t count = scanAll(find, begin, end);   //预热
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i)
+    {
+        count = scanAll(find, begin, end);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double mbps = static_cast<double>(data.size()) * rounds / seconds / (1024 * 1024);
+    printf("  %-16s %10.1f MB/s  matches=%zu%s\n", name, mbps, count, count == expected ? "" : "  MISMATCH");
+}
+
+void runImpls(const char *what, const std::string &data, int rounds, size_t expected,
+              const std::function<Finder()> &makeFinder)
+{
+    BufferSearch::Impl impls[] = { BufferSearch::kScalar, BufferSearch::kSSE2, BufferSearch::kAVX2 };
+    BufferSearch::Impl original = BufferSearch::impl();
+    for (BufferSearch::Impl impl : impls)
+    {
+        if (!BufferSearch::setImpl(impl))
+        {
+            printf("  %-16s unsupported\n", BufferSearch::implName(impl));
+            continue;
+        }
+        std::string name = std::string(what) + "/" + BufferSearch::implName(impl);
+        run(name.c_str(), makeFinder(), data, rounds, expected);
+    }
+    BufferSearch::setImpl(original);
+}
+
+int main(int argc, char *argv[])
+{
+    int lineLength = argc > 1 ? atoi(argv[1]) : 80;
+    int megabytes = argc > 2 ? atoi(argv[2]) : 16;
+    int rounds = argc > 3 ? atoi(argv[3]) : 10;
+
+    // 可打印字符组成的行，单词之间有空格，行尾是"\r\n"；行中夹杂一些孤立的'\r'
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<int> length(lineLength / 2, lineLength * 3 / 2);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::string data;
+    data.reserve(static_cast<size_t>(megabytes) * 1024 * 1024 + lineLength * 2);
+    while (data.size() < static_cast<size_t>(megabytes) * 1024 * 1024)
+    {
+        int n = length(rng);
+        for (int i = 0; i < n; ++i)
+        {
+            int r = percent(rng);
+            data.push_back(r < 12 ? ' ' : (r == 12 ? '\r' : static_cast<char>(letter(rng))));
+        }
+        data.append("\r\n");
+    }
+
+    // 通过Buffer接口走一遍，结果作为基准
+    Buffer buf;
+    buf.append(data.data(), data.size());
+    size_t lines = 0;
+    const char *crlf = buf.peek();
+    while ((crlf = buf.findCRLF(crlf)) != nullptr)
+    {
+        ++lines;
+        crlf += 2;
+    }
+    size_t eols = scanAll(memchrEOL, data.data(), data.data() + data.size());
+    size_t tokens = scanAll(naiveAny, data.data(), data.data() + data.size());
+
+    printf("data=%zuB avgLine=%d rounds=%d dispatch=%s\n",
+           data.size(), lineLength, rounds, BufferSearch::implName(BufferSearch::impl()));
+
+    printf("findCRLF (%zu lines)\n", lines);
+    run("naive", naiveCRLF, data, rounds, lines);
+    run("memchr", memchrCRLF, data, rounds, lines);
+    runImpls("buffer", data, rounds, lines, [] {
+        return Finder([](const char *b, const char *e) { return BufferSearch::findCRLF(b, e); });
+    });
+
+    printf("findEOL\n");
+    run("naive", naiveEOL, data, rounds, eols);
+    run("memchr", memchrEOL, data, rounds, eols);
+    runImpls("buffer", data, rounds, eols, [] {
+        return Finder([](const char *b, const char *e) { return BufferSearch::findByte(b, e, '\n'); });
+    });
+
+    printf("findAny \" \\t\\r\\n\"\n");
+    run("naive", naiveAny, data, rounds, tokens);
+    run("strpbrk", strpbrkAny, data, rounds, tokens);
+    runImpls("buffer", data, rounds, tokens, [] {
+        return Finder([](const char *b, const char *e) {
+            return BufferSearch::findAny(b, e, kDelimiters, kNumDelimiters);
+        });
+    });
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/ComputePool.h>
+#include <mymuduo/logger.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+
+// 把CPU密集的计算交给ComputePool的echo服务器
+// 每行一个整数n，返回不超过n的素数个数；计算在计算线程中并行执行，
+// 结果回到连接所属的loop上发送，同一个连接上的回复保持请求顺序
+// 用法：./compute_server [端口] [IO线程数] [计算线程数]
+
+static std::string countPrimes(long n)
+{
+    long count = 0;
+    for (long i = 2; i <= n; ++i)
+    {
+        bool prime = true;
+        for (long d = 2; d * d <= i; ++d)
+        {
+            if (i % d == 0)
+            {
+                prime = false;
+                break;
+            }
+        }
+        count += prime;
+    }
+    return std::to_string(n) + " " + std::to_string(count) + "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    uint16_t port = static_cast<uint16_t>(argc > 1 ? atoi(argv[1]) : 8000);
+    int ioThreads = argc > 2 ? atoi(argv[2]) : 2;
+    int computeThreads = argc > 3 ? atoi(argv[3]) : 0;
+
+    EventLoop loop;
+    ComputePool pool("ComputePool");
+    if (computeThreads > 0)
+    {
+        pool.setThreadNum(computeThreads);
+    }
+    pool.start();
+
+    TcpServer server(&loop, InetAddress(port), "ComputeServer");
+    server.setConnectionCallback([](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            conn->setContext(std::make_shared<ComputeSequence>(conn->getLoop()));
+        }
+    });
+    server.setMessageCallback([&pool](const TcpConnectionPtr &conn, Buffer *buf, Timestamp) {
+        ComputeSequencePtr sequence = std::static_pointer_cast<ComputeSequence>(conn->getContext());
+        for (;;)
+        {
+            const char *eol = static_cast<const char*>(memchr(buf->peek(), '\n', buf->readableBytes()));
+            if (eol == nullptr)
+            {
+                break;
+            }
+            long n = atol(std::string(buf->peek(), eol).c_str());
+            buf->retrieve(eol - buf->peek() + 1);
+
+            std::weak_ptr<TcpConnection> weakConn(conn);
+            pool.submit(sequence,
+                [n]() { return countPrimes(n); },
+                [weakConn](std::string reply) {
+                    TcpConnectionPtr conn = weakConn.lock();
+                    if (conn)
+                    {
+                        conn->send(std::move(reply));
+                    }
+                });
+        }
+    });
+    server.setThreadNum(ioThreads);
+    server.start();
+
+    LOG_INFO("ComputeServer listening on %d with %d compute threads \n", port, pool.numThreads());
+    loop.loop();
+    return 0;
+}
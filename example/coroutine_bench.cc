@@ -0,0 +1,112 @@
+#include <mymuduo/Coroutine.h>
+#include <mymuduo/EventLoopThreadPool.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 协程接口与回调接口的ping-pong对比：用socketpair构造成对的TcpConnection，统计每秒往返的消息数
+// 用法：./coroutine_bench [callback|coroutine] [连接对数] [loop线程数] [消息大小] [秒数]
+
+std::atomic<uint64_t> g_messages(0);
+
+static void onMessage(const TcpConnectionPtr &conn, Buffer *buf, Timestamp)
+{
+    ++g_messages;
+    conn->send(buf->retrieveAllAsString());
+}
+
+// 顺序写法的echo：读满一条消息再原样写回
+static co::Task<> echo(co::Connection conn, size_t size, bool initiator)
+{
+    if (initiator)
+    {
+        co_await conn.write(std::string(size, 'c'));
+    }
+    for (;;)
+    {
+        std::string message = co_await conn.read(size);
+        if (message.empty())
+        {
+            break;
+        }
+        ++g_messages;
+        co_await conn.write(std::move(message));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool coroutine = argc > 1 && strcmp(argv[1], "coroutine") == 0;
+    int numPairs = argc > 2 ? atoi(argv[2]) : 1000;
+    int numThreads = argc > 3 ? atoi(argv[3]) : 4;
+    size_t messageSize = argc > 4 ? atoi(argv[4]) : 64;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+
+    EventLoop baseLoop;
+    EventLoopThreadPool pool(&baseLoop, "coroutine");
+    pool.setThreadNum(numThreads);
+    pool.start();
+
+    std::vector<TcpConnectionPtr> conns;
+    std::shared_ptr<const std::string> prefix = std::make_shared<const std::string>("coroutine");
+    const std::string message(messageSize, 'p');
+    InetAddress addr;
+    uint64_t id = 0;
+    for (int i = 0; i < numPairs; ++i)
+    {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0)
+        {
+            LOG_FATAL("socketpair error : %d \n", errno);
+        }
+        for (int k = 0; k < 2; ++k)
+        {
+            TcpConnectionPtr conn(new TcpConnection(pool.getNextLoop(), ++id, prefix, fds[k], addr, addr));
+            conn->setConnectionCallback([](const TcpConnectionPtr&) {});
+            conn->setCloseCallback([](const TcpConnectionPtr&) {});
+            bool initiator = k == 0;
+            if (coroutine)
+            {
+                conn->getLoop()->runInLoop([conn, messageSize, initiator]() {
+                    conn->connectEstablished();
+                    co::spawn(conn->getLoop(), echo(co::Connection(conn), messageSize, initiator));
+                });
+            }
+            else
+            {
+                conn->setMessageCallback(onMessage);
+                conn->getLoop()->runInLoop([conn, message, initiator]() {
+                    conn->connectEstablished();
+                    if (initiator)
+                    {
+                        conn->send(message);
+                    }
+                });
+            }
+            conns.push_back(conn);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t last = 0;
+    for (int s = 0; s < seconds; ++s)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t now = g_messages.load();
+        printf("%d s: %lu messages/s\n", s + 1, now - last);
+        last = now;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%s pairs %d threads %d size %zu : %.0f messages/s\n", coroutine ? "coroutine" : "callback",
+        numPairs, numThreads, messageSize, g_messages.load() / elapsed);
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,52 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/SignalWatcher.h>
+#include <mymuduo/logger.h>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <vector>
+
+// 运行中伸缩IO线程的echo服务器
+// 开启负载均衡后，重连接集中的loop会把连接迁到空闲的loop；
+// kill -USR1 增加一个IO线程，kill -USR2 移除最后增加的IO线程（它上面的连接先迁到其他线程）
+// 用法：./elastic_server [端口] [IO线程数] [均衡间隔秒数]
+
+int main(int argc, char *argv[])
+{
+    uint16_t port = static_cast<uint16_t>(argc > 1 ? atoi(argv[1]) : 8000);
+    int ioThreads = argc > 2 ? atoi(argv[2]) : 2;
+    double interval = argc > 3 ? atof(argv[3]) : 1.0;
+
+    EventLoop loop;
+    // 信号要在启动IO线程之前屏蔽
+    std::vector<EventLoop*> added;
+    TcpServer server(&loop, InetAddress(port), "ElasticServer");
+    SignalWatcher signals(&loop, {SIGUSR1, SIGUSR2}, [&](int signo) {
+        if (signo == SIGUSR1)
+        {
+            added.push_back(server.addLoop());
+        }
+        else if (!added.empty())
+        {
+            server.removeLoop(added.back());
+            added.pop_back();
+        }
+        LOG_INFO("elastic_server: %lu connections, %lu migrations \n",
+            server.numConnections(), server.migrations());
+    });
+
+    server.setThreadNum(ioThreads);
+    server.setRebalance(interval, 0.2);
+    server.setConnectionCallback([](const TcpConnectionPtr &conn) {
+        if (conn->connected())
+        {
+            conn->setTcpNoDelay(true);
+        }
+    });
+    server.setMessageCallback([](const TcpConnectionPtr &conn, Buffer *buf, Timestamp) {
+        conn->send(buf->retrieveAllAsString());
+    });
+    server.start();
+    loop.loop();
+    return 0;
+}
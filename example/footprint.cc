@@ -0,0 +1,219 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/logger.h>
+
+#include <malloc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <memory>
+#include <string>
+
+// 统计每个空闲连接占用的内存
+// 父进程运行TcpServer，子进程建立N个连接后保持空闲；全部连接建立后统计父进程的堆内存和RSS增量
+// 用法：./footprint [连接数] [IO线程数] > /dev/null    （结果输出到stderr）
+// 100万连接需要两个进程各自的RLIMIT_NOFILE都不小于100万（root下会自动调高到fs.nr_open）
+// 客户端轮流使用127.0.0.x作为源地址，每个源地址最多kPerSourceIp个连接
+
+static const int kPerSourceIp = 20000;
+
+static size_t heapInUse()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static size_t residentBytes()
+{
+    long pages = 0;
+    long resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp)
+    {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(fp);
+    }
+    return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// /proc/net/sockstat中TCP一行的mem字段，单位是页
+static long kernelTcpPages()
+{
+    long pages = -1;
+    FILE *fp = fopen("/proc/net/sockstat", "r");
+    if (fp)
+    {
+        char line[256];
+        while (fgets(line, sizeof line, fp))
+        {
+            const char *mem = strstr(line, " mem ");
+            if (strncmp(line, "TCP:", 4) == 0 && mem)
+            {
+                pages = atol(mem + 5);
+            }
+        }
+        fclose(fp);
+    }
+    return pages;
+}
+
+static void raiseFdLimit(int want)
+{
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur >= static_cast<rlim_t>(want))
+    {
+        return;
+    }
+    rl.rlim_cur = want;
+    if (rl.rlim_max < rl.rlim_cur)
+    {
+        rl.rlim_max = rl.rlim_cur;  //需要root
+    }
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+    {
+        getrlimit(RLIMIT_NOFILE, &rl);
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        fprintf(stderr, "RLIMIT_NOFILE limited to %lu \n", static_cast<unsigned long>(rl.rlim_cur));
+    }
+}
+
+// 子进程：建立n个阻塞连接，然后等待父进程结束自己
+static void runClients(uint16_t port, int n, int readyFd)
+{
+    int made = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            fprintf(stderr, "client socket fail after %d connections : %s \n", made, strerror(errno));
+            break;
+        }
+        // 源端口在connect时按四元组分配，不受单个源地址28K个临时端口的限制
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof on);
+        sockaddr_in local;
+        memset(&local, 0, sizeof local);
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(0x7f000001 + i / kPerSourceIp);
+        ::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof local);
+
+        sockaddr_in server;
+        memset(&server, 0, sizeof server);
+        server.sin_family = AF_INET;
+        server.sin_port = htons(port);
+        server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&server), sizeof server) != 0)
+        {
+            fprintf(stderr, "client connect fail after %d connections : %s \n", made, strerror(errno));
+            ::close(fd);
+            break;
+        }
+        ++made;
+    }
+    ::write(readyFd, &made, sizeof made);
+    for (;;)
+    {
+        ::pause();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int numConns = argc > 1 ? atoi(argv[1]) : 100000;
+    int numThreads = argc > 2 ? atoi(argv[2]) : 1;
+    uint16_t port = 19999;
+    raiseFdLimit(numConns + 1024);
+
+    pid_t child = -1;
+    {
+        EventLoop loop;
+        TcpServer server(&loop, InetAddress(port, "127.0.0.1"), "Footprint");
+        std::atomic_int connected(0);
+        server.setConnectionCallback([&connected](const TcpConnectionPtr &conn) {
+            if (conn->connected())
+            {
+                ++connected;
+            }
+        });
+        server.setMessageCallback([](const TcpConnectionPtr &conn, Buffer *buf, Timestamp) {
+            conn->send(buf->retrieveAllAsString());
+        });
+        server.setThreadNum(numThreads);
+        server.start();
+
+        int pipeFds[2];
+        if (::pipe(pipeFds) != 0)
+        {
+            return 1;
+        }
+        size_t heapBefore = 0;
+        size_t rssBefore = 0;
+        long kernelBefore = 0;
+        // 等loop线程都启动、监听开始之后再取基准
+        loop.runAfter(0.2, [&]() {
+            malloc_trim(0);
+            heapBefore = heapInUse();
+            rssBefore = residentBytes();
+            kernelBefore = kernelTcpPages();
+            child = ::fork();
+            if (child == 0)
+            {
+                ::close(pipeFds[0]);
+                runClients(port, numConns, pipeFds[1]);
+                _exit(0);
+            }
+            ::close(pipeFds[1]);
+            ::fcntl(pipeFds[0], F_SETFL, O_NONBLOCK);
+            // baseloop要继续accept，不能阻塞在pipe上，定时检查子进程是否已经建立完连接
+            std::shared_ptr<int> made = std::make_shared<int>(-1);
+            loop.runEvery(0.2, [&, made]() {
+                if (*made < 0 && ::read(pipeFds[0], made.get(), sizeof(int)) != sizeof(int))
+                {
+                    *made = -1;
+                    return;
+                }
+                if (connected < *made || *made == 0)
+                {
+                    return;
+                }
+                double heap = static_cast<double>(heapInUse()) - static_cast<double>(heapBefore);
+                double rss = static_cast<double>(residentBytes()) - static_cast<double>(rssBefore);
+                long kernelAfter = kernelTcpPages();
+                fprintf(stderr, "connections : %d  io threads : %d \n", *made, numThreads);
+                fprintf(stderr, "heap  : %.1f MB  %.0f bytes/conn \n", heap / 1048576.0, heap / *made);
+                fprintf(stderr, "rss   : %.1f MB  %.0f bytes/conn \n", rss / 1048576.0, rss / *made);
+                if (kernelBefore >= 0)
+                {
+                    // 客户端和服务端的socket都在本机，内核内存是两端之和
+                    long bytes = (kernelAfter - kernelBefore) * sysconf(_SC_PAGESIZE);
+                    fprintf(stderr, "kernel tcp mem (both ends) : %.1f MB \n", bytes / 1048576.0);
+                }
+                loop.quit();
+            });
+        });
+        loop.loop();
+    }
+
+    // 服务器析构之后再结束客户端，避免析构期间还有连接在关闭
+    if (child > 0)
+    {
+        ::kill(child, SIGKILL);
+        ::waitpid(child, nullptr, 0);
+    }
+    return 0;
+}
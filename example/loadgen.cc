@@ -0,0 +1,412 @@
+#include <mymuduo/TcpClient.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/EventLoopThreadPool.h>
+#include <mymuduo/logger.h>
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 压测客户端：多个loop线程，每个连接一个TcpClient，向本机的echo服务发送固定大小的请求，
+// 按回显的字节数切分响应，记录每个请求的延迟，最后输出HDR风格的百分位分布
+// 闭环(-r 0)：每个连接保持depth个请求在途，收到一个响应立即补发一个，吞吐由服务端决定
+// 开环(-r 速率)：按固定速率安排请求，延迟从请求"本该发出"的时刻算起；连接在途已满时请求排队，
+//   排队时间同样计入延迟，服务端变慢时也不会少发请求（避免coordinated omission）
+// 用法：./loadgen [-p 端口] [-c 连接数] [-t loop线程数] [-s 请求大小] [-d 流水线深度]
+//                [-r 每秒请求数，0为闭环] [-D 压测秒数] [-w 预热秒数]
+
+int64_t nowNs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// 对数线性直方图（HdrHistogram的做法）：每个2的幂区间再等分为128格，相对误差小于1%
+class LatencyHistogram
+{
+public:
+    static const int kSubBucketBits = 7;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+
+    LatencyHistogram() : counts_((64 - kSubBucketBits + 1) * kSubBuckets, 0), total_(0), max_(0) {}
+
+    void record(int64_t value)
+    {
+        uint64_t v = value > 0 ? static_cast<uint64_t>(value) : 0;
+        ++counts_[indexOf(v)];
+        ++total_;
+        max_ = std::max(max_, v);
+    }
+
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < counts_.size(); ++i)
+        {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t total() const { return total_; }
+    uint64_t max() const { return max_; }
+
+    // 不小于percentile%样本的最小值（所在格子的上界）
+    uint64_t valueAt(double percentile) const
+    {
+        if (total_ == 0)
+        {
+            return 0;
+        }
+        uint64_t target = static_cast<uint64_t>(ceil(percentile / 100.0 * total_));
+        target = std::max<uint64_t>(target, 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i)
+        {
+            seen += counts_[i];
+            if (seen >= target)
+            {
+                return std::min(highestEquivalent(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t countAtOrBelow(uint64_t value) const
+    {
+        uint64_t seen = 0;
+        for (size_t i = 0; i <= indexOf(value) && i < counts_.size(); ++i)
+        {
+            seen += counts_[i];
+        }
+        return seen;
+    }
+
+private:
+    static size_t indexOf(uint64_t v)
+    {
+        if (v < static_cast<uint64_t>(kSubBuckets))
+        {
+            return static_cast<size_t>(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int bucket = msb - kSubBucketBits + 1;
+        size_t sub = static_cast<size_t>(v >> (bucket - 1)) - kSubBuckets;
+        return static_cast<size_t>(bucket) * kSubBuckets + sub;
+    }
+
+    static uint64_t highestEquivalent(size_t index)
+    {
+        size_t bucket = index / kSubBuckets;
+        uint64_t sub = index % kSubBuckets;
+        if (bucket == 0)
+        {
+            return sub;
+        }
+        return ((sub + kSubBuckets + 1) << (bucket - 1)) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t max_;
+};
+
+struct Options
+{
+    uint16_t port = 8000;
+    int connections = 100;
+    int threads = 4;
+    int size = 64;
+    int depth = 1;
+    double rate = 0;    //0为闭环
+    int seconds = 10;
+    int warmup = 2;
+};
+
+struct Worker;
+
+// 一个连接，只在所属loop线程中访问
+struct Session
+{
+    Worker *worker;
+    std::unique_ptr<TcpClient> client;
+    TcpConnectionPtr conn;
+    std::deque<int64_t> inflight;   //在途请求的计时起点，响应按序返回
+    size_t partial = 0;             //当前响应已经收到的字节数
+};
+
+// 每个loop一个
+struct Worker
+{
+    EventLoop *loop = nullptr;
+    std::vector<std::unique_ptr<Session>> sessions;
+    LatencyHistogram histogram;
+    bool recording = false;
+    // 开环
+    int64_t intervalNs = 0;
+    int64_t nextSendNs = 0;
+    size_t nextSession = 0;
+    std::deque<int64_t> backlog;    //已经到期、但所有连接都在途已满的请求的计划时刻
+};
+
+Options g_options;
+std::string g_payload;
+std::atomic<int> g_connected(0);
+std::atomic<uint64_t> g_responses(0);
+
+void sendRequest(Session *session, int64_t startNs)
+{
+    session->inflight.push_back(startNs);
+    session->conn->send(g_payload);
+}
+
+// 开环：把计划在startNs发出的请求交给一个在途未满的连接，都满时排队
+void dispatch(Worker *worker, int64_t startNs)
+{
+    size_t n = worker->sessions.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        Session *session = worker->sessions[worker->nextSession].get();
+        worker->nextSession = (worker->nextSession + 1) % n;
+        if (session->conn && session->inflight.size() < static_cast<size_t>(g_options.depth))
+        {
+            sendRequest(session, startNs);
+            return;
+        }
+    }
+    worker->backlog.push_back(startNs);
+}
+
+void onTick(Worker *worker)
+{
+    int64_t now = nowNs();
+    while (worker->nextSendNs <= now)
+    {
+        dispatch(worker, worker->nextSendNs);
+        worker->nextSendNs += worker->intervalNs;
+    }
+}
+
+void onConnection(Session *session, const TcpConnectionPtr &conn)
+{
+    if (conn->connected())
+    {
+        conn->setTcpNoDelay(true);
+        session->conn = conn;
+        ++g_connected;
+        if (g_options.rate <= 0)
+        {
+            for (int i = 0; i < g_options.depth; ++i)
+            {
+                sendRequest(session, nowNs());
+            }
+        }
+    }
+    else
+    {
+        session->conn.reset();
+        session->inflight.clear();
+        session->partial = 0;
+        --g_connected;
+    }
+}
+
+void onMessage(Session *session, const TcpConnectionPtr&, Buffer *buf, Timestamp)
+{
+    Worker *worker = session->worker;
+    size_t size = static_cast<size_t>(g_options.size);
+    size_t bytes = session->partial + buf->readableBytes();
+    buf->retrieveAll();
+    int64_t now = nowNs();
+    while (bytes >= size && !session->inflight.empty())
+    {
+        bytes -= size;
+        if (worker->recording)
+        {
+            worker->histogram.record(now - session->inflight.front());
+        }
+        session->inflight.pop_front();
+        ++g_responses;
+
+        if (g_options.rate <= 0)
+        {
+            sendRequest(session, now);
+        }
+        else if (!worker->backlog.empty())
+        {
+            sendRequest(session, worker->backlog.front());
+            worker->backlog.pop_front();
+        }
+    }
+    session->partial = bytes;
+}
+
+void startOpenLoop(Worker *worker)
+{
+    if (worker->sessions.empty())
+    {
+        return;
+    }
+    double share = static_cast<double>(worker->sessions.size()) / g_options.connections;
+    worker->intervalNs = static_cast<int64_t>(1e9 / (g_options.rate * share));
+    worker->nextSendNs = nowNs();
+    // 定时器的粒度会计入延迟（请求从计划时刻算起），按发送间隔取100us~1ms
+    double tick = std::min(0.001, std::max(0.0001, worker->intervalNs / 1e9));
+    worker->loop->runEvery(tick, std::bind(&onTick, worker));
+}
+
+void printHistogram(const LatencyHistogram &h, double seconds)
+{
+    printf("\n  Latency Distribution (HdrHistogram style, us)\n");
+    printf("  %12s %12s %12s %16s\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+    // 每次把剩余的尾部减半：0, 50, 75, 87.5 ... 直到覆盖最大值
+    for (int k = 0; ; ++k)
+    {
+        double fraction = 1.0 - pow(0.5, k);
+        uint64_t value = h.valueAt(fraction * 100);
+        uint64_t count = h.countAtOrBelow(value);
+        printf("  %12.3f %12.6f %12lu %16.2f\n", value / 1000.0, fraction,
+            static_cast<unsigned long>(count), 1.0 / (1.0 - fraction));
+        if (count >= h.total() || k > 20)
+        {
+            break;
+        }
+    }
+    printf("  %12.3f %12.6f %12lu %16s\n", h.max() / 1000.0, 1.0,
+        static_cast<unsigned long>(h.total()), "inf");
+    printf("#[Max = %.3f, Total count = %lu, Requests/sec = %.0f]\n",
+        h.max() / 1000.0, static_cast<unsigned long>(h.total()), h.total() / seconds);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = ::getopt(argc, argv, "p:c:t:s:d:r:D:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p': g_options.port = static_cast<uint16_t>(atoi(optarg)); break;
+        case 'c': g_options.connections = atoi(optarg); break;
+        case 't': g_options.threads = atoi(optarg); break;
+        case 's': g_options.size = atoi(optarg); break;
+        case 'd': g_options.depth = atoi(optarg); break;
+        case 'r': g_options.rate = atof(optarg); break;
+        case 'D': g_options.seconds = atoi(optarg); break;
+        case 'w': g_options.warmup = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-c conns] [-t threads] [-s size] [-d depth] "
+                "[-r rate] [-D seconds] [-w warmup]\n", argv[0]);
+            return 1;
+        }
+    }
+    g_payload.assign(g_options.size, 'x');
+
+    EventLoop baseLoop;
+    EventLoopThreadPool pool(&baseLoop, "loadgen");
+    pool.setThreadNum(g_options.threads);
+    pool.start();
+
+    std::vector<EventLoop*> loops = pool.getAllLoops();
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (EventLoop *loop : loops)
+    {
+        workers.emplace_back(new Worker);
+        workers.back()->loop = loop;
+    }
+
+    InetAddress serverAddr(g_options.port);
+    for (int i = 0; i < g_options.connections; ++i)
+    {
+        Worker *worker = workers[i % workers.size()].get();
+        Session *session = new Session;
+        session->worker = worker;
+        session->client.reset(new TcpClient(worker->loop, serverAddr, "loadgen"));
+        session->client->setConnectionCallback(std::bind(&onConnection, session, std::placeholders::_1));
+        session->client->setMessageCallback(std::bind(&onMessage, session,
+            std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+        worker->sessions.emplace_back(session);
+    }
+    for (auto &worker : workers)
+    {
+        for (auto &session : worker->sessions)
+        {
+            session->client->connect();
+        }
+    }
+
+    for (int i = 0; i < 100 && g_connected < g_options.connections; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    printf("%d/%d connections to port %u, %d threads, size %d, depth %d, %s\n",
+        g_connected.load(), g_options.connections, g_options.port, g_options.threads,
+        g_options.size, g_options.depth,
+        g_options.rate > 0 ? ("open loop " + std::to_string(static_cast<long>(g_options.rate)) + " req/s").c_str()
+                           : "closed loop");
+    fflush(stdout);
+
+    if (g_options.rate > 0)
+    {
+        for (auto &worker : workers)
+        {
+            worker->loop->runInLoop(std::bind(&startOpenLoop, worker.get()));
+        }
+    }
+
+    uint64_t last = g_responses;
+    for (int s = 0; s < g_options.warmup + g_options.seconds; ++s)
+    {
+        if (s == g_options.warmup)
+        {
+            for (auto &worker : workers)
+            {
+                Worker *w = worker.get();
+                w->loop->runInLoop([w] { w->recording = true; });
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t now = g_responses;
+        printf("%d s%s: %lu responses/s\n", s + 1, s < g_options.warmup ? " (warmup)" : "",
+            static_cast<unsigned long>(now - last));
+        fflush(stdout);
+        last = now;
+    }
+
+    // 在各loop线程中取出直方图，合并后输出
+    LatencyHistogram total;
+    size_t backlog = 0;
+    for (auto &worker : workers)
+    {
+        Worker *w = worker.get();
+        std::promise<void> done;
+        w->loop->runInLoop([w, &total, &backlog, &done] {
+            w->recording = false;
+            total.merge(w->histogram);
+            backlog += w->backlog.size();
+            done.set_value();
+        });
+        done.get_future().wait();
+    }
+    printf("\n  50%% %.1fus  90%% %.1fus  99%% %.1fus  99.9%% %.1fus  99.99%% %.1fus  max %.1fus\n",
+        total.valueAt(50) / 1000.0, total.valueAt(90) / 1000.0, total.valueAt(99) / 1000.0,
+        total.valueAt(99.9) / 1000.0, total.valueAt(99.99) / 1000.0, total.max() / 1000.0);
+    if (backlog > 0)
+    {
+        printf("  %zu scheduled requests still waiting for a free connection\n", backlog);
+    }
+    printHistogram(total, g_options.seconds);
+    fflush(stdout);
+    _exit(0);
+}
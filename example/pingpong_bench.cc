@@ -0,0 +1,94 @@
+#include <mymuduo/TcpConnection.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/EventLoopThreadPool.h>
+#include <mymuduo/logger.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 多连接ping-pong压测：用socketpair构造成对的TcpConnection，统计每秒分发的消息数
+// 同时输出每条消息平均的epoll_ctl次数
+// 用法：./pingpong_bench [连接对数] [loop线程数] [消息大小] [秒数] [读模式 adaptive|fionread|pooled]
+
+std::atomic<uint64_t> g_messages(0);
+
+void onMessage(const TcpConnectionPtr &conn, Buffer *buf, Timestamp)
+{
+    ++g_messages;
+    conn->send(buf->retrieveAllAsString());
+}
+
+int main(int argc, char *argv[])
+{
+    int numPairs = argc > 1 ? atoi(argv[1]) : 1000;
+    int numThreads = argc > 2 ? atoi(argv[2]) : 4;
+    int messageSize = argc > 3 ? atoi(argv[3]) : 64;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+    std::string readMode = argc > 5 ? argv[5] : "adaptive";
+
+    EventLoop baseLoop;
+    EventLoopThreadPool pool(&baseLoop, "pingpong");
+    pool.setThreadNum(numThreads);
+    pool.start();
+
+    std::vector<TcpConnectionPtr> conns;
+    std::shared_ptr<const std::string> prefix = std::make_shared<const std::string>("pingpong");
+    const std::string message(messageSize, 'p');
+    InetAddress addr;
+    uint64_t id = 0;
+    for (int i = 0; i < numPairs; ++i)
+    {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0)
+        {
+            LOG_FATAL("socketpair error : %d \n", errno);
+        }
+        for (int fd : fds)
+        {
+            TcpConnectionPtr conn(new TcpConnection(pool.getNextLoop(), ++id, prefix, fd, addr, addr));
+            conn->setConnectionCallback([](const TcpConnectionPtr&) {});
+            conn->setCloseCallback([](const TcpConnectionPtr&) {});
+            conn->setMessageCallback(onMessage);
+            conn->setFionread(readMode == "fionread");
+            conn->setPooledInput(readMode == "pooled");
+            conn->getLoop()->runInLoop(std::bind(&TcpConnection::connectEstablished, conn));
+            conns.push_back(conn);
+        }
+    }
+    // 每对连接的一端发起第一条消息
+    for (size_t i = 0; i < conns.size(); i += 2)
+    {
+        conns[i]->send(message);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t last = 0;
+    for (int s = 0; s < seconds; ++s)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        uint64_t now = g_messages.load();
+        printf("%d s: %lu messages/s\n", s + 1, now - last);
+        last = now;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("pairs %d threads %d size %d read %s : %.0f messages/s\n",
+        numPairs, numThreads, messageSize, readMode.c_str(), g_messages.load() / elapsed);
+    // MUDUO_EPOLL_IMMEDIATE=1 时每次事件变化立即epoll_ctl，用来和默认的合并提交对比
+    uint64_t updates = 0, ctlCalls = 0;
+    for (EventLoop *loop : pool.getAllLoops())
+    {
+        updates += loop->interestUpdates();
+        ctlCalls += loop->epollCtlCalls();
+    }
+    printf("interest updates %lu, epoll_ctl %lu (%.3f per message)\n",
+        updates, ctlCalls, g_messages.load() > 0 ? static_cast<double>(ctlCalls) / g_messages.load() : 0.0);
+    fflush(stdout);
+    _exit(0);
+}
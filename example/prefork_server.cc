@@ -0,0 +1,57 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/Prefork.h>
+#include <mymuduo/HotRestart.h>
+#include <mymuduo/SignalWatcher.h>
+#include <mymuduo/logger.h>
+
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// prefork + 不停服升级的echo服务器
+// 用法：./prefork_server [端口] [worker个数] [控制socket]
+// 升级时直接启动新版本的./prefork_server，使用同一个控制socket：
+// 新进程从旧进程取走监听socket开始accept，旧进程的worker排空连接后退出，期间不会出现connection refused
+
+static int runWorker(int index, const std::vector<int> &listenFds)
+{
+    EventLoop loop;
+    TcpServer server(&loop, listenFds[0], "EchoServer-" + std::to_string(index));
+    server.setConnectionCallback([](const TcpConnectionPtr &conn) {
+        LOG_INFO("worker %d connection %s %s \n", getpid(),
+            conn->peerAddress().toIpPort().c_str(), conn->connected() ? "up" : "down");
+    });
+    server.setMessageCallback([](const TcpConnectionPtr &conn, Buffer *buf, Timestamp) {
+        conn->send(buf->retrieveAllAsString());
+    });
+    server.setThreadNum(2);
+
+    // 在启动线程池之前屏蔽SIGTERM，收到后停止accept，10秒内排空连接
+    SignalWatcher signals(&loop, {SIGTERM, SIGINT}, [&](int) {
+        server.drain(10.0, [&]() { loop.quit(); });
+    });
+
+    server.start();
+    loop.loop();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint16_t port = static_cast<uint16_t>(argc > 1 ? atoi(argv[1]) : 8000);
+    int numWorkers = argc > 2 ? atoi(argv[2]) : 4;
+    std::string controlPath = argc > 3 ? argv[3] : "@mymuduo-prefork-" + std::to_string(port);
+
+    std::vector<int> listenFds;
+    if (!HotRestart::inherit(controlPath, &listenFds))
+    {
+        listenFds.push_back(Acceptor::createListenSocket(InetAddress(port, "0.0.0.0")));
+    }
+
+    Prefork prefork(listenFds, numWorkers);
+    prefork.setControlPath(controlPath);
+    prefork.setDrainTimeout(10.0);
+    return prefork.run(runWorker);
+}
@@ -0,0 +1,137 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/logger.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 准入控制的回归检查：连接总数上限为1，依次建立kClients个连接
+// 不带kShedReject时超出上限的连接照常接纳、都能收到回显；带kShedReject时多出来的连接收到拒绝消息后被关闭
+// 用法：./shed_check，通过时退出码为0
+
+const int kClients = 3;
+const char kRejectMessage[] = "busy\n";
+
+uint16_t boundPort(int sockfd)
+{
+    sockaddr_in addr;
+    socklen_t len = sizeof addr;
+    ::getsockname(sockfd, reinterpret_cast<sockaddr*>(&addr), &len);
+    return ntohs(addr.sin_port);
+}
+
+int connectTo(uint16_t port)
+{
+    int sockfd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval tv = { 2, 0 };
+    ::setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0)
+    {
+        ::close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+// 发送"ping\n"后读到对端关闭或超时为止，返回收到的数据
+std::string exchange(int sockfd)
+{
+    ::send(sockfd, "ping\n", 5, MSG_NOSIGNAL);
+    std::string received;
+    char buf[64];
+    ssize_t n;
+    while (received.size() < 5 && (n = ::read(sockfd, buf, sizeof buf)) > 0)
+    {
+        received.append(buf, n);
+    }
+    return received;
+}
+
+// 依次建立kClients个连接，返回结果符合预期的个数：
+// 不拒绝时每个连接都应该收到回显，拒绝时第一个收到回显、其余收到拒绝消息
+int runClients(uint16_t port, bool reject)
+{
+    int passed = 0;
+    std::vector<int> clients;
+    for (int i = 0; i < kClients; ++i)
+    {
+        int sockfd = connectTo(port);
+        if (sockfd < 0)
+        {
+            continue;
+        }
+        clients.push_back(sockfd);
+        std::string expected = (reject && i > 0) ? kRejectMessage : "ping\n";
+        if (exchange(sockfd) == expected)
+        {
+            ++passed;
+        }
+    }
+    for (int sockfd : clients)
+    {
+        ::close(sockfd);
+    }
+    return passed;
+}
+
+void setupServer(TcpServer &server, int shedActions)
+{
+    server.setMaxConnections(1);
+    server.setShedPolicy(shedActions, kRejectMessage);
+    server.setConnectionCallback([](const TcpConnectionPtr&) {});
+    server.setMessageCallback([](const TcpConnectionPtr &conn, Buffer *buf, Timestamp) {
+        conn->send(buf->retrieveAllAsString());
+    });
+    server.start();
+}
+
+int main()
+{
+    ::signal(SIGPIPE, SIG_IGN);
+    EventLoop loop;
+
+    int acceptFd = Acceptor::createListenSocket(InetAddress(0, "127.0.0.1"));
+    uint16_t acceptPort = boundPort(acceptFd);
+    TcpServer acceptServer(&loop, acceptFd, "ShedAccept");
+    setupServer(acceptServer, TcpServer::kShedCloseIdle);
+
+    int rejectFd = Acceptor::createListenSocket(InetAddress(0, "127.0.0.1"));
+    uint16_t rejectPort = boundPort(rejectFd);
+    TcpServer rejectServer(&loop, rejectFd, "ShedReject");
+    setupServer(rejectServer, TcpServer::kShedReject);
+
+    // 客户端在单独的线程中用阻塞socket连接，服务端都在loop中
+    int accepted = 0;
+    int rejected = 0;
+    std::thread clients([&]() {
+        accepted = runClients(acceptPort, false);
+        rejected = runClients(rejectPort, true);
+        loop.quit();
+    });
+    loop.loop();
+    clients.join();
+
+    uint64_t acceptRejected = acceptServer.rejectedConnections();
+    uint64_t rejectRejected = rejectServer.rejectedConnections();
+    bool ok = accepted == kClients && acceptRejected == 0
+        && rejected == kClients && rejectRejected == static_cast<uint64_t>(kClients - 1);
+    fprintf(stderr, "shed_check: without kShedReject %d/%d served, %lu rejected; "
+        "with kShedReject %d/%d as expected, %lu rejected %s\n",
+        accepted, kClients, static_cast<unsigned long>(acceptRejected),
+        rejected, kClients, static_cast<unsigned long>(rejectRejected), ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
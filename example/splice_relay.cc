@@ -0,0 +1,335 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/TcpClient.h>
+#include <mymuduo/SpliceProxy.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/logger.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 四层转发：每个进来的连接向后端发起一个连接，两者之间双向转发
+// splice模式用SpliceProxy在内核中搬运，copy模式走TcpConnection的收发缓冲区（高水位时暂停读源）
+// 用法：./splice_relay 监听端口 后端ip 后端端口 [splice|copy] [IO线程数]
+//       ./splice_relay bench [每个连接的MB] [连接数] [splice|copy|both]
+// bench在本进程内起一个后端（收齐约定的字节数后回复收到的字节数）和若干客户端，
+// 分别用两种模式转发，输出吞吐和转发线程每GB消耗的CPU时间
+// （TcpConnection读到EOF就关闭整个连接，copy模式不支持半关闭，所以bench不用半关闭结束请求）
+
+class Relay
+{
+public:
+    Relay(EventLoop *loop, const InetAddress &listenAddr, const InetAddress &backend, bool splice)
+        : server_(loop, listenAddr, "Relay"),
+          backend_(backend),
+          splice_(splice)
+    {
+        server_.setConnectionCallback(std::bind(&Relay::onInbound, this, std::placeholders::_1));
+        server_.setMessageCallback(std::bind(&Relay::onInboundMessage, this,
+            std::placeholders::_1, std::placeholders::_2));
+    }
+
+    void setThreadNum(int numThreads) { server_.setThreadNum(numThreads); }
+    void start() { server_.start(); }
+
+private:
+    // 每个进来的连接一个会话，保存在连接的context中
+    struct Session
+    {
+        std::unique_ptr<TcpClient> client;
+        std::weak_ptr<TcpConnection> outbound;
+        std::string pending;    //copy模式下后端连上之前收到的数据
+    };
+
+    static const size_t kHighWaterMark = 4 * 1024 * 1024;
+
+    void onInbound(const TcpConnectionPtr &in)
+    {
+        if (in->connected())
+        {
+            std::shared_ptr<Session> session(std::make_shared<Session>());
+            session->client.reset(new TcpClient(in->getLoop(), backend_, "RelayBackend"));
+            std::weak_ptr<TcpConnection> weakIn(in);
+            session->client->setConnectionCallback([this, weakIn](const TcpConnectionPtr &out) {
+                onOutbound(weakIn, out);
+            });
+            session->client->setMessageCallback([weakIn](const TcpConnectionPtr&, Buffer *buf, Timestamp) {
+                TcpConnectionPtr in(weakIn.lock());
+                if (in)
+                {
+                    in->send(buf->retrieveAllAsString());
+                }
+            });
+            in->setContext(session);
+            if (splice_)
+            {
+                // 后端连上之前不再读，已经读到的数据由SpliceProxy接管时转发
+                in->stopRead();
+            }
+            session->client->connect();
+        }
+        else
+        {
+            // copy模式下一方关闭后，另一方发完缓冲区中的数据再关闭写端
+            std::shared_ptr<Session> session(std::static_pointer_cast<Session>(in->getContext()));
+            if (session)
+            {
+                session->client->disconnect();
+                // TcpClient析构时会关闭还没有结束的后端连接，放到回调之后
+                in->getLoop()->queueInLoop([session]() {});
+            }
+            in->setContext(std::shared_ptr<void>());
+        }
+    }
+
+    void onInboundMessage(const TcpConnectionPtr &in, Buffer *buf)
+    {
+        if (splice_)
+        {
+            return;     //留在输入缓冲区中，见onInbound
+        }
+        std::shared_ptr<Session> session(std::static_pointer_cast<Session>(in->getContext()));
+        TcpConnectionPtr out(session ? session->outbound.lock() : TcpConnectionPtr());
+        if (out && out->connected())
+        {
+            out->send(buf->retrieveAllAsString());
+        }
+        else if (session)
+        {
+            session->pending += buf->retrieveAllAsString();
+        }
+    }
+
+    void onOutbound(const std::weak_ptr<TcpConnection> &weakIn, const TcpConnectionPtr &out)
+    {
+        TcpConnectionPtr in(weakIn.lock());
+        if (!out->connected())
+        {
+            if (in && !splice_)
+            {
+                in->shutdown();
+            }
+            return;
+        }
+        if (!in || !in->connected())
+        {
+            out->forceClose();
+            return;
+        }
+        std::shared_ptr<Session> session(std::static_pointer_cast<Session>(in->getContext()));
+        session->outbound = out;
+        if (splice_)
+        {
+            SpliceProxy::start(in, out);
+            return;
+        }
+        // 两个方向都开启背压：对端的发送缓冲区超过高水位时暂停读源
+        in->setFlowControl(kHighWaterMark, kHighWaterMark / 2);
+        in->setBackpressureSource(out);
+        out->setFlowControl(kHighWaterMark, kHighWaterMark / 2);
+        out->setBackpressureSource(in);
+        if (!session->pending.empty())
+        {
+            out->send(session->pending);
+            session->pending.clear();
+        }
+    }
+
+    TcpServer server_;
+    InetAddress backend_;
+    bool splice_;
+};
+
+static int listenLoopback(uint16_t port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(fd, (sockaddr*)&addr, sizeof addr) < 0 || ::listen(fd, 128) < 0)
+    {
+        LOG_FATAL("bench backend listen %d err : %d \n", port, errno);
+    }
+    return fd;
+}
+
+static int connectLoopback(uint16_t port)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int retry = 0; retry < 100; ++retry)
+    {
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (::connect(fd, (sockaddr*)&addr, sizeof addr) == 0)
+        {
+            return fd;
+        }
+        ::close(fd);
+        usleep(10000);
+    }
+    LOG_FATAL("bench connect %d err : %d \n", port, errno);
+    return -1;
+}
+
+// 后端：每个连接收齐bytes字节（或读到EOF）后回复收到的字节数，等对方关闭
+static void runBackend(int listenfd, int connections, uint64_t bytes)
+{
+    std::vector<std::thread> threads;
+    for (int i = 0; i < connections; ++i)
+    {
+        int fd = ::accept(listenfd, nullptr, nullptr);
+        threads.emplace_back([fd, bytes] {
+            std::vector<char> buf(256 * 1024);
+            uint64_t total = 0;
+            ssize_t n;
+            while (total < bytes && (n = ::read(fd, buf.data(), buf.size())) > 0)
+            {
+                total += n;
+            }
+            std::string reply = std::to_string(total);
+            ssize_t written = ::write(fd, reply.data(), reply.size());
+            (void)written;
+            while (::read(fd, buf.data(), buf.size()) > 0)
+            {
+            }
+            ::close(fd);
+        });
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+}
+
+// 客户端：发送bytes字节，读回后端的回复，返回回复是否与发送的字节数一致
+static bool runClient(uint16_t port, uint64_t bytes)
+{
+    int fd = connectLoopback(port);
+    std::vector<char> buf(256 * 1024, 'r');
+    uint64_t sent = 0;
+    while (sent < bytes)
+    {
+        size_t len = static_cast<size_t>(std::min<uint64_t>(buf.size(), bytes - sent));
+        ssize_t n = ::write(fd, buf.data(), len);
+        if (n <= 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    const std::string expected = std::to_string(bytes);
+    std::string reply;
+    ssize_t n;
+    while (reply.size() < expected.size() && (n = ::read(fd, buf.data(), buf.size())) > 0)
+    {
+        reply.append(buf.data(), n);
+    }
+    ::close(fd);
+    return reply == expected;
+}
+
+static double threadCpuSeconds()
+{
+    rusage usage;
+    ::getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void bench(bool splice, uint64_t bytesPerConn, int connections, uint16_t relayPort, uint16_t backendPort)
+{
+    int listenfd = listenLoopback(backendPort);
+    EventLoop loop;
+    Relay relay(&loop, InetAddress(relayPort), InetAddress(backendPort), splice);
+    relay.start();
+
+    int ok = 0;
+    double elapsed = 0;
+    auto start = std::chrono::steady_clock::now();
+    // 后端看到转发过来的关闭后才结束，所以等后端结束再退出转发的loop
+    std::thread driver([&] {
+        std::thread backend(runBackend, listenfd, connections, bytesPerConn);
+        std::vector<std::thread> threads;
+        std::vector<char> results(connections, 0);
+        for (int i = 0; i < connections; ++i)
+        {
+            threads.emplace_back([&, i] { results[i] = runClient(relayPort, bytesPerConn); });
+        }
+        for (std::thread &t : threads)
+        {
+            t.join();
+        }
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (char r : results)
+        {
+            ok += r;
+        }
+        backend.join();
+        loop.quit();
+    });
+    double cpuStart = threadCpuSeconds();
+    loop.loop();
+    double cpu = threadCpuSeconds() - cpuStart;
+    driver.join();
+    ::close(listenfd);
+
+    double gb = static_cast<double>(bytesPerConn) * connections / (1024.0 * 1024 * 1024);
+    printf("%-6s : %d/%d transfers ok, %.0f MB/s, relay cpu %.2f s per GB\n",
+        splice ? "splice" : "copy", ok, connections, gb * 1024 / elapsed, cpu / gb);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    ::signal(SIGPIPE, SIG_IGN);
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        uint64_t mb = argc > 2 ? atoi(argv[2]) : 256;
+        int connections = argc > 3 ? atoi(argv[3]) : 4;
+        std::string mode = argc > 4 ? argv[4] : "both";
+        if (mode != "splice")
+        {
+            bench(false, mb * 1024 * 1024, connections, 9701, 9702);
+        }
+        if (mode != "copy")
+        {
+            bench(true, mb * 1024 * 1024, connections, 9703, 9704);
+        }
+        return 0;
+    }
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: %s listen_port backend_ip backend_port [splice|copy] [io_threads]\n"
+                        "       %s bench [MB_per_connection] [connections] [splice|copy|both]\n", argv[0], argv[0]);
+        return 1;
+    }
+    uint16_t port = static_cast<uint16_t>(atoi(argv[1]));
+    InetAddress backend(static_cast<uint16_t>(atoi(argv[3])), argv[2]);
+    bool splice = argc <= 4 || strcmp(argv[4], "copy") != 0;
+    int ioThreads = argc > 5 ? atoi(argv[5]) : 2;
+
+    EventLoop loop;
+    Relay relay(&loop, InetAddress(port, "0.0.0.0"), backend, splice);
+    relay.setThreadNum(ioThreads);
+    relay.start();
+    loop.loop();
+    return 0;
+}
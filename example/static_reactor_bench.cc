@@ -0,0 +1,152 @@
+#include <mymuduo/StaticReactor.h>
+#include <mymuduo/TcpConnection.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/logger.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 静态分发和动态分发的对比：同一个线程里用socketpair构造成对的连接做ping-pong，
+// 分别跑在EventLoop+TcpConnection（虚函数Poller、std::function回调）和sr::Reactor上，
+// 每条消息对应一次可读事件，输出每秒处理的事件数
+// 用法：./static_reactor_bench [连接对数] [消息大小] [秒数] [dynamic|static|both]
+
+uint64_t g_events = 0;
+
+void onMessage(const TcpConnectionPtr &conn, Buffer *buf, Timestamp)
+{
+    ++g_events;
+    conn->send(buf->retrieveAllAsString());
+}
+
+struct EchoHandler
+{
+    template <typename Conn>
+    void onConnection(Conn &) {}
+
+    template <typename Conn, typename Buf>
+    void onMessage(Conn &conn, Buf &buf)
+    {
+        ++g_events;
+        conn.send(buf.peek(), buf.readableBytes());
+        buf.retrieveAll();
+    }
+
+    template <typename Conn>
+    void onClose(Conn &) {}
+};
+
+std::vector<int> makePairs(int numPairs)
+{
+    std::vector<int> fds;
+    for (int i = 0; i < numPairs; ++i)
+    {
+        int pair[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) < 0)
+        {
+            LOG_FATAL("socketpair error : %d \n", errno);
+        }
+        fds.push_back(pair[0]);
+        fds.push_back(pair[1]);
+    }
+    return fds;
+}
+
+double runDynamic(int numPairs, int messageSize, int seconds)
+{
+    EventLoop loop;
+    std::vector<TcpConnectionPtr> conns;
+    std::shared_ptr<const std::string> prefix = std::make_shared<const std::string>("dynamic");
+    InetAddress addr;
+    uint64_t id = 0;
+    for (int fd : makePairs(numPairs))
+    {
+        TcpConnectionPtr conn(new TcpConnection(&loop, ++id, prefix, fd, addr, addr));
+        conn->setConnectionCallback([](const TcpConnectionPtr&) {});
+        conn->setCloseCallback([](const TcpConnectionPtr&) {});
+        conn->setMessageCallback(onMessage);
+        conn->connectEstablished();
+        conns.push_back(conn);
+    }
+    const std::string message(messageSize, 'p');
+    for (size_t i = 0; i < conns.size(); i += 2)
+    {
+        conns[i]->send(message);
+    }
+
+    g_events = 0;
+    auto start = std::chrono::steady_clock::now();
+    loop.runAfter(seconds, [&loop] { loop.quit(); });
+    loop.loop();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const TcpConnectionPtr &conn : conns)
+    {
+        conn->connectDestroyed();
+    }
+    return g_events / elapsed;
+}
+
+double runStatic(int numPairs, int messageSize, int seconds)
+{
+    sr::Reactor<EchoHandler> reactor;
+    std::vector<sr::Reactor<EchoHandler>::Connection*> conns;
+    for (int fd : makePairs(numPairs))
+    {
+        conns.push_back(reactor.adopt(fd));
+    }
+    const std::string message(messageSize, 'p');
+    for (size_t i = 0; i < conns.size(); i += 2)
+    {
+        conns[i]->send(message.data(), message.size());
+    }
+
+    g_events = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::thread timer([&reactor, seconds] {
+        std::this_thread::sleep_for(std::chrono::seconds(seconds));
+        reactor.quit();
+    });
+    reactor.loop();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    timer.join();
+    return g_events / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    int numPairs = argc > 1 ? atoi(argv[1]) : 100;
+    int messageSize = argc > 2 ? atoi(argv[2]) : 64;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    std::string mode = argc > 4 ? argv[4] : "both";
+
+    double dynamicRate = 0, staticRate = 0;
+    if (mode != "static")
+    {
+        dynamicRate = runDynamic(numPairs, messageSize, seconds);
+    }
+    if (mode != "dynamic")
+    {
+        staticRate = runStatic(numPairs, messageSize, seconds);
+    }
+    printf("pairs %d size %d\n", numPairs, messageSize);
+    if (dynamicRate > 0)
+    {
+        printf("dynamic (EventLoop + TcpConnection) : %.0f events/s\n", dynamicRate);
+    }
+    if (staticRate > 0)
+    {
+        printf("static  (sr::Reactor)               : %.0f events/s\n", staticRate);
+    }
+    if (dynamicRate > 0 && staticRate > 0)
+    {
+        printf("static / dynamic : %.2fx\n", staticRate / dynamicRate);
+    }
+    return 0;
+}
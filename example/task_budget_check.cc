@@ -0,0 +1,59 @@
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/logger.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <functional>
+
+// 回调预算的回归检查：每轮用一个紧急回调（不受预算限制）把普通回调补到kBacklog个，
+// 积压一直超过每轮的预算，检查已经执行的回调会及时从队列中删掉，堆内存不随轮数增长
+// 用法：./task_budget_check [预算用完的轮数]，通过时退出码为0
+
+// 大块内存（比如变大的vector）由mmap分配，不计在uordblks中
+size_t heapInUse()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t rounds = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000;
+    const size_t kBudget = 16;
+    const size_t kBacklog = 1000;
+
+    EventLoop loop;
+    loop.setTaskBudget(kBudget, 0);
+    uint64_t executed = 0;
+    size_t heapStart = 0;
+    size_t heapEnd = 0;
+
+    std::function<void()> refill = [&]() {
+        uint64_t exhausted = loop.taskBudgetExhausted();
+        if (heapStart == 0 && exhausted >= rounds / 10)
+        {
+            heapStart = heapInUse();
+        }
+        if (exhausted >= rounds)
+        {
+            heapEnd = heapInUse();
+            loop.quit();
+            return;
+        }
+        for (size_t n = loop.queueSize(); n < kBacklog; ++n)
+        {
+            loop.queueInLoop([&executed]() { ++executed; });
+        }
+        loop.queueUrgent(refill);
+    };
+    loop.queueUrgent(refill);
+    loop.loop();
+
+    double growthMb = (static_cast<double>(heapEnd) - heapStart) / (1024 * 1024);
+    bool ok = growthMb < 1.0;
+    fprintf(stderr, "task_budget_check: %lu rounds over budget, %lu tasks, heap growth %.2f MB %s\n",
+        static_cast<unsigned long>(loop.taskBudgetExhausted()), static_cast<unsigned long>(executed),
+        growthMb, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+#include <mymuduo/TcpConnection.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/EventLoopThread.h>
+#include <mymuduo/logger.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 拷贝发送与MSG_ZEROCOPY发送的对比：不同消息大小下的吞吐和发送线程每MB消耗的CPU时间
+// 用法：./zerocopy_bench [每轮秒数] [接收端ip:port]
+// 不指定接收端时在本进程内起一个回环接收线程；回环网卡上内核总会退回拷贝，
+// 要看到零拷贝的收益需要在另一台机器上运行接收端，如 nc -lk 9000 > /dev/null
+
+static const int kPipeline = 8;     // 每次写完成后再补充的消息个数
+
+static double threadCpuSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 回环接收端：逐个接受连接，读到的数据全部丢弃
+static void runSink(int listenFd)
+{
+    std::vector<char> buf(1024 * 1024);
+    for (;;)
+    {
+        int fd = ::accept(listenFd, nullptr, nullptr);
+        if (fd < 0)
+        {
+            return;
+        }
+        while (::read(fd, buf.data(), buf.size()) > 0)
+        {
+        }
+        ::close(fd);
+    }
+}
+
+struct RunResult
+{
+    uint64_t bytes;
+    double seconds;
+    double cpuSeconds;
+    uint64_t zcCompleted;
+    uint64_t zcCopied;
+    bool zeroCopy;
+};
+
+static RunResult runOnce(EventLoop *loop, const InetAddress &sink, size_t size, bool zeroCopy, int seconds)
+{
+    int fd = ::socket(sink.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (::connect(fd, sink.getSockAddr(), sink.getSockLen()) < 0)
+    {
+        LOG_FATAL("connect %s error : %d \n", sink.toIpPort().c_str(), errno);
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    static uint64_t id = 0;
+    std::shared_ptr<const std::string> prefix = std::make_shared<const std::string>("zerocopy");
+    TcpConnectionPtr conn(new TcpConnection(loop, ++id, prefix, fd, InetAddress(), sink));
+
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> sent(0);
+    auto refill = [&](const TcpConnectionPtr &c) {
+        if (!running)
+        {
+            return;
+        }
+        for (int i = 0; i < kPipeline; ++i)
+        {
+            // 每条消息都是新分配的，零拷贝时由连接持有到内核完成
+            c->send(std::string(size, 'z'));
+            sent += size;
+        }
+    };
+    conn->setConnectionCallback([](const TcpConnectionPtr&) {});
+    conn->setCloseCallback([](const TcpConnectionPtr&) {});
+    conn->setMessageCallback([](const TcpConnectionPtr&, Buffer *buf, Timestamp) { buf->retrieveAll(); });
+    conn->setWriteCompleteCallback(refill);
+
+    RunResult result;
+    std::promise<double> started;
+    loop->runInLoop([&]() {
+        result.zeroCopy = zeroCopy && conn->setZeroCopy(size);
+        conn->connectEstablished();
+        started.set_value(threadCpuSeconds());
+        refill(conn);
+    });
+    double cpuStart = started.get_future().get();
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+    std::promise<void> stopped;
+    loop->runInLoop([&]() {
+        running = false;
+        result.cpuSeconds = threadCpuSeconds() - cpuStart;
+        result.zcCompleted = conn->zeroCopyCompleted();
+        result.zcCopied = conn->zeroCopyCopied();
+        conn->forceClose();
+        loop->queueInLoop([&]() {
+            conn->connectDestroyed();
+            stopped.set_value();
+        });
+    });
+    stopped.get_future().get();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.bytes = sent.load();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+
+    InetAddress sink;
+    std::thread sinkThread;
+    int listenFd = -1;
+    if (argc > 2)
+    {
+        std::string hostPort(argv[2]);
+        size_t colon = hostPort.rfind(':');
+        sink = InetAddress(static_cast<uint16_t>(atoi(hostPort.c_str() + colon + 1)), hostPort.substr(0, colon));
+    }
+    else
+    {
+        listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof addr;
+        ::bind(listenFd, (sockaddr*)&addr, sizeof addr);
+        ::listen(listenFd, 16);
+        ::getsockname(listenFd, (sockaddr*)&addr, &len);
+        sink = InetAddress(addr);
+        sinkThread = std::thread(runSink, listenFd);
+    }
+
+    EventLoopThread loopThread;
+    EventLoop *loop = loopThread.startLoop();
+
+    printf("sink %s, %d s per run\n", sink.toIpPort().c_str(), seconds);
+    printf("%10s %10s %12s %14s %12s %12s\n", "size", "mode", "MB/s", "cpu us/MB", "zc done", "zc copied");
+    const size_t sizes[] = { 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+    for (size_t size : sizes)
+    {
+        for (int zc = 0; zc < 2; ++zc)
+        {
+            RunResult r = runOnce(loop, sink, size, zc == 1, seconds);
+            double mb = r.bytes / (1024.0 * 1024.0);
+            printf("%10zu %10s %12.1f %14.1f %12lu %12lu\n",
+                size, zc == 0 ? "copy" : (r.zeroCopy ? "zerocopy" : "zc-unsup"),
+                mb / r.seconds, r.cpuSeconds * 1e6 / mb, r.zcCompleted, r.zcCopied);
+            fflush(stdout);
+        }
+    }
+    _exit(0);
+}
@@ -39,7 +39,7 @@
 #define LOG_DEBUG(LogmsgFormat, ...) \
     do \
     {  \
-        Logger &logger = Logger::instance(); /* 修正拼写错误 */ \
+        Logger &logger = Logger::instace(); \
         logger.setLogLevel(DEBUG); \
         char buf[1024] = {0}; \
         snprintf(buf, 1024, LogmsgFormat, ##__VA_ARGS__); \